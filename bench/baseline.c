@@ -0,0 +1,214 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "baseline.h"
+
+/* Baselines are the JSON lines written by write_result, one scenario per
+   line, so reading them back only needs to find our own keys */
+
+#define NOISE_FACTOR (3.0)
+
+void write_result (FILE *file, result_t *result)
+{
+  fprintf (file, "{\"scenario\": \"%s\", \"category\": \"%s\", \"packets\": %d, \"rules\": %d, "
+                 "\"repetitions\": %d, \"ns_per_packet\": %.1f, \"spread\": %.4f, \"pps\": %.0f, "
+                 "\"rules_load_ms\": %.3f, \"rules_per_second\": %.0f, \"peak_rss_kb\": %ld",
+           result->scenario, result->category, result->packets, result->rules,
+           result->repetitions, result->ns_per_packet, result->spread, result->pps,
+           result->rules_load_ms, result->rules_per_second, result->peak_rss_kb);
+
+  /* Only known when built with -DBENCH_COUNT_ALLOCS */
+  if (result->allocations_per_packet >= 0)
+  {
+    fprintf (file, ", \"allocations_per_packet\": %.3f", result->allocations_per_packet);
+  }
+
+  if (result->native_ns_per_packet > 0)
+  {
+    fprintf (file, ", \"native_ns_per_packet\": %.1f, \"compile_ms\": %.1f",
+             result->native_ns_per_packet, result->compile_ms);
+  }
+
+  fprintf (file, "}\n");
+  fflush (file);
+}
+
+bool read_string (char *, char *, char *, int);
+double read_number (char *, char *);
+
+int read_baseline (char *filename, result_t **results)
+{
+  FILE *file = fopen (filename, "r");
+  if (file == NULL)
+  {
+    fprintf (stderr, "Could not open baseline %s\n", filename);
+    exit (EXIT_FAILURE);
+  }
+
+  char *line = NULL;
+  size_t allocated = 0;
+  int number = 0;
+
+  *results = NULL;
+
+  while (getline (&line, &allocated, file) != -1)
+  {
+    result_t result;
+
+    memset (&result, 0, sizeof (result_t));
+
+    if (read_string (line, "scenario", result.scenario, LINE_LENGTH) == false)
+    {
+      continue;
+    }
+
+    read_string (line, "category", result.category, STRING_LENGTH);
+
+    result.packets = (int) read_number (line, "packets");
+    result.rules = (int) read_number (line, "rules");
+    result.repetitions = (int) read_number (line, "repetitions");
+    result.ns_per_packet = read_number (line, "ns_per_packet");
+    result.spread = read_number (line, "spread");
+    result.pps = read_number (line, "pps");
+    result.allocations_per_packet = strstr (line, "\"allocations_per_packet\": ") != NULL ?
+                                    read_number (line, "allocations_per_packet") : -1;
+    result.rules_load_ms = read_number (line, "rules_load_ms");
+    result.rules_per_second = read_number (line, "rules_per_second");
+    result.peak_rss_kb = (long) read_number (line, "peak_rss_kb");
+    result.native_ns_per_packet = read_number (line, "native_ns_per_packet");
+    result.compile_ms = read_number (line, "compile_ms");
+
+    *results = (result_t *) realloc (*results, (number + 1) * sizeof (result_t));
+    (*results)[number++] = result;
+  }
+
+  free (line);
+  fclose (file);
+
+  return number;
+}
+
+bool read_string (char *line, char *key, char *value, int length)
+{
+  char pattern[LINE_LENGTH];
+
+  snprintf (pattern, LINE_LENGTH, "\"%s\": \"", key);
+
+  char *start = strstr (line, pattern);
+  if (start == NULL)
+  {
+    return false;
+  }
+
+  start += strlen (pattern);
+
+  char *finish = strchr (start, '"');
+  if (finish == NULL || finish - start >= length)
+  {
+    return false;
+  }
+
+  memcpy (value, start, finish - start);
+  value[finish - start] = '\0';
+
+  return true;
+}
+
+double read_number (char *line, char *key)
+{
+  char pattern[LINE_LENGTH];
+
+  snprintf (pattern, LINE_LENGTH, "\"%s\": ", key);
+
+  char *start = strstr (line, pattern);
+  if (start == NULL)
+  {
+    return 0;
+  }
+
+  return atof (start + strlen (pattern));
+}
+
+double percent_change (double, double);
+
+/* Prints per-scenario deltas against the baseline. A scenario regresses
+   when its time per packet grew by more than threshold percent and by
+   more than NOISE_FACTOR times the spread measured in either run.
+   Returns true if a matching or parsing scenario regressed. */
+bool compare_results (result_t *baseline, int number_of_baseline,
+                      result_t *results, int number_of_results, double threshold)
+{
+  bool regressed = false;
+
+  fprintf (stderr, "%-20s %12s %12s %9s %9s %10s %10s %10s  %s\n",
+           "scenario", "base ns/pkt", "new ns/pkt", "delta", "allowed", "allocs", "rss", "load", "verdict");
+
+  for (int i = 0; i < number_of_results; i++)
+  {
+    result_t *result = &(results[i]);
+    result_t *base = NULL;
+
+    for (int j = 0; j < number_of_baseline; j++)
+    {
+      if (strcmp (baseline[j].scenario, result->scenario) == 0)
+      {
+        base = &(baseline[j]);
+        break;
+      }
+    }
+
+    if (base == NULL)
+    {
+      fprintf (stderr, "%-20s %12s %12.1f %9s %9s %10s %10s %10s  new\n",
+               result->scenario, "-", result->ns_per_packet, "-", "-", "-", "-", "-");
+      continue;
+    }
+
+    double delta = percent_change (base->ns_per_packet, result->ns_per_packet);
+    double noise = 100.0 * NOISE_FACTOR * (base->spread > result->spread ? base->spread : result->spread);
+    double allowed = threshold > noise ? threshold : noise;
+
+    char *verdict = "ok";
+
+    if (delta > allowed)
+    {
+      verdict = "REGRESSION";
+
+      if (strcmp (result->category, "matching") == 0 || strcmp (result->category, "parsing") == 0)
+      {
+        regressed = true;
+      }
+    }
+    else if (delta < -allowed)
+    {
+      verdict = "improved";
+    }
+
+    char allocations[STRING_LENGTH] = "-";
+
+    if (base->allocations_per_packet >= 0 && result->allocations_per_packet >= 0)
+    {
+      snprintf (allocations, STRING_LENGTH, "%+.1f%%",
+                percent_change (base->allocations_per_packet, result->allocations_per_packet));
+    }
+
+    fprintf (stderr, "%-20s %12.1f %12.1f %8.1f%% %8.1f%% %10s %+9.1f%% %+9.1f%%  %s\n",
+             result->scenario, base->ns_per_packet, result->ns_per_packet, delta, allowed, allocations,
+             percent_change ((double) base->peak_rss_kb, (double) result->peak_rss_kb),
+             percent_change (base->rules_load_ms, result->rules_load_ms),
+             verdict);
+  }
+
+  return regressed;
+}
+
+double percent_change (double before, double after)
+{
+  if (before == 0)
+  {
+    return after == 0 ? 0 : 100.0;
+  }
+
+  return 100.0 * (after - before) / before;
+}
@@ -0,0 +1,34 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include "libraries.h"
+#include "definitions.h"
+
+/* Result of one benchmark scenario */
+typedef struct result_tag
+{
+  char scenario[LINE_LENGTH];
+  char category[STRING_LENGTH]; /* "matching" or "parsing" */
+
+  int packets;
+  int rules;
+  int repetitions;
+
+  double ns_per_packet; /* median over repetitions */
+  double spread; /* median absolute deviation relative to the median */
+  double pps;
+  double allocations_per_packet;
+  double rules_load_ms; /* median over repetitions */
+  double rules_per_second;
+  long peak_rss_kb;
+
+  double native_ns_per_packet; /* rules compiled to native code, 0 if not timed */
+  double compile_ms;
+}
+result_t;
+
+void write_result (FILE *, result_t *);
+int read_baseline (char *, result_t **);
+bool compare_results (result_t *, int, result_t *, int, double);
+
+#endif
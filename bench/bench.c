@@ -0,0 +1,611 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "rules.h"
+#include "process.h"
+#include "engine.h"
+#include "native.h"
+
+#include "generate.h"
+#include "baseline.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+/* End-to-end benchmark: generates synthetic captures and rule files, runs
+   the engine over them in-process and prints one JSON object per scenario */
+
+typedef struct scenario_tag
+{
+  char *name;
+  char *category;
+  traffic_t traffic;
+  rule_mix_t mix;
+}
+scenario_t;
+
+scenario_t scenarios[] = {
+  {.name = "tcp-small-10", .category = "parsing",
+   .traffic = {.packets = 200000, .flows = 1000, .payload_size = 64, .tcp_percent = 100, .http_percent = 0, .seed = 1},
+   .mix = {.rules = 10, .content_percent = 0, .match_percent = 20, .seed = 1}},
+  {.name = "mixed-100", .category = "matching",
+   .traffic = {.packets = 100000, .flows = 1000, .payload_size = 256, .tcp_percent = 80, .http_percent = 20, .seed = 2},
+   .mix = {.rules = 100, .content_percent = 30, .match_percent = 10, .seed = 2}},
+  {.name = "mixed-1k", .category = "matching",
+   .traffic = {.packets = 50000, .flows = 5000, .payload_size = 256, .tcp_percent = 80, .http_percent = 20, .seed = 3},
+   .mix = {.rules = 1000, .content_percent = 30, .match_percent = 10, .seed = 3}},
+  {.name = "content-1k", .category = "matching",
+   .traffic = {.packets = 50000, .flows = 5000, .payload_size = 512, .tcp_percent = 100, .http_percent = 20, .seed = 4},
+   .mix = {.rules = 1000, .content_percent = 100, .match_percent = 50, .seed = 4}},
+  {.name = "http-1k", .category = "matching",
+   .traffic = {.packets = 50000, .flows = 1000, .payload_size = 512, .tcp_percent = 100, .http_percent = 100, .seed = 5},
+   .mix = {.rules = 1000, .content_percent = 50, .match_percent = 50, .seed = 5}},
+  {.name = "udp-flows-100", .category = "parsing",
+   .traffic = {.packets = 100000, .flows = 100000, .payload_size = 128, .tcp_percent = 0, .http_percent = 0, .seed = 6},
+   .mix = {.rules = 100, .content_percent = 20, .match_percent = 20, .seed = 6}},
+  {.name = "large-payload-100", .category = "matching",
+   .traffic = {.packets = 20000, .flows = 100, .payload_size = 8000, .tcp_percent = 100, .http_percent = 10, .seed = 7},
+   .mix = {.rules = 100, .content_percent = 100, .match_percent = 20, .seed = 7}},
+  {.name = "windowed-100", .category = "matching",
+   .traffic = {.packets = 20000, .flows = 100, .payload_size = 8000, .tcp_percent = 100, .http_percent = 10, .seed = 7},
+   .mix = {.rules = 100, .content_percent = 100, .match_percent = 20, .seed = 7, .window_percent = 100}},
+  {.name = "rules-10k", .category = "matching",
+   .traffic = {.packets = 5000, .flows = 1000, .payload_size = 256, .tcp_percent = 80, .http_percent = 20, .seed = 8},
+   .mix = {.rules = 10000, .content_percent = 30, .match_percent = 10, .seed = 8}},
+  {.name = "rules-50k", .category = "matching",
+   .traffic = {.packets = 1000, .flows = 1000, .payload_size = 256, .tcp_percent = 80, .http_percent = 20, .seed = 9},
+   .mix = {.rules = 50000, .content_percent = 30, .match_percent = 10, .seed = 9}}
+};
+
+#define NUMBER_OF_SCENARIOS ((int) (sizeof (scenarios) / sizeof (scenarios[0])))
+
+/* Built with -DBENCH_COUNT_ALLOCS, allocations are counted by wrapping the
+   glibc allocator, so the engine itself stays free of benchmark hooks. The
+   wrappers replace malloc for the whole program, which sanitizers and
+   other allocator interposers do as well, so they are left out otherwise
+   and allocation_count returns -1. */
+#ifdef BENCH_COUNT_ALLOCS
+extern void *__libc_malloc (size_t);
+extern void *__libc_calloc (size_t, size_t);
+extern void *__libc_realloc (void *, size_t);
+extern void *__libc_memalign (size_t, size_t);
+
+long allocations_made = 0;
+
+void *malloc (size_t size)
+{
+  __atomic_add_fetch (&allocations_made, 1, __ATOMIC_RELAXED);
+  return __libc_malloc (size);
+}
+
+void *calloc (size_t number, size_t size)
+{
+  __atomic_add_fetch (&allocations_made, 1, __ATOMIC_RELAXED);
+  return __libc_calloc (number, size);
+}
+
+void *realloc (void *pointer, size_t size)
+{
+  __atomic_add_fetch (&allocations_made, 1, __ATOMIC_RELAXED);
+  return __libc_realloc (pointer, size);
+}
+
+int posix_memalign (void **pointer, size_t alignment, size_t size)
+{
+  if (alignment < sizeof (void *) || (alignment & (alignment - 1)) != 0)
+  {
+    return EINVAL;
+  }
+
+  __atomic_add_fetch (&allocations_made, 1, __ATOMIC_RELAXED);
+
+  void *allocated = __libc_memalign (alignment, size);
+  if (allocated == NULL)
+  {
+    return ENOMEM;
+  }
+
+  *pointer = allocated;
+
+  return 0;
+}
+
+void *aligned_alloc (size_t alignment, size_t size)
+{
+  __atomic_add_fetch (&allocations_made, 1, __ATOMIC_RELAXED);
+  return __libc_memalign (alignment, size);
+}
+
+long allocation_count (void)
+{
+  return __atomic_load_n (&allocations_made, __ATOMIC_RELAXED);
+}
+#else
+long allocation_count (void)
+{
+  return -1;
+}
+#endif
+
+/* Packets of one capture, read into memory before timing */
+typedef struct capture_tag
+{
+  int number;
+  int allocated;
+  struct pcap_pkthdr *headers;
+  u_char **data;
+}
+capture_t;
+
+#define DEFAULT_REPETITIONS (5)
+#define DEFAULT_THRESHOLD (5.0)
+
+void run_scenario (scenario_t *, char *, int, bool, result_t *);
+uint64_t hash_parameters (const int *, int);
+void time_packets (capture_t *, rule_t *, pcap_t *, int, double *, long *);
+void load_capture (capture_t *, char *, pcap_t **);
+void store_packet (u_char *, const struct pcap_pkthdr *, const u_char *);
+void free_capture (capture_t *);
+double seconds_since (struct timespec *);
+double median (double *, int);
+int compare_doubles (const void *, const void *);
+void reset_peak_rss (void);
+long peak_rss_kb (void);
+void print_usage (char *);
+
+int main (int argc, char *argv[])
+{
+  char *directory = "/tmp";
+  char *only = NULL;
+  FILE *results = stdout;
+  char *save_baseline = NULL;
+  char *compare_baseline = NULL;
+  int repetitions = DEFAULT_REPETITIONS;
+  double threshold = DEFAULT_THRESHOLD;
+  bool native = false;
+
+  int c;
+
+  while ((c = getopt (argc, argv, "d:s:o:n:b:c:t:lN")) != -1)
+  {
+    switch (c)
+    {
+    case 'd':
+      directory = optarg;
+      break;
+
+    case 's':
+      only = optarg;
+      break;
+
+    case 'o':
+      results = fopen (optarg, "w");
+      if (results == NULL)
+      {
+        fprintf (stderr, "Could not open %s\n", optarg);
+        exit (EXIT_FAILURE);
+      }
+      break;
+
+    case 'n':
+      repetitions = atoi (optarg);
+      if (repetitions < 1)
+      {
+        fprintf (stderr, "Number of repetitions must be positive\n");
+        exit (EXIT_FAILURE);
+      }
+      break;
+
+    case 'b':
+      save_baseline = optarg;
+      break;
+
+    case 'c':
+      compare_baseline = optarg;
+      break;
+
+    case 't':
+      threshold = atof (optarg);
+      if (threshold < 0)
+      {
+        fprintf (stderr, "Regression threshold must not be negative\n");
+        exit (EXIT_FAILURE);
+      }
+      break;
+
+    case 'N':
+      native = true;
+      break;
+
+    case 'l':
+      for (int i = 0; i < NUMBER_OF_SCENARIOS; i++)
+      {
+        printf ("%s\n", scenarios[i].name);
+      }
+      exit (EXIT_SUCCESS);
+
+    default:
+      print_usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  /* Alerts and reports of the engine go to /dev/null, results to a copy of stdout */
+  if (results == stdout)
+  {
+    results = fdopen (dup (STDOUT_FILENO), "w");
+  }
+
+  result_t *baseline = NULL;
+  int number_of_baseline = 0;
+
+  if (compare_baseline != NULL)
+  {
+    number_of_baseline = read_baseline (compare_baseline, &baseline);
+  }
+
+  int null_fd = open ("/dev/null", O_WRONLY);
+  int stdout_fd = dup (STDOUT_FILENO);
+
+  result_t measured[NUMBER_OF_SCENARIOS];
+  int number_of_measured = 0;
+
+  for (int i = 0; i < NUMBER_OF_SCENARIOS; i++)
+  {
+    if (only != NULL && strstr (scenarios[i].name, only) == NULL)
+    {
+      continue;
+    }
+
+    fflush (stdout);
+    dup2 (null_fd, STDOUT_FILENO);
+
+    run_scenario (&(scenarios[i]), directory, repetitions, native, &(measured[number_of_measured]));
+
+    fflush (stdout);
+    dup2 (stdout_fd, STDOUT_FILENO);
+
+    write_result (results, &(measured[number_of_measured]));
+
+    result_t *result = &(measured[number_of_measured]);
+
+    if (result->native_ns_per_packet > 0)
+    {
+      fprintf (stderr, "%-20s interpreted %10.1f ns/pkt, native %10.1f ns/pkt (%.2fx), compiled in %.0f ms\n",
+               result->scenario, result->ns_per_packet, result->native_ns_per_packet,
+               result->ns_per_packet / result->native_ns_per_packet, result->compile_ms);
+    }
+
+    number_of_measured++;
+  }
+
+  fclose (results);
+
+  if (save_baseline != NULL)
+  {
+    FILE *file = fopen (save_baseline, "w");
+    if (file == NULL)
+    {
+      fprintf (stderr, "Could not open %s\n", save_baseline);
+      exit (EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < number_of_measured; i++)
+    {
+      write_result (file, &(measured[i]));
+    }
+
+    fclose (file);
+  }
+
+  bool regressed = false;
+
+  if (compare_baseline != NULL)
+  {
+    regressed = compare_results (baseline, number_of_baseline, measured, number_of_measured, threshold);
+    free (baseline);
+  }
+
+  /* A distinct status lets scripts tell regressions from usage errors */
+  return regressed ? 2 : 0;
+}
+
+void print_usage (char *program)
+{
+  fprintf (stderr, "Usage: %s [-d directory] [-s scenario] [-o results_file] [-n repetitions]\n"
+                   "       [-b baseline_file] [-c baseline_file] [-t threshold] [-N] [-l]\n", program);
+  fprintf (stderr, "  -d DIR  where synthetic captures and rule files are kept (default: /tmp)\n");
+  fprintf (stderr, "  -s STR  only run scenarios whose name contains STR\n");
+  fprintf (stderr, "  -o FILE write JSON results to FILE instead of stdout\n");
+  fprintf (stderr, "  -n N    time each scenario N times and report the median (default: %d)\n", DEFAULT_REPETITIONS);
+  fprintf (stderr, "  -b FILE save the results as a baseline\n");
+  fprintf (stderr, "  -c FILE compare against a baseline, exit with status 2 on a regression\n");
+  fprintf (stderr, "  -t PCT  smallest slowdown in percent counted as a regression (default: %.0f)\n", DEFAULT_THRESHOLD);
+  fprintf (stderr, "  -N      also time the rules compiled to native code, reported next to the interpreter\n");
+  fprintf (stderr, "  -l      list scenarios\n");
+}
+
+void run_scenario (scenario_t *scenario, char *directory, int repetitions, bool native, result_t *result)
+{
+  char pcap_filename[LINE_LENGTH];
+  char rules_filename[LINE_LENGTH];
+
+  traffic_t *traffic = &(scenario->traffic);
+  rule_mix_t *mix = &(scenario->mix);
+
+  /* Inputs are reused only if made by this generator from the same
+     parameters, which the file names carry a hash of */
+  int traffic_parameters[] = {
+    GENERATOR_VERSION, traffic->packets, traffic->flows, traffic->payload_size,
+    traffic->tcp_percent, traffic->http_percent, (int) traffic->seed
+  };
+  int mix_parameters[] = {
+    GENERATOR_VERSION, mix->rules, mix->content_percent, mix->match_percent,
+    (int) mix->seed, mix->window_percent
+  };
+
+  snprintf (pcap_filename, LINE_LENGTH, "%s/nids-bench-%s-%016lx.pcap", directory, scenario->name,
+            (long unsigned) hash_parameters (traffic_parameters, sizeof (traffic_parameters) / sizeof (int)));
+  snprintf (rules_filename, LINE_LENGTH, "%s/nids-bench-%s-%016lx.rules", directory, scenario->name,
+            (long unsigned) hash_parameters (mix_parameters, sizeof (mix_parameters) / sizeof (int)));
+
+  if (access (pcap_filename, R_OK) != 0)
+  {
+    generate_pcap (pcap_filename, &(scenario->traffic));
+  }
+
+  if (access (rules_filename, R_OK) != 0)
+  {
+    generate_rules (rules_filename, &(scenario->mix));
+  }
+
+  reset_peak_rss ();
+
+  /* Startup cost: the rule file is parsed as often as the packets are run */
+  struct timespec start;
+  double load_seconds[repetitions];
+  rule_t *rules = NULL;
+
+  for (int r = 0; r < repetitions; r++)
+  {
+    free_rules (rules);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    rules = get_rules (rules_filename);
+    load_seconds[r] = seconds_since (&start);
+  }
+
+  capture_t capture;
+  pcap_t *handle;
+
+  load_capture (&capture, pcap_filename, &handle);
+
+  double ns_per_packet[repetitions];
+  double deviations[repetitions];
+  long allocations = 0;
+
+  time_packets (&capture, rules, handle, repetitions, ns_per_packet, &allocations);
+
+  memset (result, 0, sizeof (result_t));
+
+  /* The same packets again, once the rules are compiled */
+  if (native == true)
+  {
+    double native_ns_per_packet[repetitions];
+    long native_allocations = 0;
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    if (compile_rules (rules) == true)
+    {
+      result->compile_ms = seconds_since (&start) * 1e3;
+
+      time_packets (&capture, rules, handle, repetitions, native_ns_per_packet, &native_allocations);
+
+      result->native_ns_per_packet = median (native_ns_per_packet, repetitions);
+    }
+  }
+
+  snprintf (result->scenario, LINE_LENGTH, "%s", scenario->name);
+  snprintf (result->category, STRING_LENGTH, "%s", scenario->category);
+
+  result->packets = capture.number;
+  result->rules = scenario->mix.rules;
+  result->repetitions = repetitions;
+  result->ns_per_packet = median (ns_per_packet, repetitions);
+  result->pps = result->ns_per_packet > 0 ? 1e9 / result->ns_per_packet : 0;
+  result->rules_load_ms = median (load_seconds, repetitions) * 1e3;
+  result->rules_per_second = result->rules_load_ms > 0 ? result->rules * 1e3 / result->rules_load_ms : 0;
+  result->peak_rss_kb = peak_rss_kb ();
+
+  result->allocations_per_packet = -1;
+
+  if (capture.number > 0 && allocation_count () >= 0)
+  {
+    result->allocations_per_packet = (double) allocations / ((double) capture.number * repetitions);
+  }
+
+  for (int r = 0; r < repetitions; r++)
+  {
+    deviations[r] = ns_per_packet[r] > result->ns_per_packet ? ns_per_packet[r] - result->ns_per_packet
+                                                             : result->ns_per_packet - ns_per_packet[r];
+  }
+
+  if (result->ns_per_packet > 0)
+  {
+    result->spread = median (deviations, repetitions) / result->ns_per_packet;
+  }
+
+  pcap_close (handle);
+  free_capture (&capture);
+  free_rules (rules);
+}
+
+/* FNV-1a over the parameters, byte by byte */
+uint64_t hash_parameters (const int *parameters, int number)
+{
+  uint64_t hash = FNV_OFFSET;
+
+  for (int i = 0; i < number; i++)
+  {
+    uint32_t value = (uint32_t) parameters[i];
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+      hash = (hash ^ ((value >> shift) & 0xFF)) * FNV_PRIME;
+    }
+  }
+
+  return hash;
+}
+
+void time_packets (capture_t *capture, rule_t *rules, pcap_t *handle, int repetitions,
+                   double *ns_per_packet, long *allocations)
+{
+  struct timespec start;
+
+  for (int r = 0; r < repetitions; r++)
+  {
+    settings_t settings;
+    context_t context;
+
+    settings_defaults (&settings);
+    engine_init (&context, &settings, rules, handle);
+
+    long allocations_before = allocation_count ();
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < capture->number; i++)
+    {
+      process_packet ((u_char *) &context, &(capture->headers[i]), capture->data[i]);
+    }
+
+    double seconds = seconds_since (&start);
+    *allocations += allocation_count () - allocations_before;
+
+    engine_finish (&context);
+
+    ns_per_packet[r] = capture->number > 0 ? seconds * 1e9 / (double) capture->number : 0;
+  }
+}
+
+void load_capture (capture_t *capture, char *filename, pcap_t **handle)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  *handle = pcap_open_offline (filename, errbuf);
+  if (*handle == NULL)
+  {
+    fprintf (stderr, "Could not read %s: %s\n", filename, errbuf);
+    exit (EXIT_FAILURE);
+  }
+
+  memset (capture, 0, sizeof (capture_t));
+
+  pcap_loop (*handle, -1, store_packet, (u_char *) capture);
+}
+
+void store_packet (u_char *arg, const struct pcap_pkthdr *pkthdr, const u_char *raw)
+{
+  capture_t *capture = (capture_t *) arg;
+
+  if (capture->number == capture->allocated)
+  {
+    capture->allocated = capture->allocated > 0 ? 2 * capture->allocated : 1024;
+    capture->headers = (struct pcap_pkthdr *) realloc (capture->headers, capture->allocated * sizeof (struct pcap_pkthdr));
+    capture->data = (u_char **) realloc (capture->data, capture->allocated * sizeof (u_char *));
+  }
+
+  capture->headers[capture->number] = *pkthdr;
+  capture->data[capture->number] = (u_char *) malloc (pkthdr->caplen);
+  memcpy (capture->data[capture->number], raw, pkthdr->caplen);
+
+  capture->number++;
+}
+
+void free_capture (capture_t *capture)
+{
+  for (int i = 0; i < capture->number; i++)
+  {
+    free (capture->data[i]);
+  }
+
+  free (capture->data);
+  free (capture->headers);
+}
+
+double seconds_since (struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Sorts the values in place */
+double median (double *values, int number)
+{
+  qsort (values, number, sizeof (double), compare_doubles);
+
+  if (number % 2 == 1)
+  {
+    return values[number / 2];
+  }
+
+  return (values[number / 2 - 1] + values[number / 2]) / 2;
+}
+
+int compare_doubles (const void *a, const void *b)
+{
+  double x = *((const double *) a);
+  double y = *((const double *) b);
+
+  return (x > y) - (x < y);
+}
+
+/* Linux resets the peak resident set size when 5 is written to clear_refs */
+void reset_peak_rss (void)
+{
+  FILE *file = fopen ("/proc/self/clear_refs", "w");
+
+  if (file != NULL)
+  {
+    fprintf (file, "5");
+    fclose (file);
+  }
+}
+
+long peak_rss_kb (void)
+{
+  char line[LINE_LENGTH];
+  long kb = -1;
+
+  FILE *file = fopen ("/proc/self/status", "r");
+
+  if (file != NULL)
+  {
+    while (fgets (line, LINE_LENGTH, file) != NULL)
+    {
+      if (strncmp (line, "VmHWM:", 6) == 0)
+      {
+        kb = atol (line + 6);
+        break;
+      }
+    }
+
+    fclose (file);
+  }
+
+  if (kb < 0)
+  {
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+    kb = usage.ru_maxrss;
+  }
+
+  return kb;
+}
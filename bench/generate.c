@@ -0,0 +1,361 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "generate.h"
+
+/* Traffic goes from 10.0.0.0/16 clients to 192.168.0.0/24 servers. Rules
+   that should not match use 172.16.0.0/12, which never appears. */
+
+#define ETHERNET_LENGTH (14)
+#define CLIENT_NET (0x0A000000)
+#define SERVER_NET (0xC0A80000)
+#define UNUSED_NET (0xAC100000)
+
+typedef struct flow_tag
+{
+  uint32_t client;
+  uint32_t server;
+  uint16_t client_port;
+  uint16_t server_port;
+  bool tcp;
+}
+flow_t;
+
+char *words[] = {
+  "GET", "POST", "admin", "passwd", "login", "cmd.exe", "/bin/sh", "SELECT",
+  "UNION", "select", "password", "root", "../../", "eval(", "<script>", "wget",
+  "curl", "token", "session", "cookie", "Host:", "User-Agent", "nc -e", "base64"
+};
+
+#define NUMBER_OF_WORDS ((int) (sizeof (words) / sizeof (words[0])))
+
+uint16_t server_ports[] = {80, 443, 22, 25, 53, 8080, 3306, 123};
+
+#define NUMBER_OF_SERVER_PORTS ((int) (sizeof (server_ports) / sizeof (server_ports[0])))
+
+uint16_t checksum (void *, int);
+int build_packet (uint8_t *, flow_t *, bool, uint32_t, uint8_t *, int);
+int build_payload (uint8_t *, int, bool, uint32_t *);
+
+/* Xorshift: cheap and reproducible for a given seed */
+uint32_t next_random (uint32_t *state)
+{
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  *state = x;
+
+  return x;
+}
+
+void generate_pcap (char *filename, traffic_t *traffic)
+{
+  uint32_t state = traffic->seed | 1;
+
+  pcap_t *dead_handle = pcap_open_dead (DLT_EN10MB, 0xffff);
+  pcap_dumper_t *dumper = pcap_dump_open (dead_handle, filename);
+  if (dumper == NULL)
+  {
+    fprintf (stderr, "Could not write %s\n", filename);
+    exit (EXIT_FAILURE);
+  }
+
+  flow_t *flows = (flow_t *) malloc (traffic->flows * sizeof (flow_t));
+
+  for (int i = 0; i < traffic->flows; i++)
+  {
+    flows[i].client = CLIENT_NET | (next_random (&state) & 0xFFFF);
+    flows[i].server = SERVER_NET | (next_random (&state) & 0xFF);
+    flows[i].client_port = (uint16_t) (1024 + next_random (&state) % 60000);
+    flows[i].tcp = (int) (next_random (&state) % 100) < traffic->tcp_percent;
+    flows[i].server_port = server_ports[next_random (&state) % NUMBER_OF_SERVER_PORTS];
+
+    if (flows[i].tcp == false && flows[i].server_port != 123)
+    {
+      flows[i].server_port = 53;
+    }
+  }
+
+  uint8_t *payload = (uint8_t *) malloc (2 * traffic->payload_size + 1);
+  uint8_t *frame = (uint8_t *) malloc (2 * traffic->payload_size + 128);
+
+  struct pcap_pkthdr header;
+
+  header.ts.tv_sec = 1500000000;
+  header.ts.tv_usec = 0;
+
+  for (int i = 0; i < traffic->packets; i++)
+  {
+    flow_t *flow = &(flows[next_random (&state) % traffic->flows]);
+
+    bool http = flow->tcp == true && (int) (next_random (&state) % 100) < traffic->http_percent;
+    int payload_length = traffic->payload_size > 0 ?
+                         (int) (next_random (&state) % (2 * traffic->payload_size + 1)) : 0;
+
+    payload_length = build_payload (payload, payload_length, http, &state);
+
+    bool reply = (next_random (&state) & 1) != 0 && http == false;
+
+    int length = build_packet (frame, flow, reply, next_random (&state), payload, payload_length);
+
+    header.ts.tv_usec += 10;
+    if (header.ts.tv_usec >= 1000000)
+    {
+      header.ts.tv_sec++;
+      header.ts.tv_usec -= 1000000;
+    }
+
+    header.caplen = (bpf_u_int32) length;
+    header.len = (bpf_u_int32) length;
+
+    pcap_dump ((u_char *) dumper, &header, frame);
+  }
+
+  pcap_dump_close (dumper);
+  pcap_close (dead_handle);
+
+  free (frame);
+  free (payload);
+  free (flows);
+}
+
+/* Random printable text with the odd keyword in it, or an HTTP request */
+int build_payload (uint8_t *payload, int length, bool http, uint32_t *state)
+{
+  int used = 0;
+
+  if (http == true)
+  {
+    used = sprintf ((char *) payload, "%s /%s/%u HTTP/1.1\r\nHost: example.com\r\n\r\n",
+                    (next_random (state) & 3) == 0 ? "POST" : "GET",
+                    words[next_random (state) % NUMBER_OF_WORDS],
+                    (unsigned) next_random (state) % 1000);
+  }
+
+  while (used < length)
+  {
+    if ((next_random (state) % 64) == 0)
+    {
+      char *word = words[next_random (state) % NUMBER_OF_WORDS];
+      int word_length = (int) strlen (word);
+
+      if (used + word_length <= length)
+      {
+        memcpy (payload + used, word, word_length);
+        used += word_length;
+        continue;
+      }
+    }
+
+    payload[used++] = (uint8_t) ('a' + next_random (state) % 26);
+  }
+
+  return used;
+}
+
+int build_packet (uint8_t *frame, flow_t *flow, bool reply, uint32_t sequence,
+                  uint8_t *payload, int payload_length)
+{
+  memset (frame, 0, ETHERNET_LENGTH);
+  frame[12] = 0x08;
+  frame[13] = 0x00;
+
+  ip_header_t *ip_header = (ip_header_t *) (frame + ETHERNET_LENGTH);
+  int transport_length = flow->tcp == true ? (int) sizeof (tcp_header_t) : (int) sizeof (udp_header_t);
+
+  memset (ip_header, 0, sizeof (ip_header_t));
+  ip_header->version_and_ihl = 0x45;
+  ip_header->total_length = htons ((uint16_t) (sizeof (ip_header_t) + transport_length + payload_length));
+  ip_header->identification = htons ((uint16_t) sequence);
+  ip_header->time_to_live = 64;
+  ip_header->protocol = flow->tcp == true ? 6 : 17;
+  ip_header->source_address = htonl (reply == true ? flow->server : flow->client);
+  ip_header->dest_address = htonl (reply == true ? flow->client : flow->server);
+  ip_header->header_checksum = checksum (ip_header, sizeof (ip_header_t));
+
+  uint16_t source_port = reply == true ? flow->server_port : flow->client_port;
+  uint16_t dest_port = reply == true ? flow->client_port : flow->server_port;
+
+  uint8_t *transport = frame + ETHERNET_LENGTH + sizeof (ip_header_t);
+
+  if (flow->tcp == true)
+  {
+    tcp_header_t *tcp_header = (tcp_header_t *) transport;
+
+    memset (tcp_header, 0, sizeof (tcp_header_t));
+    tcp_header->source_port = htons (source_port);
+    tcp_header->dest_port = htons (dest_port);
+    tcp_header->seq_number = htonl (sequence);
+    tcp_header->ack_number = htonl (sequence ^ 0x5A5A5A5A);
+    tcp_header->data_offset_and_flags = htons ((uint16_t) ((5 << 12) | (payload_length > 0 ? 0x18 : 0x10)));
+    tcp_header->window = htons (0xFFFF);
+  }
+
+  else
+  {
+    udp_header_t *udp_header = (udp_header_t *) transport;
+
+    udp_header->source_port = htons (source_port);
+    udp_header->dest_port = htons (dest_port);
+    udp_header->length = htons ((uint16_t) (sizeof (udp_header_t) + payload_length));
+    udp_header->checksum = 0;
+  }
+
+  memcpy (transport + transport_length, payload, payload_length);
+
+  return ETHERNET_LENGTH + (int) sizeof (ip_header_t) + transport_length + payload_length;
+}
+
+uint16_t checksum (void *data, int length)
+{
+  uint32_t sum = 0;
+  uint16_t *words16 = (uint16_t *) data;
+
+  for (int i = 0; i < length / 2; i++)
+  {
+    sum += words16[i];
+  }
+
+  while (sum >> 16)
+  {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+
+  return (uint16_t) ~sum;
+}
+
+/* One random Ethernet frame with the given transport and payload length;
+   frame must have room for payload_length + 128 bytes */
+int generate_packet (uint8_t *frame, bool tcp, int payload_length, uint32_t *state)
+{
+  flow_t flow;
+
+  flow.client = CLIENT_NET | (next_random (state) & 0xFFFF);
+  flow.server = SERVER_NET | (next_random (state) & 0xFF);
+  flow.client_port = (uint16_t) (1024 + next_random (state) % 60000);
+  flow.server_port = server_ports[next_random (state) % NUMBER_OF_SERVER_PORTS];
+  flow.tcp = tcp;
+
+  uint8_t *payload = (uint8_t *) malloc (payload_length + 1);
+
+  payload_length = build_payload (payload, payload_length, false, state);
+
+  int length = build_packet (frame, &flow, false, next_random (state), payload, payload_length);
+
+  free (payload);
+
+  return length;
+}
+
+void write_ip (FILE *, uint32_t, int);
+void write_port (FILE *, uint32_t *);
+
+/* Rules whose header can match use the traffic's networks; the others use
+   an unused network, so packets are tested against all of them */
+void generate_rules (char *filename, rule_mix_t *mix)
+{
+  uint32_t state = mix->seed | 1;
+
+  FILE *file = fopen (filename, "w");
+  if (file == NULL)
+  {
+    fprintf (stderr, "Could not write %s\n", filename);
+    exit (EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < mix->rules; i++)
+  {
+    bool can_match = (int) (next_random (&state) % 100) < mix->match_percent;
+    bool content = (int) (next_random (&state) % 100) < mix->content_percent;
+    uint32_t kind = next_random (&state) % 10;
+
+    char *protocol = kind < 6 ? "tcp" : (kind < 9 ? "udp" : "http");
+
+    fprintf (file, "alert %s ", protocol);
+
+    if ((next_random (&state) & 1) != 0)
+    {
+      fprintf (file, "any ");
+    }
+    else
+    {
+      write_ip (file, (can_match == true ? CLIENT_NET : UNUSED_NET) | (next_random (&state) & 0xFFFF),
+                16 + (int) (next_random (&state) % 17));
+    }
+
+    write_port (file, &state);
+
+    fprintf (file, "-> ");
+
+    if (can_match == true)
+    {
+      write_ip (file, SERVER_NET, 24);
+    }
+    else
+    {
+      write_ip (file, UNUSED_NET | (next_random (&state) & 0xFFFFF), 20 + (int) (next_random (&state) % 13));
+    }
+
+    write_port (file, &state);
+
+    fprintf (file, "(");
+
+    if (content == true)
+    {
+      fprintf (file, "content:\"%s\"; ", words[next_random (&state) % NUMBER_OF_WORDS]);
+
+      if (mix->window_percent > 0 && (int) (next_random (&state) % 100) < mix->window_percent)
+      {
+        fprintf (file, "depth:64; %s", (next_random (&state) % 4) == 0 ? "nocase; " : "");
+      }
+    }
+
+    if (strcmp (protocol, "tcp") == 0 && (next_random (&state) % 4) == 0)
+    {
+      fprintf (file, "flags:PA; ");
+    }
+
+    if (strcmp (protocol, "http") == 0)
+    {
+      fprintf (file, "http_request:\"%s\"; ", (next_random (&state) & 1) != 0 ? "GET" : "POST");
+    }
+
+    fprintf (file, "msg:\"synthetic rule %d\")\n", i + 1);
+  }
+
+  fclose (file);
+}
+
+void write_ip (FILE *file, uint32_t ip, int mask)
+{
+  fprintf (file, "%u.%u.%u.%u/%d ", (unsigned) (ip >> 24), (unsigned) ((ip >> 16) & 0xFF),
+           (unsigned) ((ip >> 8) & 0xFF), (unsigned) (ip & 0xFF), mask);
+}
+
+void write_port (FILE *file, uint32_t *state)
+{
+  switch (next_random (state) % 4)
+  {
+  case 0:
+    fprintf (file, "any ");
+    break;
+
+  case 1:
+    fprintf (file, "%u ", (unsigned) server_ports[next_random (state) % NUMBER_OF_SERVER_PORTS]);
+    break;
+
+  case 2:
+    fprintf (file, "%u:%u ", (unsigned) (next_random (state) % 1024), (unsigned) (1024 + next_random (state) % 64512));
+    break;
+
+  default:
+    fprintf (file, "%u,%u,%u ", (unsigned) server_ports[next_random (state) % NUMBER_OF_SERVER_PORTS],
+             (unsigned) server_ports[next_random (state) % NUMBER_OF_SERVER_PORTS],
+             (unsigned) (1024 + next_random (state) % 64512));
+    break;
+  }
+}
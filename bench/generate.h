@@ -0,0 +1,38 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include "libraries.h"
+
+/* Synthetic capture */
+typedef struct traffic_tag
+{
+  int packets;
+  int flows;
+  int payload_size; /* average payload bytes */
+  int tcp_percent; /* the rest is UDP */
+  int http_percent; /* TCP packets carrying an HTTP request line */
+  unsigned seed;
+}
+traffic_t;
+
+/* Synthetic rule file */
+typedef struct rule_mix_tag
+{
+  int rules;
+  int content_percent; /* rules with a content option */
+  int match_percent; /* rules whose header can match the synthetic traffic */
+  unsigned seed;
+  int window_percent; /* contents searched in the first 64 bytes only, a quarter of them nocase */
+}
+rule_mix_t;
+
+/* Part of the names of generated files: bump it whenever the generator
+   output changes, so that files made by an older one are not reused */
+#define GENERATOR_VERSION (1)
+
+void generate_pcap (char *, traffic_t *);
+void generate_rules (char *, rule_mix_t *);
+int generate_packet (uint8_t *, bool, int, uint32_t *);
+uint32_t next_random (uint32_t *);
+
+#endif
@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "needle.h"
+#include "subreg.h"
+#include "check.h"
+#include "packet.h"
+
+#include "generate.h"
+
+
+/* Microbenchmarks of the innermost kernels. Every case runs batches of
+   calls over a rotating set of inputs; the median and 99th percentile of
+   the per-call time over all batches are printed as one JSON object per
+   case. Each call's result is folded into a checksum that is compared
+   with the expected number of hits, so the compiler cannot drop the work
+   and a replacement kernel cannot silently change the answers. */
+
+#define NUMBER_OF_INPUTS (256)
+#define MAX_BATCH_CALLS (1024)
+#define TARGET_BATCH_NS (50000)
+
+typedef struct micro_case_tag micro_case_t;
+
+typedef uint64_t (*kernel_t) (micro_case_t *, int, int);
+
+struct micro_case_tag
+{
+  char name[LINE_LENGTH];
+  kernel_t kernel;
+
+  bool expected[NUMBER_OF_INPUTS]; /* whether the call on each input should hit */
+
+  /* inputs, depending on the kernel */
+  uint8_t *haystacks[NUMBER_OF_INPUTS];
+  int haystack_length;
+  uint8_t needle[64];
+  int needle_length;
+
+  ip_t ip;
+  port_t port;
+  uint32_t addresses[NUMBER_OF_INPUTS];
+  uint16_t ports[NUMBER_OF_INPUTS];
+
+  uint8_t *frames[NUMBER_OF_INPUTS];
+  int frame_lengths[NUMBER_OF_INPUTS];
+};
+
+int warmup_batches = 20;
+int batches = 200;
+
+volatile uint64_t sink;
+
+void run_case (micro_case_t *, char *);
+double time_batch (micro_case_t *, int, int);
+int compare_doubles (const void *, const void *);
+void print_usage (char *);
+
+void needle_cases (char *);
+void subreg_cases (char *);
+void ip_cases (char *);
+void port_cases (char *);
+void parse_cases (char *);
+
+int main (int argc, char *argv[])
+{
+  char *only = NULL;
+
+  int c;
+
+  while ((c = getopt (argc, argv, "k:r:w:")) != -1)
+  {
+    switch (c)
+    {
+    case 'k':
+      only = optarg;
+      break;
+
+    case 'r':
+      batches = (int) atol (optarg);
+      break;
+
+    case 'w':
+      warmup_batches = (int) atol (optarg);
+      break;
+
+    default:
+      print_usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  if (batches < 1 || warmup_batches < 0)
+  {
+    print_usage (argv[0]);
+    exit (EXIT_FAILURE);
+  }
+
+  needle_cases (only);
+  subreg_cases (only);
+  ip_cases (only);
+  port_cases (only);
+  parse_cases (only);
+
+  return 0;
+}
+
+void print_usage (char *program)
+{
+  fprintf (stderr, "Usage: %s [-k kernel] [-r batches] [-w warmup_batches]\n", program);
+  fprintf (stderr, "  -k STR  only run cases whose name contains STR\n");
+  fprintf (stderr, "  -r N    timed batches per case (default: 200)\n");
+  fprintf (stderr, "  -w N    untimed batches before timing (default: 20)\n");
+}
+
+void run_case (micro_case_t *micro_case, char *only)
+{
+  if (only != NULL && strstr (micro_case->name, only) == NULL)
+  {
+    return;
+  }
+
+  double *samples = (double *) malloc (batches * sizeof (double));
+
+  /* Batches grow until they take long enough to time reliably */
+  int calls_per_batch = 1;
+
+  while (calls_per_batch < MAX_BATCH_CALLS &&
+         time_batch (micro_case, 0, calls_per_batch) < TARGET_BATCH_NS)
+  {
+    calls_per_batch *= 2;
+  }
+
+  for (int i = 0; i < warmup_batches; i++)
+  {
+    sink += micro_case->kernel (micro_case, i * calls_per_batch, calls_per_batch);
+  }
+
+  uint64_t hits = 0;
+  uint64_t expected = 0;
+
+  for (int i = 0; i < batches; i++)
+  {
+    struct timespec start, finish;
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    hits += micro_case->kernel (micro_case, i * calls_per_batch, calls_per_batch);
+    clock_gettime (CLOCK_MONOTONIC, &finish);
+
+    samples[i] = ((double) (finish.tv_sec - start.tv_sec) * 1e9 +
+                  (double) (finish.tv_nsec - start.tv_nsec)) / calls_per_batch;
+
+    for (int j = i * calls_per_batch; j < (i + 1) * calls_per_batch; j++)
+    {
+      expected += micro_case->expected[j % NUMBER_OF_INPUTS] == true ? 1 : 0;
+    }
+  }
+
+  sink += hits;
+
+  qsort (samples, batches, sizeof (double), compare_doubles);
+
+  uint64_t calls = (uint64_t) batches * calls_per_batch;
+
+  bool valid = hits == expected;
+
+  printf ("{\"case\": \"%s\", \"calls\": %lu, \"median_ns\": %.2f, \"p99_ns\": %.2f, "
+          "\"min_ns\": %.2f, \"hits\": %lu, \"valid\": %s}\n",
+          micro_case->name, (long unsigned) calls,
+          samples[batches / 2], samples[(int) ((double) (batches - 1) * 0.99)], samples[0],
+          (long unsigned) hits, valid == true ? "true" : "false");
+  fflush (stdout);
+
+  if (valid == false)
+  {
+    fprintf (stderr, "%s: %lu hits, expected %lu\n", micro_case->name,
+             (long unsigned) hits, (long unsigned) expected);
+  }
+
+  free (samples);
+}
+
+double time_batch (micro_case_t *micro_case, int first, int calls)
+{
+  struct timespec start, finish;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  sink += micro_case->kernel (micro_case, first, calls);
+  clock_gettime (CLOCK_MONOTONIC, &finish);
+
+  return (double) (finish.tv_sec - start.tv_sec) * 1e9 + (double) (finish.tv_nsec - start.tv_nsec);
+}
+
+int compare_doubles (const void *a, const void *b)
+{
+  double x = *((double *) a);
+  double y = *((double *) b);
+
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+uint64_t needle_kernel (micro_case_t *, int, int);
+uint64_t memmem_kernel (micro_case_t *, int, int);
+uint64_t nocase_kernel (micro_case_t *, int, int);
+
+/* Haystacks of random letters; hit_percent of them get the needle at a random place */
+void fill_haystacks (micro_case_t *micro_case, int length, char *needle, int hit_percent, uint32_t *state)
+{
+  micro_case->haystack_length = length;
+  micro_case->needle_length = (int) strlen (needle);
+  memcpy (micro_case->needle, needle, micro_case->needle_length);
+
+  for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+  {
+    uint8_t *haystack = (uint8_t *) malloc (length);
+
+    for (int j = 0; j < length; j++)
+    {
+      haystack[j] = (uint8_t) ('a' + next_random (state) % 26);
+    }
+
+    micro_case->expected[i] = (i * 100) / NUMBER_OF_INPUTS < hit_percent && length >= micro_case->needle_length;
+
+    if (micro_case->expected[i] == true)
+    {
+      int at = (int) (next_random (state) % (length - micro_case->needle_length + 1));
+
+      memcpy (haystack + at, needle, micro_case->needle_length);
+    }
+
+    micro_case->haystacks[i] = haystack;
+  }
+}
+
+void free_haystacks (micro_case_t *micro_case)
+{
+  for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+  {
+    free (micro_case->haystacks[i]);
+  }
+}
+
+void needle_cases (char *only)
+{
+  int lengths[] = {64, 512, 1500, 9000, 65535};
+  char *needles[] = {"GET", "passwd01", "User-Agent: curl/7"};
+  int hit_percents[] = {0, 50, 100};
+
+  uint32_t state = 12345;
+
+  micro_case_t *micro_case = (micro_case_t *) calloc (1, sizeof (micro_case_t));
+
+  for (int l = 0; l < (int) (sizeof (lengths) / sizeof (int)); l++)
+  {
+    for (int n = 0; n < (int) (sizeof (needles) / sizeof (char *)); n++)
+    {
+      for (int h = 0; h < (int) (sizeof (hit_percents) / sizeof (int)); h++)
+      {
+        /* Upper case needles never occur in the lower case haystacks by chance */
+        fill_haystacks (micro_case, lengths[l], needles[n], hit_percents[h], &state);
+
+        micro_case->kernel = needle_kernel;
+        snprintf (micro_case->name, LINE_LENGTH, "find_needle n=%d m=%d hit=%d%%",
+                  lengths[l], micro_case->needle_length, hit_percents[h]);
+        run_case (micro_case, only);
+
+        micro_case->kernel = memmem_kernel;
+        snprintf (micro_case->name, LINE_LENGTH, "memmem n=%d m=%d hit=%d%%",
+                  lengths[l], micro_case->needle_length, hit_percents[h]);
+        run_case (micro_case, only);
+
+        /* Folded, a needle of letters only could occur by chance */
+        if (strspn (needles[n], "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz") < strlen (needles[n]))
+        {
+          micro_case->kernel = nocase_kernel;
+          snprintf (micro_case->name, LINE_LENGTH, "find_needle_nocase n=%d m=%d hit=%d%%",
+                    lengths[l], micro_case->needle_length, hit_percents[h]);
+          run_case (micro_case, only);
+        }
+
+        free_haystacks (micro_case);
+      }
+    }
+  }
+
+  free (micro_case);
+}
+
+uint64_t needle_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    hits += find_needle (micro_case->haystacks[i % NUMBER_OF_INPUTS], micro_case->haystack_length,
+                         micro_case->needle, micro_case->needle_length) != NULL;
+  }
+
+  return hits;
+}
+
+uint64_t nocase_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    hits += find_needle_nocase (micro_case->haystacks[i % NUMBER_OF_INPUTS], micro_case->haystack_length,
+                                micro_case->needle, micro_case->needle_length) != NULL;
+  }
+
+  return hits;
+}
+
+/* glibc's two-way search, as a reference for find_needle */
+uint64_t memmem_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    hits += memmem (micro_case->haystacks[i % NUMBER_OF_INPUTS], micro_case->haystack_length,
+                    micro_case->needle, micro_case->needle_length) != NULL;
+  }
+
+  return hits;
+}
+
+uint64_t subreg_kernel (micro_case_t *, int, int);
+
+/* The expression check_option builds for http_request: GET */
+void subreg_cases (char *only)
+{
+  int lengths[] = {64, 512, 1500};
+  int hit_percents[] = {0, 50, 100};
+
+  uint32_t state = 777;
+
+  micro_case_t *micro_case = (micro_case_t *) calloc (1, sizeof (micro_case_t));
+
+  for (int l = 0; l < (int) (sizeof (lengths) / sizeof (int)); l++)
+  {
+    for (int h = 0; h < (int) (sizeof (hit_percents) / sizeof (int)); h++)
+    {
+      micro_case->haystack_length = lengths[l];
+
+      for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+      {
+        char *haystack = (char *) malloc (lengths[l] + 1);
+        bool hit = (i * 100) / NUMBER_OF_INPUTS < hit_percents[h];
+
+        int used = snprintf (haystack, lengths[l] + 1, "%s /index.html HTTP/1.1\r\n", hit == true ? "GET" : "get");
+
+        for (int j = used; j < lengths[l]; j++)
+        {
+          haystack[j] = (char) ('a' + next_random (&state) % 26);
+        }
+
+        haystack[lengths[l]] = '\0';
+
+        micro_case->haystacks[i] = (uint8_t *) haystack;
+        micro_case->expected[i] = hit;
+      }
+
+      micro_case->kernel = subreg_kernel;
+      snprintf (micro_case->name, LINE_LENGTH, "subreg_match n=%d hit=%d%%", lengths[l], hit_percents[h]);
+      run_case (micro_case, only);
+
+      free_haystacks (micro_case);
+    }
+  }
+
+  free (micro_case);
+}
+
+uint64_t subreg_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  subreg_capture_t captures[MAX_NUM_CAPTURES];
+
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    hits += subreg_match ("\\s*\\GET\\s+\\S+\\s+HTTP/.*", (char *) micro_case->haystacks[i % NUMBER_OF_INPUTS],
+                          captures, MAX_NUM_CAPTURES, MAX_DEPTH) > 0;
+  }
+
+  return hits;
+}
+
+uint64_t ip_kernel (micro_case_t *, int, int);
+
+void ip_cases (char *only)
+{
+  int masks[] = {32, 24, 8};
+  int hit_percents[] = {0, 50, 100};
+
+  uint32_t state = 4242;
+
+  micro_case_t *micro_case = (micro_case_t *) calloc (1, sizeof (micro_case_t));
+
+  for (int m = 0; m < (int) (sizeof (masks) / sizeof (int)); m++)
+  {
+    for (int h = 0; h < (int) (sizeof (hit_percents) / sizeof (int)); h++)
+    {
+      uint32_t size = masks[m] == 32 ? 1 : (1u << (32 - masks[m]));
+
+      micro_case->ip.start = 0x0A000000;
+      micro_case->ip.finish = 0x0A000000 + size - 1;
+
+      for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+      {
+        bool hit = (i * 100) / NUMBER_OF_INPUTS < hit_percents[h];
+
+        micro_case->addresses[i] = hit == true ? 0x0A000000 + next_random (&state) % size
+                                               : 0x0B000000 + next_random (&state) % 0x1000000;
+        micro_case->expected[i] = hit;
+      }
+
+      micro_case->kernel = ip_kernel;
+      snprintf (micro_case->name, LINE_LENGTH, "check_ip mask=/%d hit=%d%%", masks[m], hit_percents[h]);
+      run_case (micro_case, only);
+    }
+  }
+
+  free (micro_case);
+}
+
+uint64_t ip_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    hits += check_ip (&(micro_case->ip), micro_case->addresses[i % NUMBER_OF_INPUTS]);
+  }
+
+  return hits;
+}
+
+uint64_t port_kernel (micro_case_t *, int, int);
+
+/* A range, then lists of 1, 4 and 16 ports */
+void port_cases (char *only)
+{
+  int list_sizes[] = {0, 1, 4, 16};
+  int hit_percents[] = {0, 50, 100};
+
+  uint32_t state = 999;
+
+  micro_case_t *micro_case = (micro_case_t *) calloc (1, sizeof (micro_case_t));
+  uint16_t list[16];
+
+  for (int l = 0; l < (int) (sizeof (list_sizes) / sizeof (int)); l++)
+  {
+    for (int h = 0; h < (int) (sizeof (hit_percents) / sizeof (int)); h++)
+    {
+      port_t *port = &(micro_case->port);
+
+      if (list_sizes[l] == 0)
+      {
+        port->colon_found = true;
+        port->start = 1000;
+        port->finish = 2000;
+      }
+      else
+      {
+        port->colon_found = false;
+        port->number_of_ports = list_sizes[l];
+        port->ports = list;
+
+        for (int i = 0; i < list_sizes[l]; i++)
+        {
+          list[i] = (uint16_t) (1000 + 10 * i);
+        }
+      }
+
+      for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+      {
+        bool hit = (i * 100) / NUMBER_OF_INPUTS < hit_percents[h];
+
+        if (hit == true)
+        {
+          micro_case->ports[i] = list_sizes[l] == 0 ? (uint16_t) (1000 + next_random (&state) % 1001)
+                                                    : list[next_random (&state) % list_sizes[l]];
+        }
+        else
+        {
+          micro_case->ports[i] = (uint16_t) (3000 + next_random (&state) % 60000);
+        }
+
+        micro_case->expected[i] = hit;
+      }
+
+      micro_case->kernel = port_kernel;
+
+      if (list_sizes[l] == 0)
+      {
+        snprintf (micro_case->name, LINE_LENGTH, "check_port range hit=%d%%", hit_percents[h]);
+      }
+      else
+      {
+        snprintf (micro_case->name, LINE_LENGTH, "check_port list=%d hit=%d%%", list_sizes[l], hit_percents[h]);
+      }
+
+      run_case (micro_case, only);
+    }
+  }
+
+  free (micro_case);
+}
+
+uint64_t port_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    hits += check_port (&(micro_case->port), micro_case->ports[i % NUMBER_OF_INPUTS]);
+  }
+
+  return hits;
+}
+
+uint64_t parse_kernel (micro_case_t *, int, int);
+
+/* Every valid packet counts as a hit */
+void parse_cases (char *only)
+{
+  int payload_lengths[] = {0, 64, 512, 1460};
+
+  uint32_t state = 31337;
+
+  micro_case_t *micro_case = (micro_case_t *) calloc (1, sizeof (micro_case_t));
+
+  for (int tcp = 1; tcp >= 0; tcp--)
+  {
+    for (int p = 0; p < (int) (sizeof (payload_lengths) / sizeof (int)); p++)
+    {
+      for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+      {
+        micro_case->frames[i] = (uint8_t *) malloc (payload_lengths[p] + 128);
+        micro_case->frame_lengths[i] = generate_packet (micro_case->frames[i], tcp == 1, payload_lengths[p], &state);
+        micro_case->expected[i] = true;
+      }
+
+      micro_case->kernel = parse_kernel;
+      snprintf (micro_case->name, LINE_LENGTH, "parse_packet %s payload=%d",
+                tcp == 1 ? "tcp" : "udp", payload_lengths[p]);
+      run_case (micro_case, only);
+
+      for (int i = 0; i < NUMBER_OF_INPUTS; i++)
+      {
+        free (micro_case->frames[i]);
+      }
+    }
+  }
+
+  free (micro_case);
+}
+
+uint64_t parse_kernel (micro_case_t *micro_case, int first, int calls)
+{
+  uint64_t hits = 0;
+
+  for (int i = first; i < first + calls; i++)
+  {
+    packet_t packet;
+
+    parse_packet (&packet, 14, micro_case->frames[i % NUMBER_OF_INPUTS],
+                  micro_case->frame_lengths[i % NUMBER_OF_INPUTS]);
+
+    if (packet.valid == true)
+    {
+      hits += 1;
+      free (packet.data);
+    }
+  }
+
+  return hits;
+}
@@ -1,6 +1,13 @@
 #!/bin/bash
 
-cd ./src
-gcc -std=gnu99 -Wall *.c *.h -o my_nids -lpcap
-mv my_nids ../bin
+CFLAGS="-std=gnu99 -Wall -O2"
+LIBS="-lpcap -lpthread -lz -lrt -ldl"
+
+mkdir -p ./bin
 
+cd ./src
+gcc $CFLAGS *.c *.h -o my_nids $LIBS
+gcc $CFLAGS -I. $(ls *.c | grep -v '^main.c$') ../bench/bench.c ../bench/baseline.c ../bench/generate.c -o nids_bench $LIBS
+gcc $CFLAGS -I. $(ls *.c | grep -v '^main.c$') ../bench/micro.c ../bench/generate.c -o nids_micro $LIBS
+gcc $CFLAGS -I. ../tools/nids_top.c -o nids_top $LIBS
+mv my_nids nids_bench nids_micro nids_top ../bin
@@ -0,0 +1,1003 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "arena.h"
+#include "rules.h"
+
+#include "analysis.h"
+
+#define CANDIDATES (16) /* earlier rows of a chain a rule is compared with */
+#define BLOCK_SHIFT (12) /* destination addresses are chained by blocks of 4096 */
+#define MAX_BLOCKS (4) /* rows over more blocks go in a single chain of wide rows */
+#define WIDE_BLOCK (1 << (32 - BLOCK_SHIFT))
+#define MERGE_WINDOW (32) /* rows a rule may be merged back over */
+#define MAX_OPTIONS (6) /* rules with more are never found shadowed */
+#define MAX_MERGED_PORTS (32)
+#define MIX_MULTIPLIER (0x9E3779B97F4A7C15ULL)
+
+/* Works out the rows check_with_rules goes through, in list order:
+
+     - a rule whose packets all match an earlier row is dropped, since the
+       first match wins it could never fire (an exact duplicate is the
+       same case with the same message);
+     - a rule that only differs from an earlier row in one of its IP
+       ranges or port sets is merged into that row, when the union is
+       still a range or a short port list and no row in between could
+       match any of its packets.
+
+   A merged row is a rule of its own, outside the list, whose members
+   are the rules it stands for; check_with_rules hands back the first
+   member matching the packet, so alerts and hit counters are those of
+   the original rules. Options are compared without their message. */
+
+enum {SOURCE_IP = 0, DEST_IP, SOURCE_PORT, DEST_PORT, NUMBER_OF_DIMENSIONS};
+
+typedef struct row_tag
+{
+  rule_t *rule;
+
+  /* Copied from the rule, so most candidates are turned down without
+     reading it */
+  uint8_t protocol;
+  uint32_t source_start;
+  uint32_t source_finish;
+  uint32_t dest_start;
+  uint32_t dest_finish;
+  uint16_t source_port_start; /* bounds of lists as in the headers */
+  uint16_t source_port_finish;
+  uint16_t dest_port_start;
+  uint16_t dest_port_finish;
+
+  uint64_t options;
+  int number_of_options;
+
+  int dimension; /* the one merged along, -1 while it has no members */
+  int allocated_members;
+}
+row_t;
+
+/* Rows that could shadow a rule are chained by options, protocol and
+   destination block, newest first */
+typedef struct link_tag
+{
+  int row;
+  int next; /* -1 at the end of the chain */
+}
+link_t;
+
+/* Keys are only kept as tags of their upper half, which also places
+   them: every row found is checked again, so a rare collision only costs
+   a comparison */
+typedef struct slot_tag
+{
+  uint32_t tag; /* 0 for a free slot */
+  int value;
+}
+slot_t;
+
+/* Maps a key to the newest row or link inserted with it */
+typedef struct table_tag
+{
+  slot_t *slots;
+  uint64_t mask;
+  uint64_t used;
+}
+table_t;
+
+typedef struct analyser_tag
+{
+  rule_storage_t *storage;
+
+  row_t *rows;
+  int number_of_rows;
+
+  link_t *links;
+  int number_of_links;
+  int allocated_links;
+
+  table_t chains;
+  table_t by_dimension[NUMBER_OF_DIMENSIONS];
+
+  rule_analysis_t *analysis;
+}
+analyser_t;
+
+void table_init (table_t *, int);
+uint32_t key_tag (uint64_t);
+int table_find (table_t *, uint64_t);
+void table_set (table_t *, uint64_t, int);
+uint64_t mix (uint64_t, uint64_t);
+int option_hashes (rule_t *, uint64_t *, int *);
+uint64_t option_hash (option_t *);
+uint64_t options_key (uint64_t *, int, int);
+uint64_t dimension_key (rule_t *, uint8_t, uint64_t, int);
+uint64_t chain_key (uint64_t, uint8_t, uint32_t);
+void block_span (uint32_t, uint32_t, uint32_t *, uint32_t *);
+void chain_row (analyser_t *, int, uint32_t, uint32_t);
+bool shadowed (analyser_t *, rule_t *, uint8_t, uint64_t *, int, bool *);
+bool merged (analyser_t *, rule_t *, uint8_t, uint64_t);
+void add_row (analyser_t *, rule_t *, uint8_t, uint64_t, int);
+
+/* Returns the rows to check, allocated in the storage's hot arena */
+rule_t **analyse_rules (rule_storage_t *storage, rule_t *rules, int *number_of_rows)
+{
+  analyser_t analyser;
+  rule_analysis_t *analysis = &(storage->analysis);
+
+  memset (&analyser, 0, sizeof (analyser_t));
+  memset (analysis, 0, sizeof (rule_analysis_t));
+
+  analyser.storage = storage;
+  analyser.analysis = analysis;
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    analysis->rules++;
+  }
+
+  analyser.rows = (row_t *) calloc (analysis->rules + 1, sizeof (row_t));
+  if (analyser.rows == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule analysis\n");
+    exit (EXIT_FAILURE);
+  }
+
+  table_init (&(analyser.chains), analysis->rules);
+
+  for (int d = 0; d < NUMBER_OF_DIMENSIONS; d++)
+  {
+    table_init (&(analyser.by_dimension[d]), analysis->rules);
+  }
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    uint64_t hashes[MAX_OPTIONS + 1];
+    int number_of_options;
+    int number_of_hashes = option_hashes (rule, hashes, &number_of_options);
+    uint64_t options = options_key (hashes, number_of_hashes, (1 << number_of_hashes) - 1);
+    uint8_t protocol = protocol_number (rule);
+    bool duplicate;
+
+    analysis->option_checks += number_of_options;
+
+    if (number_of_hashes <= MAX_OPTIONS &&
+        shadowed (&analyser, rule, protocol, hashes, number_of_hashes, &duplicate) == true)
+    {
+      if (duplicate == true)
+      {
+        analysis->duplicates++;
+      }
+      else
+      {
+        analysis->shadowed++;
+      }
+
+      continue;
+    }
+
+    if (merged (&analyser, rule, protocol, options) == true)
+    {
+      analysis->merged++;
+      continue;
+    }
+
+    add_row (&analyser, rule, protocol, options, number_of_options);
+  }
+
+  rule_t **checked = (rule_t **) arena_alloc (&(storage->hot), (analyser.number_of_rows + 1) * sizeof (rule_t *),
+                                               sizeof (rule_t *));
+
+  analysis->rows = analyser.number_of_rows;
+
+  for (int i = 0; i < analyser.number_of_rows; i++)
+  {
+    checked[i] = analyser.rows[i].rule;
+
+    if (checked[i]->members != NULL)
+    {
+      analysis->groups++;
+    }
+
+    analysis->option_checks_left += analyser.rows[i].number_of_options;
+  }
+
+  free (analyser.rows);
+  free (analyser.links);
+  free (analyser.chains.slots);
+
+  for (int d = 0; d < NUMBER_OF_DIMENSIONS; d++)
+  {
+    free (analyser.by_dimension[d].slots);
+  }
+
+  *number_of_rows = analyser.number_of_rows;
+
+  return checked;
+}
+
+void table_init (table_t *table, int number)
+{
+  uint64_t size = 2;
+
+  while (size < 2 * (uint64_t) number)
+  {
+    size *= 2;
+  }
+
+  table->slots = (slot_t *) calloc (size, sizeof (slot_t));
+  table->mask = size - 1;
+  table->used = 0;
+
+  if (table->slots == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule analysis\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+uint32_t key_tag (uint64_t key)
+{
+  uint32_t tag = (uint32_t) (key >> 32);
+
+  return tag != 0 ? tag : 1;
+}
+
+int table_find (table_t *table, uint64_t key)
+{
+  uint32_t tag = key_tag (key);
+
+  for (uint64_t slot = tag & table->mask; table->slots[slot].tag != 0; slot = (slot + 1) & table->mask)
+  {
+    if (table->slots[slot].tag == tag)
+    {
+      return table->slots[slot].value;
+    }
+  }
+
+  return -1;
+}
+
+void table_grow (table_t *);
+
+void table_set (table_t *table, uint64_t key, int value)
+{
+  if (2 * (table->used + 1) > table->mask + 1)
+  {
+    table_grow (table);
+  }
+
+  uint32_t tag = key_tag (key);
+  uint64_t slot = tag & table->mask;
+
+  while (table->slots[slot].tag != 0 && table->slots[slot].tag != tag)
+  {
+    slot = (slot + 1) & table->mask;
+  }
+
+  if (table->slots[slot].tag == 0)
+  {
+    table->used++;
+  }
+
+  table->slots[slot].tag = tag;
+  table->slots[slot].value = value;
+}
+
+void table_grow (table_t *table)
+{
+  table_t grown;
+
+  table_init (&grown, (int) (table->mask + 1));
+
+  for (uint64_t slot = 0; slot <= table->mask; slot++)
+  {
+    uint32_t tag = table->slots[slot].tag;
+
+    if (tag != 0)
+    {
+      uint64_t free_slot = tag & grown.mask;
+
+      while (grown.slots[free_slot].tag != 0)
+      {
+        free_slot = (free_slot + 1) & grown.mask;
+      }
+
+      grown.slots[free_slot] = table->slots[slot];
+      grown.used++;
+    }
+  }
+
+  free (table->slots);
+  *table = grown;
+}
+
+uint64_t mix (uint64_t hash, uint64_t value)
+{
+  hash = (hash ^ value) * MIX_MULTIPLIER;
+
+  return hash ^ (hash >> 29);
+}
+
+uint64_t hash_string (uint64_t, char *);
+uint64_t hash_bytes (uint64_t, char *, int);
+
+/* One hash per distinct option other than the message. Returns how many,
+   which is more than MAX_OPTIONS when there were too many to keep, and
+   counts all the options. */
+int option_hashes (rule_t *rule, uint64_t *hashes, int *number_of_options)
+{
+  int number = 0;
+
+  *number_of_options = 0;
+
+  for (option_t *option = rule->options; option != NULL; option = option->next)
+  {
+    (*number_of_options)++;
+
+    if (option->modifier == true || strcmp (option->name, STRING_MSG) == 0)
+    {
+      continue;
+    }
+
+    uint64_t hash = option_hash (option);
+    bool seen = false;
+
+    for (int i = 0; i < number && i <= MAX_OPTIONS; i++)
+    {
+      seen = seen || hashes[i] == hash;
+    }
+
+    if (seen == false)
+    {
+      if (number <= MAX_OPTIONS)
+      {
+        hashes[number] = hash;
+      }
+
+      number++;
+    }
+  }
+
+  return number;
+}
+
+/* A content is hashed with its window and, when relative, the content it
+   follows, the modifiers themselves are skipped */
+uint64_t option_hash (option_t *option)
+{
+  uint64_t hash = hash_bytes (hash_string (FNV_OFFSET, option->name), option->value, option->value_length);
+  content_t *content = &(option->content);
+
+  if (strcmp (option->name, STRING_CONTENT) == 0)
+  {
+    hash = mix (mix (mix (hash, (uint64_t) (uint32_t) content->start), (uint64_t) (uint32_t) content->length),
+                (content->nocase == true ? 1 : 0) | (content->relative == true ? 2 : 0));
+
+    if (content->relative == true)
+    {
+      hash = mix (hash, option_hash (content->previous));
+    }
+  }
+
+  return hash;
+}
+
+uint64_t hash_string (uint64_t hash, char *string)
+{
+  return hash_bytes (hash, string, (int) strlen (string));
+}
+
+uint64_t hash_bytes (uint64_t hash, char *bytes, int length)
+{
+  for (int i = 0; i < length; i++)
+  {
+    hash = (hash ^ (uint8_t) bytes[i]) * FNV_PRIME;
+  }
+
+  return (hash ^ 0xFF) * FNV_PRIME;
+}
+
+/* Order independent key of the options selected by mask */
+uint64_t options_key (uint64_t *hashes, int number, int mask)
+{
+  uint64_t key = 1;
+
+  for (int i = 0; i < number && i <= MAX_OPTIONS; i++)
+  {
+    if ((mask & (1 << i)) != 0)
+    {
+      key += hashes[i];
+    }
+  }
+
+  return key != 0 ? key : 1;
+}
+
+uint64_t port_key (uint64_t, port_t *);
+
+/* Key of everything but the given dimension */
+uint64_t dimension_key (rule_t *rule, uint8_t protocol, uint64_t options, int dimension)
+{
+  uint64_t key = mix (mix (FNV_OFFSET, options), protocol);
+
+  key = mix (key, dimension);
+
+  if (dimension != SOURCE_IP)
+  {
+    key = mix (mix (key, rule->source_ip.start), rule->source_ip.finish);
+  }
+
+  if (dimension != DEST_IP)
+  {
+    key = mix (mix (key, rule->dest_ip.start), rule->dest_ip.finish);
+  }
+
+  if (dimension != SOURCE_PORT)
+  {
+    key = port_key (key, &(rule->source_port));
+  }
+
+  if (dimension != DEST_PORT)
+  {
+    key = port_key (key, &(rule->dest_port));
+  }
+
+  return key != 0 ? key : 1;
+}
+
+uint64_t port_key (uint64_t key, port_t *port)
+{
+  if (port->colon_found == true)
+  {
+    return mix (mix (key, port->start), port->finish);
+  }
+
+  for (int i = 0; i < port->number_of_ports; i++)
+  {
+    key = mix (key, port->ports[i] + 0x10000);
+  }
+
+  return key;
+}
+
+bool ip_covers (ip_t *, ip_t *);
+bool port_covers (port_t *, port_t *);
+bool port_equal (port_t *, port_t *);
+bool options_subset (rule_t *, rule_t *, bool);
+bool same_option (option_t *, option_t *);
+bool same_message (rule_t *, rule_t *);
+
+/* Looks for an earlier row matching every packet the rule matches: one
+   whose options are a subset of the rule's, so each subset is tried, and
+   whose destination covers the rule's, so in the chain of its block or in
+   that of wide rows */
+bool shadowed (analyser_t *analyser, rule_t *rule, uint8_t protocol, uint64_t *hashes, int number,
+               bool *duplicate)
+{
+  uint32_t blocks[2] = {rule->dest_ip.start >> BLOCK_SHIFT, WIDE_BLOCK};
+
+  uint16_t source_port_start, source_port_finish, dest_port_start, dest_port_finish;
+
+  set_port_header (&(rule->source_port), &source_port_start, &source_port_finish);
+  set_port_header (&(rule->dest_port), &dest_port_start, &dest_port_finish);
+
+  for (int mask = 0; mask < (1 << number) * 2; mask++)
+  {
+    uint64_t key = chain_key (options_key (hashes, number, mask >> 1), protocol, blocks[mask & 1]);
+    int compared = 0;
+
+    for (int l = table_find (&(analyser->chains), key);
+         l >= 0 && compared < CANDIDATES; l = analyser->links[l].next, compared++)
+    {
+      row_t *row = &(analyser->rows[analyser->links[l].row]);
+      rule_t *earlier = row->rule;
+
+      if (row->protocol != protocol ||
+          row->source_start > rule->source_ip.start || row->source_finish < rule->source_ip.finish ||
+          row->dest_start > rule->dest_ip.start || row->dest_finish < rule->dest_ip.finish ||
+          row->source_port_start > source_port_start || row->source_port_finish < source_port_finish ||
+          row->dest_port_start > dest_port_start || row->dest_port_finish < dest_port_finish ||
+          port_covers (&(earlier->source_port), &(rule->source_port)) == false ||
+          port_covers (&(earlier->dest_port), &(rule->dest_port)) == false ||
+          options_subset (earlier, rule, false) == false)
+      {
+        continue;
+      }
+
+      *duplicate = earlier->members == NULL && options_subset (rule, earlier, false) == true &&
+                   same_message (rule, earlier) == true &&
+                   ip_covers (&(rule->source_ip), &(earlier->source_ip)) == true &&
+                   ip_covers (&(rule->dest_ip), &(earlier->dest_ip)) == true &&
+                   port_equal (&(rule->source_port), &(earlier->source_port)) == true &&
+                   port_equal (&(rule->dest_port), &(earlier->dest_port)) == true;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool disjoint (row_t *, rule_t *, uint8_t);
+bool same_except (rule_t *, rule_t *, int);
+bool join (analyser_t *, row_t *, rule_t *, int);
+
+bool merged (analyser_t *analyser, rule_t *rule, uint8_t protocol, uint64_t options)
+{
+  for (int d = 0; d < NUMBER_OF_DIMENSIONS; d++)
+  {
+    int r = table_find (&(analyser->by_dimension[d]), dimension_key (rule, protocol, options, d));
+
+    if (r < 0 || analyser->number_of_rows - r > MERGE_WINDOW)
+    {
+      continue;
+    }
+
+    row_t *row = &(analyser->rows[r]);
+
+    if ((row->dimension != -1 && row->dimension != d) || row->protocol != protocol ||
+        same_except (row->rule, rule, d) == false ||
+        options_subset (row->rule, rule, false) == false || options_subset (rule, row->rule, false) == false)
+    {
+      continue;
+    }
+
+    /* Packets of the rule would now reach the row before the rows in
+       between, which must not be able to match them */
+    bool clear = true;
+
+    for (int i = r + 1; i < analyser->number_of_rows && clear == true; i++)
+    {
+      clear = disjoint (&(analyser->rows[i]), rule, protocol);
+    }
+
+    if (clear == true && join (analyser, row, rule, d) == true)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void add_row (analyser_t *analyser, rule_t *rule, uint8_t protocol, uint64_t options, int number_of_options)
+{
+  int r = analyser->number_of_rows++;
+  row_t *row = &(analyser->rows[r]);
+
+  row->rule = rule;
+  row->protocol = protocol;
+  row->source_start = rule->source_ip.start;
+  row->source_finish = rule->source_ip.finish;
+  row->dest_start = rule->dest_ip.start;
+  row->dest_finish = rule->dest_ip.finish;
+
+  set_port_header (&(rule->source_port), &(row->source_port_start), &(row->source_port_finish));
+  set_port_header (&(rule->dest_port), &(row->dest_port_start), &(row->dest_port_finish));
+
+  row->options = options;
+  row->number_of_options = number_of_options;
+  row->dimension = -1;
+
+  chain_row (analyser, r, 1, 0);
+
+  for (int d = 0; d < NUMBER_OF_DIMENSIONS; d++)
+  {
+    table_set (&(analyser->by_dimension[d]), dimension_key (rule, protocol, options, d), r);
+  }
+}
+
+/* Adds the row to the chains of its destination blocks, but those from
+   chained_first to chained_last it is already in */
+void chain_row (analyser_t *analyser, int r, uint32_t chained_first, uint32_t chained_last)
+{
+  row_t *row = &(analyser->rows[r]);
+
+  uint32_t first;
+  uint32_t last;
+
+  block_span (row->dest_start, row->dest_finish, &first, &last);
+
+  for (uint32_t block = first; block <= last; block++)
+  {
+    if (block >= chained_first && block <= chained_last)
+    {
+      continue;
+    }
+
+    if (analyser->number_of_links == analyser->allocated_links)
+    {
+      analyser->allocated_links = 2 * analyser->allocated_links + MAX_BLOCKS;
+      analyser->links = (link_t *) realloc (analyser->links, analyser->allocated_links * sizeof (link_t));
+      if (analyser->links == NULL)
+      {
+        fprintf (stderr, "Could not allocate the rule analysis\n");
+        exit (EXIT_FAILURE);
+      }
+    }
+
+    uint64_t key = chain_key (row->options, row->protocol, block);
+    int l = analyser->number_of_links++;
+
+    analyser->links[l].row = r;
+    analyser->links[l].next = table_find (&(analyser->chains), key);
+
+    table_set (&(analyser->chains), key, l);
+  }
+}
+
+void block_span (uint32_t start, uint32_t finish, uint32_t *first, uint32_t *last)
+{
+  *first = start >> BLOCK_SHIFT;
+  *last = finish >> BLOCK_SHIFT;
+
+  if (*last - *first >= MAX_BLOCKS)
+  {
+    *first = *last = WIDE_BLOCK;
+  }
+}
+
+uint64_t chain_key (uint64_t options, uint8_t protocol, uint32_t block)
+{
+  uint64_t key = mix (mix (mix (FNV_OFFSET, options), protocol), block);
+
+  return key != 0 ? key : 1;
+}
+
+bool union_ip (ip_t *, ip_t *, ip_t *);
+bool union_port (port_t *, port_t *, port_t *, arena_t *);
+
+/* Widens the row by the rule along the dimension. On the first member
+   the row becomes a merged rule: a copy of its first member, whose
+   strings stay those of that member. */
+bool join (analyser_t *analyser, row_t *row, rule_t *rule, int dimension)
+{
+  arena_t *hot = &(analyser->storage->hot);
+  arena_t *cold = &(analyser->storage->cold);
+
+  ip_t ip;
+  port_t port;
+  bool joined = false;
+
+  switch (dimension)
+  {
+  case SOURCE_IP:
+    joined = union_ip (&(row->rule->source_ip), &(rule->source_ip), &ip);
+    break;
+
+  case DEST_IP:
+    joined = union_ip (&(row->rule->dest_ip), &(rule->dest_ip), &ip);
+    break;
+
+  case SOURCE_PORT:
+    joined = union_port (&(row->rule->source_port), &(rule->source_port), &port, hot);
+    break;
+
+  default:
+    joined = union_port (&(row->rule->dest_port), &(rule->dest_port), &port, hot);
+    break;
+  }
+
+  if (joined == false)
+  {
+    return false;
+  }
+
+  if (row->rule->members == NULL)
+  {
+    rule_t *first = row->rule;
+    rule_t *merged_rule = (rule_t *) arena_alloc (cold, sizeof (rule_t), sizeof (void *));
+
+    *merged_rule = *first;
+    merged_rule->prev = NULL;
+    merged_rule->next = NULL;
+
+    row->allocated_members = 4;
+    merged_rule->members = (rule_t **) arena_alloc (cold, row->allocated_members * sizeof (rule_t *),
+                                                    sizeof (rule_t *));
+    merged_rule->members[merged_rule->number_of_members++] = first;
+
+    row->rule = merged_rule;
+    row->dimension = dimension;
+  }
+
+  rule_t *merged_rule = row->rule;
+
+  if (merged_rule->number_of_members == row->allocated_members)
+  {
+    rule_t **members = (rule_t **) arena_alloc (cold, 2 * row->allocated_members * sizeof (rule_t *),
+                                                sizeof (rule_t *));
+
+    memcpy (members, merged_rule->members, row->allocated_members * sizeof (rule_t *));
+
+    merged_rule->members = members;
+    row->allocated_members *= 2;
+  }
+
+  merged_rule->members[merged_rule->number_of_members++] = rule;
+
+  switch (dimension)
+  {
+  case SOURCE_IP:
+    merged_rule->source_ip.start = row->source_start = ip.start;
+    merged_rule->source_ip.finish = row->source_finish = ip.finish;
+    break;
+
+  case DEST_IP:
+    {
+      uint32_t chained_first;
+      uint32_t chained_last;
+
+      block_span (row->dest_start, row->dest_finish, &chained_first, &chained_last);
+
+      merged_rule->dest_ip.start = row->dest_start = ip.start;
+      merged_rule->dest_ip.finish = row->dest_finish = ip.finish;
+
+      chain_row (analyser, row - analyser->rows, chained_first, chained_last);
+    }
+    break;
+
+  case SOURCE_PORT:
+    port.str = merged_rule->source_port.str;
+    merged_rule->source_port = port;
+    set_port_header (&port, &(row->source_port_start), &(row->source_port_finish));
+    break;
+
+  default:
+    port.str = merged_rule->dest_port.str;
+    merged_rule->dest_port = port;
+    set_port_header (&port, &(row->dest_port_start), &(row->dest_port_finish));
+    break;
+  }
+
+  return true;
+}
+
+/* Only ranges that overlap or touch make a range */
+bool union_ip (ip_t *a, ip_t *b, ip_t *result)
+{
+  if ((uint64_t) b->start > (uint64_t) a->finish + 1 || (uint64_t) a->start > (uint64_t) b->finish + 1)
+  {
+    return false;
+  }
+
+  result->start = a->start < b->start ? a->start : b->start;
+  result->finish = a->finish > b->finish ? a->finish : b->finish;
+
+  return true;
+}
+
+bool has_port (port_t *, uint16_t);
+
+/* Two ranges that overlap or touch, or two lists short enough together */
+bool union_port (port_t *a, port_t *b, port_t *result, arena_t *arena)
+{
+  memset (result, 0, sizeof (port_t));
+
+  if (a->colon_found == true && b->colon_found == true)
+  {
+    if ((int) b->start > (int) a->finish + 1 || (int) a->start > (int) b->finish + 1)
+    {
+      return false;
+    }
+
+    result->colon_found = true;
+    result->start = a->start < b->start ? a->start : b->start;
+    result->finish = a->finish > b->finish ? a->finish : b->finish;
+
+    return true;
+  }
+
+  if (a->colon_found == true || b->colon_found == true ||
+      a->number_of_ports + b->number_of_ports > MAX_MERGED_PORTS)
+  {
+    return false;
+  }
+
+  result->ports = (uint16_t *) arena_alloc (arena, (a->number_of_ports + b->number_of_ports) * sizeof (uint16_t),
+                                            sizeof (uint16_t));
+
+  memcpy (result->ports, a->ports, a->number_of_ports * sizeof (uint16_t));
+  result->number_of_ports = a->number_of_ports;
+
+  for (int i = 0; i < b->number_of_ports; i++)
+  {
+    if (has_port (result, b->ports[i]) == false)
+    {
+      result->ports[result->number_of_ports++] = b->ports[i];
+    }
+  }
+
+  return true;
+}
+
+bool has_port (port_t *port, uint16_t value)
+{
+  if (port->colon_found == true)
+  {
+    return value >= port->start && value <= port->finish;
+  }
+
+  for (int i = 0; i < port->number_of_ports; i++)
+  {
+    if (port->ports[i] == value)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool ip_covers (ip_t *a, ip_t *b)
+{
+  return a->start <= b->start && a->finish >= b->finish;
+}
+
+/* Whether every port of b is a port of a. A range is only compared
+   port by port against a list when it is short. */
+bool port_covers (port_t *a, port_t *b)
+{
+  if (b->colon_found == true)
+  {
+    if (a->colon_found == true)
+    {
+      return a->start <= b->start && a->finish >= b->finish;
+    }
+
+    if (b->finish - b->start >= MAX_MERGED_PORTS)
+    {
+      return false;
+    }
+
+    for (int value = b->start; value <= b->finish; value++)
+    {
+      if (has_port (a, (uint16_t) value) == false)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  for (int i = 0; i < b->number_of_ports; i++)
+  {
+    if (has_port (a, b->ports[i]) == false)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool port_equal (port_t *a, port_t *b)
+{
+  return a->colon_found == b->colon_found && port_covers (a, b) == true && port_covers (b, a) == true;
+}
+
+bool ports_disjoint (port_t *, port_t *);
+
+/* Whether no packet can match both the row and the rule */
+bool disjoint (row_t *row, rule_t *rule, uint8_t protocol)
+{
+  rule_t *other = row->rule;
+
+  return row->protocol != protocol ||
+         row->source_finish < rule->source_ip.start || rule->source_ip.finish < row->source_start ||
+         row->dest_finish < rule->dest_ip.start || rule->dest_ip.finish < row->dest_start ||
+         ports_disjoint (&(other->source_port), &(rule->source_port)) == true ||
+         ports_disjoint (&(other->dest_port), &(rule->dest_port)) == true;
+}
+
+bool ports_disjoint (port_t *a, port_t *b)
+{
+  if (a->colon_found == true && b->colon_found == true)
+  {
+    return a->finish < b->start || b->finish < a->start;
+  }
+
+  port_t *list = a->colon_found == true ? b : a;
+  port_t *other = list == a ? b : a;
+
+  for (int i = 0; i < list->number_of_ports; i++)
+  {
+    if (has_port (other, list->ports[i]) == true)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Whether the two rules have the same IP ranges and ports, except in
+   the given dimension */
+bool same_except (rule_t *a, rule_t *b, int dimension)
+{
+  return (dimension == SOURCE_IP ||
+          (a->source_ip.start == b->source_ip.start && a->source_ip.finish == b->source_ip.finish)) &&
+         (dimension == DEST_IP ||
+          (a->dest_ip.start == b->dest_ip.start && a->dest_ip.finish == b->dest_ip.finish)) &&
+         (dimension == SOURCE_PORT || port_equal (&(a->source_port), &(b->source_port)) == true) &&
+         (dimension == DEST_PORT || port_equal (&(a->dest_port), &(b->dest_port)) == true);
+}
+
+/* Whether every option of a, the message aside, is also one of b */
+bool options_subset (rule_t *a, rule_t *b, bool with_message)
+{
+  for (option_t *option = a->options; option != NULL; option = option->next)
+  {
+    if (option->modifier == true || (with_message == false && strcmp (option->name, STRING_MSG) == 0))
+    {
+      continue;
+    }
+
+    bool found = false;
+
+    for (option_t *other = b->options; other != NULL && found == false; other = other->next)
+    {
+      found = other->modifier == false && same_option (option, other) == true;
+    }
+
+    if (found == false)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Contents only match the same packets with the same window, and relative
+   ones after the same content. A content checked with the relative content
+   after it is no narrower than on its own, so following is left out. */
+bool same_option (option_t *a, option_t *b)
+{
+  if (strcmp (a->name, b->name) != 0 || a->value_length != b->value_length ||
+      memcmp (a->value, b->value, a->value_length) != 0)
+  {
+    return false;
+  }
+
+  if (strcmp (a->name, STRING_CONTENT) != 0)
+  {
+    return true;
+  }
+
+  content_t *x = &(a->content);
+  content_t *y = &(b->content);
+
+  return x->start == y->start && x->length == y->length && x->nocase == y->nocase && x->relative == y->relative &&
+         (x->relative == false || same_option (x->previous, y->previous) == true);
+}
+
+bool same_message (rule_t *a, rule_t *b)
+{
+  return options_subset (a, b, true) == true && options_subset (b, a, true) == true;
+}
+
+void print_analysis (rule_t *rules)
+{
+  if (rules == NULL)
+  {
+    return;
+  }
+
+  rule_analysis_t *analysis = &(rules->storage->analysis);
+
+  if (analysis->rows == analysis->rules)
+  {
+    return;
+  }
+
+  printf ("Rule analysis: %d duplicate and %d shadowed rules dropped, %d rules merged into %d\n",
+          analysis->duplicates, analysis->shadowed, analysis->merged, analysis->groups);
+  printf ("  %d rules are checked as %d rows (%.1f%% fewer), %d options as %d (%.1f%% fewer)\n\n",
+          analysis->rules, analysis->rows, 100.0 * (analysis->rules - analysis->rows) / analysis->rules,
+          analysis->option_checks, analysis->option_checks_left,
+          analysis->option_checks > 0 ?
+          100.0 * (analysis->option_checks - analysis->option_checks_left) / analysis->option_checks : 0.0);
+}
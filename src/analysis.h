@@ -0,0 +1,9 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "structures.h"
+
+rule_t **analyse_rules (rule_storage_t *, rule_t *, int *);
+void print_analysis (rule_t *);
+
+#endif
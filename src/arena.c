@@ -0,0 +1,83 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "arena.h"
+
+/* Bump allocator: memory is handed out from large blocks and only ever
+   released all at once by arena_free */
+
+void arena_init (arena_t *arena, size_t block_size)
+{
+  arena->blocks = NULL;
+  arena->block_size = block_size;
+  arena->allocated = 0;
+}
+
+size_t aligned_offset (arena_block_t *, size_t);
+
+/* Returns zeroed memory aligned to alignment, a power of two. Requests
+   larger than a block get a block of their own. */
+void *arena_alloc (arena_t *arena, size_t size, size_t alignment)
+{
+  arena_block_t *block = arena->blocks;
+
+  if (block == NULL || aligned_offset (block, alignment) + size > block->size)
+  {
+    size_t block_size = size + alignment > arena->block_size ? size + alignment : arena->block_size;
+
+    block = (arena_block_t *) malloc (sizeof (arena_block_t) + block_size);
+    if (block == NULL)
+    {
+      fprintf (stderr, "Could not allocate an arena block\n");
+      exit (EXIT_FAILURE);
+    }
+
+    block->next = arena->blocks;
+    block->size = block_size;
+    block->used = 0;
+
+    arena->blocks = block;
+    arena->allocated += block_size;
+  }
+
+  size_t offset = aligned_offset (block, alignment);
+
+  void *memory = block->data + offset;
+  block->used = offset + size;
+
+  memset (memory, 0, size);
+
+  return memory;
+}
+
+size_t aligned_offset (arena_block_t *block, size_t alignment)
+{
+  uintptr_t start = (uintptr_t) block->data;
+  uintptr_t next = (start + block->used + alignment - 1) & ~((uintptr_t) alignment - 1);
+
+  return (size_t) (next - start);
+}
+
+char *arena_strndup (arena_t *arena, const char *string, size_t length)
+{
+  char *copy = (char *) arena_alloc (arena, length + 1, 1);
+
+  memcpy (copy, string, length);
+  copy[length] = '\0';
+
+  return copy;
+}
+
+void arena_free (arena_t *arena)
+{
+  while (arena->blocks != NULL)
+  {
+    arena_block_t *next = arena->blocks->next;
+
+    free (arena->blocks);
+    arena->blocks = next;
+  }
+
+  arena->allocated = 0;
+}
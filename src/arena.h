@@ -0,0 +1,11 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "structures.h"
+
+void arena_init (arena_t *, size_t);
+void *arena_alloc (arena_t *, size_t, size_t);
+char *arena_strndup (arena_t *, const char *, size_t);
+void arena_free (arena_t *);
+
+#endif
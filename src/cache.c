@@ -0,0 +1,700 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "rules.h"
+#include "arena.h"
+
+#include "cache.h"
+
+#define HASH_BUFFER_SIZE (0x10000)
+#define SECTION_ALIGNMENT (8)
+
+#define CACHE_OPTION_MODIFIER (0x01)
+#define CACHE_OPTION_NOCASE (0x02)
+#define CACHE_OPTION_RELATIVE (0x04)
+
+/* The compiled rule set is cached next to nothing but its own key: the
+   hash and size of the rule file. When they match, the cache is mapped
+   read-only and only the list nodes and headers are allocated; strings
+   and port lists stay in the mapping, so processes loading the same cache
+   share its pages. The rows left by the rule analysis are kept as well.
+   Otherwise the rule file is parsed and the cache is written again. */
+
+rule_t *load_cache (char *, uint64_t, uint64_t);
+void save_cache (char *, rule_t *, uint64_t, uint64_t);
+
+rule_t *get_cached_rules (char *rules_filename, char *cache_filename)
+{
+  rule_t *rules;
+
+  if (read_cached_rules (rules_filename, cache_filename, NULL, &rules, NULL) == false)
+  {
+    exit (EXIT_FAILURE);
+  }
+
+  return rules;
+}
+
+/* Like read_rules, false when the rule file cannot be read or parsed.
+   Rules of previous are only reused when the cache has to be rebuilt. */
+bool read_cached_rules (char *rules_filename, char *cache_filename, rule_t *previous,
+                        rule_t **rules, rule_reuse_t *reuse)
+{
+  uint64_t source_size;
+  uint64_t source_hash;
+
+  if (hash_file (rules_filename, &source_hash, &source_size) == false)
+  {
+    return false;
+  }
+
+  *rules = load_cache (cache_filename, source_hash, source_size);
+  if (*rules != NULL)
+  {
+    printf ("Rules loaded from cache %s\n\n", cache_filename);
+    return true;
+  }
+
+  if (read_rules (rules_filename, previous, rules, reuse) == false)
+  {
+    return false;
+  }
+
+  save_cache (cache_filename, *rules, source_hash, source_size);
+
+  return true;
+}
+
+bool hash_file (char *filename, uint64_t *hash, uint64_t *size)
+{
+  FILE *file = fopen (filename, "r");
+  if (file == NULL)
+  {
+    fprintf (stderr, "Could not open %s\n", filename);
+    return false;
+  }
+
+  uint8_t buffer[HASH_BUFFER_SIZE];
+  size_t length;
+
+  *hash = FNV_OFFSET;
+  *size = 0;
+
+  while ((length = fread (buffer, 1, HASH_BUFFER_SIZE, file)) > 0)
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      *hash = (*hash ^ buffer[i]) * FNV_PRIME;
+    }
+
+    *size += length;
+  }
+
+  fclose (file);
+
+  return true;
+}
+
+/* Growable byte buffer used to lay out the sections */
+typedef struct section_tag
+{
+  uint8_t *data;
+  uint64_t length;
+  uint64_t allocated;
+}
+section_t;
+
+uint64_t append (section_t *, void *, uint64_t);
+int32_t option_index (option_t *, option_t *);
+uint32_t append_string (section_t *, char *);
+void fill_port (cache_port_t *, port_t *, section_t *, section_t *);
+void fill_rows (cache_header_t *, rule_t *, section_t *, section_t *, section_t *, section_t *);
+bool write_section (FILE *, section_t *, uint64_t);
+
+void save_cache (char *filename, rule_t *rules, uint64_t source_hash, uint64_t source_size)
+{
+  section_t rule_section = {NULL, 0, 0};
+  section_t option_section = {NULL, 0, 0};
+  section_t port_section = {NULL, 0, 0};
+  section_t string_section = {NULL, 0, 0};
+  section_t row_section = {NULL, 0, 0};
+  section_t member_section = {NULL, 0, 0};
+
+  cache_header_t header;
+
+  memset (&header, 0, sizeof (cache_header_t));
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    cache_rule_t entry;
+
+    memset (&entry, 0, sizeof (cache_rule_t));
+
+    entry.id = rule->id;
+    entry.str = append_string (&string_section, rule->str);
+    entry.protocol = append_string (&string_section, rule->protocol);
+
+    entry.source_ip_str = append_string (&string_section, rule->source_ip.str);
+    entry.source_ip_start = rule->source_ip.start;
+    entry.source_ip_finish = rule->source_ip.finish;
+
+    entry.dest_ip_str = append_string (&string_section, rule->dest_ip.str);
+    entry.dest_ip_start = rule->dest_ip.start;
+    entry.dest_ip_finish = rule->dest_ip.finish;
+
+    fill_port (&(entry.source_port), &(rule->source_port), &port_section, &string_section);
+    fill_port (&(entry.dest_port), &(rule->dest_port), &port_section, &string_section);
+
+    entry.first_option = header.number_of_options;
+
+    for (option_t *option = rule->options; option != NULL; option = option->next)
+    {
+      cache_option_t option_entry;
+
+      memset (&option_entry, 0, sizeof (cache_option_t));
+
+      option_entry.id = option->id;
+      option_entry.name = append_string (&string_section, option->name);
+      option_entry.value = (uint32_t) append (&string_section, option->value, option->value_length + 1);
+      option_entry.value_length = (uint32_t) option->value_length;
+
+      option_entry.start = option->content.start;
+      option_entry.length = option->content.length;
+      option_entry.flags = (option->modifier == true ? CACHE_OPTION_MODIFIER : 0) |
+                           (option->content.nocase == true ? CACHE_OPTION_NOCASE : 0) |
+                           (option->content.relative == true ? CACHE_OPTION_RELATIVE : 0);
+      option_entry.previous = option_index (rule->options, option->content.previous);
+      option_entry.following = option_index (rule->options, option->content.following);
+
+      append (&option_section, &option_entry, sizeof (cache_option_t));
+
+      entry.number_of_options++;
+      header.number_of_options++;
+    }
+
+    append (&rule_section, &entry, sizeof (cache_rule_t));
+    header.number_of_rules++;
+  }
+
+  fill_rows (&header, rules, &row_section, &member_section, &port_section, &string_section);
+
+  memcpy (header.magic, RULE_CACHE_MAGIC, sizeof (header.magic));
+  header.version = RULE_CACHE_VERSION;
+  header.byte_order = RULE_CACHE_BYTE_ORDER;
+  header.source_hash = source_hash;
+  header.source_size = source_size;
+
+  header.number_of_ports = (uint32_t) (port_section.length / sizeof (uint16_t));
+  header.strings_size = (uint32_t) string_section.length;
+
+  header.rules_offset = sizeof (cache_header_t);
+  header.options_offset = header.rules_offset + rule_section.length;
+  header.rows_offset = header.options_offset + option_section.length;
+  header.members_offset = header.rows_offset + row_section.length;
+  header.ports_offset = header.members_offset + member_section.length;
+  header.strings_offset = (header.ports_offset + port_section.length + SECTION_ALIGNMENT - 1) &
+                          ~((uint64_t) SECTION_ALIGNMENT - 1);
+  header.file_size = header.strings_offset + string_section.length;
+
+  /* Written aside and renamed, so a reader never maps half a cache */
+  char temporary[LINE_LENGTH];
+
+  snprintf (temporary, LINE_LENGTH, "%s.tmp", filename);
+
+  FILE *file = fopen (temporary, "w");
+
+  bool written = file != NULL &&
+                 fwrite (&header, sizeof (cache_header_t), 1, file) == 1 &&
+                 write_section (file, &rule_section, header.rules_offset) == true &&
+                 write_section (file, &option_section, header.options_offset) == true &&
+                 write_section (file, &row_section, header.rows_offset) == true &&
+                 write_section (file, &member_section, header.members_offset) == true &&
+                 write_section (file, &port_section, header.ports_offset) == true &&
+                 write_section (file, &string_section, header.strings_offset) == true;
+
+  if (file != NULL && fclose (file) != 0)
+  {
+    written = false;
+  }
+
+  if (written == true && rename (temporary, filename) == 0)
+  {
+    printf ("Rule cache %s written\n\n", filename);
+  }
+  else
+  {
+    fprintf (stderr, "Could not write rule cache %s\n", filename);
+    unlink (temporary);
+  }
+
+  free (rule_section.data);
+  free (option_section.data);
+  free (row_section.data);
+  free (member_section.data);
+  free (port_section.data);
+  free (string_section.data);
+}
+
+uint64_t append (section_t *section, void *data, uint64_t length)
+{
+  if (section->length + length > section->allocated)
+  {
+    section->allocated = 2 * (section->length + length);
+    section->data = (uint8_t *) realloc (section->data, section->allocated);
+
+    if (section->data == NULL)
+    {
+      fprintf (stderr, "Could not allocate the rule cache\n");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  memcpy (section->data + section->length, data, length);
+
+  uint64_t offset = section->length;
+  section->length += length;
+
+  return offset;
+}
+
+/* Position of option in the list, or -1 */
+int32_t option_index (option_t *options, option_t *option)
+{
+  int32_t index = 0;
+
+  for (option_t *other = options; other != NULL; other = other->next, index++)
+  {
+    if (other == option)
+    {
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+uint32_t append_string (section_t *strings, char *string)
+{
+  return (uint32_t) append (strings, string, strlen (string) + 1);
+}
+
+void fill_port (cache_port_t *entry, port_t *port, section_t *ports, section_t *strings)
+{
+  entry->str = append_string (strings, port->str);
+  entry->colon_found = port->colon_found;
+  entry->start = port->start;
+  entry->finish = port->finish;
+  entry->number_of_ports = 0;
+  entry->first_port = (uint32_t) (ports->length / sizeof (uint16_t));
+
+  if (port->colon_found == false)
+  {
+    entry->number_of_ports = port->number_of_ports;
+    append (ports, port->ports, port->number_of_ports * sizeof (uint16_t));
+  }
+}
+
+/* Rows refer to rules by id, which is unique within the list */
+void fill_rows (cache_header_t *header, rule_t *rules, section_t *rows, section_t *members,
+                section_t *ports, section_t *strings)
+{
+  if (rules == NULL)
+  {
+    return;
+  }
+
+  rule_storage_t *storage = rules->storage;
+
+  header->duplicates = storage->analysis.duplicates;
+  header->shadowed = storage->analysis.shadowed;
+
+  for (int i = 0; i < storage->headers->number; i++)
+  {
+    rule_t *row = storage->headers->rules[i];
+    cache_row_t entry;
+
+    memset (&entry, 0, sizeof (cache_row_t));
+
+    entry.rule = row->id;
+    entry.first_member = header->number_of_members;
+
+    for (int j = 0; j < row->number_of_members; j++)
+    {
+      uint32_t id = row->members[j]->id;
+
+      append (members, &id, sizeof (uint32_t));
+      entry.number_of_members++;
+      header->number_of_members++;
+    }
+
+    entry.source_ip_start = row->source_ip.start;
+    entry.source_ip_finish = row->source_ip.finish;
+    entry.dest_ip_start = row->dest_ip.start;
+    entry.dest_ip_finish = row->dest_ip.finish;
+
+    fill_port (&(entry.source_port), &(row->source_port), ports, strings);
+    fill_port (&(entry.dest_port), &(row->dest_port), ports, strings);
+
+    append (rows, &entry, sizeof (cache_row_t));
+    header->number_of_rows++;
+  }
+}
+
+/* Pads the file up to offset, then writes the section */
+bool write_section (FILE *file, section_t *section, uint64_t offset)
+{
+  while ((uint64_t) ftell (file) < offset)
+  {
+    if (fputc (0, file) == EOF)
+    {
+      return false;
+    }
+  }
+
+  return section->length == 0 || fwrite (section->data, section->length, 1, file) == 1;
+}
+
+bool valid_cache (cache_header_t *, uint64_t, uint64_t, uint64_t);
+bool valid_string (cache_header_t *, uint32_t);
+bool valid_port (cache_header_t *, cache_port_t *);
+char *string_at (uint8_t *, cache_header_t *, uint32_t);
+void set_port (port_t *, cache_port_t *, uint8_t *, cache_header_t *);
+int *index_ids (cache_header_t *, cache_rule_t *);
+bool valid_rows (cache_header_t *, uint8_t *);
+rule_t **load_rows (rule_storage_t *, rule_t *, int *, cache_header_t *, uint8_t *);
+
+/* Returns NULL when there is no usable cache for this rule file */
+rule_t *load_cache (char *filename, uint64_t source_hash, uint64_t source_size)
+{
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+
+  struct stat status;
+
+  if (fstat (fd, &status) != 0 || (uint64_t) status.st_size < sizeof (cache_header_t))
+  {
+    close (fd);
+    return NULL;
+  }
+
+  uint8_t *mapping = (uint8_t *) mmap (NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (mapping == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+  cache_header_t *header = (cache_header_t *) mapping;
+
+  if (valid_cache (header, status.st_size, source_hash, source_size) == false)
+  {
+    munmap (mapping, status.st_size);
+    return NULL;
+  }
+
+  cache_rule_t *entries = (cache_rule_t *) (mapping + header->rules_offset);
+  cache_option_t *option_entries = (cache_option_t *) (mapping + header->options_offset);
+
+  /* Position in the list of each rule id, NULL when ids are not distinct */
+  int *index_of_id = index_ids (header, entries);
+
+  if (index_of_id == NULL || valid_rows (header, mapping) == false)
+  {
+    free (index_of_id);
+    munmap (mapping, status.st_size);
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < header->number_of_rules; i++)
+  {
+    cache_rule_t *entry = &(entries[i]);
+
+    if (valid_string (header, entry->str) == false || valid_string (header, entry->protocol) == false ||
+        valid_string (header, entry->source_ip_str) == false || valid_string (header, entry->dest_ip_str) == false ||
+        valid_port (header, &(entry->source_port)) == false || valid_port (header, &(entry->dest_port)) == false ||
+        (uint64_t) entry->first_option + entry->number_of_options > header->number_of_options)
+    {
+      free (index_of_id);
+      munmap (mapping, status.st_size);
+      return NULL;
+    }
+
+    for (uint32_t j = 0; j < entry->number_of_options; j++)
+    {
+      cache_option_t *option_entry = &(option_entries[entry->first_option + j]);
+
+      if (valid_string (header, option_entry->name) == false || valid_string (header, option_entry->value) == false ||
+          (uint64_t) option_entry->value + option_entry->value_length >= header->strings_size ||
+          option_entry->id < 0 || option_entry->previous < -1 || option_entry->following < -1 ||
+          option_entry->previous >= (int64_t) entry->number_of_options ||
+          option_entry->following >= (int64_t) entry->number_of_options ||
+          ((option_entry->flags & CACHE_OPTION_RELATIVE) != 0 && option_entry->previous < 0))
+      {
+        free (index_of_id);
+        munmap (mapping, status.st_size);
+        return NULL;
+      }
+    }
+  }
+
+  rule_storage_t *storage = new_rule_storage ();
+
+  storage->mapping = mapping;
+  storage->mapping_length = status.st_size;
+
+  rule_t *rules = (rule_t *) arena_alloc (&(storage->cold), header->number_of_rules * sizeof (rule_t),
+                                          sizeof (void *));
+  option_t *options = (option_t *) arena_alloc (&(storage->cold), header->number_of_options * sizeof (option_t),
+                                                sizeof (void *));
+
+  /* Strings and ports point into the read-only mapping; nothing writes
+     them once a rule has been parsed */
+  for (uint32_t i = 0; i < header->number_of_rules; i++)
+  {
+    cache_rule_t *entry = &(entries[i]);
+    rule_t *rule = &(rules[i]);
+
+    rule->id = entry->id;
+    rule->origin = storage;
+    rule->str = string_at (mapping, header, entry->str);
+    rule->protocol = string_at (mapping, header, entry->protocol);
+
+    rule->source_ip.str = string_at (mapping, header, entry->source_ip_str);
+    rule->source_ip.start = entry->source_ip_start;
+    rule->source_ip.finish = entry->source_ip_finish;
+
+    rule->dest_ip.str = string_at (mapping, header, entry->dest_ip_str);
+    rule->dest_ip.start = entry->dest_ip_start;
+    rule->dest_ip.finish = entry->dest_ip_finish;
+
+    set_port (&(rule->source_port), &(entry->source_port), mapping, header);
+    set_port (&(rule->dest_port), &(entry->dest_port), mapping, header);
+
+    for (uint32_t j = 0; j < entry->number_of_options; j++)
+    {
+      option_t *option = &(options[entry->first_option + j]);
+      cache_option_t *option_entry = &(option_entries[entry->first_option + j]);
+
+      option->id = option_entry->id;
+      option->name = string_at (mapping, header, option_entry->name);
+      option->value = string_at (mapping, header, option_entry->value);
+      option->value_length = (int) option_entry->value_length;
+      option->next = j + 1 < entry->number_of_options ? option + 1 : NULL;
+
+      option->modifier = (option_entry->flags & CACHE_OPTION_MODIFIER) != 0;
+      option->content.start = option_entry->start;
+      option->content.length = option_entry->length;
+      option->content.nocase = (option_entry->flags & CACHE_OPTION_NOCASE) != 0;
+      option->content.relative = (option_entry->flags & CACHE_OPTION_RELATIVE) != 0;
+      option->content.previous = option_entry->previous >= 0 ?
+                                 &(options[entry->first_option + option_entry->previous]) : NULL;
+      option->content.following = option_entry->following >= 0 ?
+                                  &(options[entry->first_option + option_entry->following]) : NULL;
+
+      if (option->id >= storage->next_option_id)
+      {
+        storage->next_option_id = option->id + 1;
+      }
+    }
+
+    rule->options = entry->number_of_options > 0 ? &(options[entry->first_option]) : NULL;
+    rule->prev = i > 0 ? &(rules[i - 1]) : NULL;
+    rule->next = i + 1 < header->number_of_rules ? &(rules[i + 1]) : NULL;
+  }
+
+  rule_t **rows = load_rows (storage, rules, index_of_id, header, mapping);
+
+  index_rules (storage, rules, rows, header->number_of_rows);
+
+  free (index_of_id);
+
+  return rules;
+}
+
+int *index_ids (cache_header_t *header, cache_rule_t *entries)
+{
+  int *index_of_id = (int *) malloc ((header->number_of_rules + 1) * sizeof (int));
+  if (index_of_id == NULL)
+  {
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < header->number_of_rules; i++)
+  {
+    index_of_id[i] = -1;
+  }
+
+  for (uint32_t i = 0; i < header->number_of_rules; i++)
+  {
+    int32_t id = entries[i].id;
+
+    if (id < 0 || (uint32_t) id >= header->number_of_rules || index_of_id[id] != -1)
+    {
+      free (index_of_id);
+      return NULL;
+    }
+
+    index_of_id[id] = (int) i;
+  }
+
+  return index_of_id;
+}
+
+bool valid_rows (cache_header_t *header, uint8_t *mapping)
+{
+  cache_row_t *row_entries = (cache_row_t *) (mapping + header->rows_offset);
+  uint32_t *member_ids = (uint32_t *) (mapping + header->members_offset);
+
+  for (uint32_t i = 0; i < header->number_of_rows; i++)
+  {
+    cache_row_t *entry = &(row_entries[i]);
+
+    if (entry->rule >= header->number_of_rules ||
+        (uint64_t) entry->first_member + entry->number_of_members > header->number_of_members ||
+        valid_port (header, &(entry->source_port)) == false || valid_port (header, &(entry->dest_port)) == false)
+    {
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < header->number_of_members; i++)
+  {
+    if (member_ids[i] >= header->number_of_rules)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Rebuilds the rows the analysis left when the cache was written, and
+   what it counted */
+rule_t **load_rows (rule_storage_t *storage, rule_t *rules, int *index_of_id, cache_header_t *header,
+                    uint8_t *mapping)
+{
+  cache_rule_t *entries = (cache_rule_t *) (mapping + header->rules_offset);
+  cache_row_t *row_entries = (cache_row_t *) (mapping + header->rows_offset);
+  uint32_t *member_ids = (uint32_t *) (mapping + header->members_offset);
+  rule_analysis_t *analysis = &(storage->analysis);
+
+  rule_t **rows = (rule_t **) arena_alloc (&(storage->hot), (header->number_of_rows + 1) * sizeof (rule_t *),
+                                           sizeof (rule_t *));
+
+  memset (analysis, 0, sizeof (rule_analysis_t));
+
+  analysis->rules = header->number_of_rules;
+  analysis->rows = header->number_of_rows;
+  analysis->duplicates = header->duplicates;
+  analysis->shadowed = header->shadowed;
+  analysis->option_checks = header->number_of_options;
+
+  for (uint32_t i = 0; i < header->number_of_rows; i++)
+  {
+    cache_row_t *entry = &(row_entries[i]);
+    int index = index_of_id[entry->rule];
+    rule_t *rule = &(rules[index]);
+
+    analysis->option_checks_left += entries[index].number_of_options;
+
+    if (entry->number_of_members == 0)
+    {
+      rows[i] = rule;
+      continue;
+    }
+
+    rule_t *merged_rule = (rule_t *) arena_alloc (&(storage->cold), sizeof (rule_t), sizeof (void *));
+
+    *merged_rule = *rule;
+    merged_rule->prev = NULL;
+    merged_rule->next = NULL;
+
+    merged_rule->source_ip.start = entry->source_ip_start;
+    merged_rule->source_ip.finish = entry->source_ip_finish;
+    merged_rule->dest_ip.start = entry->dest_ip_start;
+    merged_rule->dest_ip.finish = entry->dest_ip_finish;
+
+    set_port (&(merged_rule->source_port), &(entry->source_port), mapping, header);
+    set_port (&(merged_rule->dest_port), &(entry->dest_port), mapping, header);
+
+    merged_rule->members = (rule_t **) arena_alloc (&(storage->cold), entry->number_of_members * sizeof (rule_t *),
+                                                    sizeof (rule_t *));
+    merged_rule->number_of_members = entry->number_of_members;
+
+    for (uint32_t j = 0; j < entry->number_of_members; j++)
+    {
+      merged_rule->members[j] = &(rules[index_of_id[member_ids[entry->first_member + j]]]);
+    }
+
+    analysis->merged += entry->number_of_members - 1;
+    analysis->groups++;
+
+    rows[i] = merged_rule;
+  }
+
+  return rows;
+}
+
+bool valid_cache (cache_header_t *header, uint64_t file_size, uint64_t source_hash, uint64_t source_size)
+{
+  if (memcmp (header->magic, RULE_CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != RULE_CACHE_VERSION || header->byte_order != RULE_CACHE_BYTE_ORDER ||
+      header->source_hash != source_hash || header->source_size != source_size ||
+      header->file_size != file_size)
+  {
+    return false;
+  }
+
+  if (header->rules_offset + (uint64_t) header->number_of_rules * sizeof (cache_rule_t) > file_size ||
+      header->options_offset + (uint64_t) header->number_of_options * sizeof (cache_option_t) > file_size ||
+      header->rows_offset + (uint64_t) header->number_of_rows * sizeof (cache_row_t) > file_size ||
+      header->members_offset + (uint64_t) header->number_of_members * sizeof (uint32_t) > file_size ||
+      header->ports_offset + (uint64_t) header->number_of_ports * sizeof (uint16_t) > file_size ||
+      header->strings_offset + header->strings_size > file_size ||
+      header->rules_offset % SECTION_ALIGNMENT != 0 || header->options_offset % sizeof (uint32_t) != 0 ||
+      header->rows_offset % sizeof (uint32_t) != 0 || header->members_offset % sizeof (uint32_t) != 0 ||
+      header->ports_offset % sizeof (uint16_t) != 0)
+  {
+    return false;
+  }
+
+  /* Every string must end inside the section */
+  return header->strings_size > 0 &&
+         ((char *) header)[header->strings_offset + header->strings_size - 1] == '\0';
+}
+
+bool valid_string (cache_header_t *header, uint32_t offset)
+{
+  return offset < header->strings_size;
+}
+
+bool valid_port (cache_header_t *header, cache_port_t *port)
+{
+  return valid_string (header, port->str) == true && port->start <= 0xFFFF && port->finish <= 0xFFFF &&
+         (uint64_t) port->first_port + port->number_of_ports <= header->number_of_ports;
+}
+
+char *string_at (uint8_t *mapping, cache_header_t *header, uint32_t offset)
+{
+  return (char *) (mapping + header->strings_offset + offset);
+}
+
+void set_port (port_t *port, cache_port_t *entry, uint8_t *mapping, cache_header_t *header)
+{
+  port->str = string_at (mapping, header, entry->str);
+  port->colon_found = entry->colon_found != 0;
+  port->start = (uint16_t) entry->start;
+  port->finish = (uint16_t) entry->finish;
+  port->number_of_ports = (int) entry->number_of_ports;
+  port->ports = NULL;
+
+  if (port->colon_found == false)
+  {
+    port->ports = ((uint16_t *) (mapping + header->ports_offset)) + entry->first_port;
+  }
+}
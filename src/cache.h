@@ -0,0 +1,10 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "structures.h"
+
+rule_t *get_cached_rules (char *, char *);
+bool read_cached_rules (char *, char *, rule_t *, rule_t **, rule_reuse_t *);
+bool hash_file (char *, uint64_t *, uint64_t *);
+
+#endif
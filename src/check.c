@@ -4,86 +4,243 @@
 
 #include "subreg.h"
 #include "needle.h"
+#include "cycles.h"
+#include "profile.h"
+#include "stages.h"
+#include "stats.h"
+#include "order.h"
+#include "prefilter.h"
 
 #include "check.h"
 
-bool check_ip (ip_t *, uint32_t);
-bool check_port (port_t *, uint16_t);
-bool check_option (option_t *, packet_t *);
-
-rule_t *check_with_rules (packet_t *packet, rule_t *rules)
+#define CONTENT_SEARCHES (64) /* searches for one content and the relative contents after it */
+
+bool check_header (rule_headers_t *, int, packet_t *);
+bool check_options (rule_t *, packet_t *, profile_t *);
+void add_cost (cost_t *, bool, uint64_t);
+rule_t *matched_member (rule_t *, packet_t *);
+void count_row (rule_headers_t *, int, bool);
+bool pattern_missing (prefilter_t *, int32_t, packet_t *, counters_t *);
+
+/* Rules are checked in the order of the current headers. Their fields are
+   read from contiguous arrays, so rules whose headers do not match are
+   rejected without touching the rules themselves. A row with a fast
+   pattern is then skipped when the payload does not hold it.
+   A rule set compiled to native code is checked by it instead, unless
+   rules are being profiled or counted. */
+rule_t *check_with_rules (packet_t *packet, rule_t *rules, counters_t *counters)
 {
-  rule_t *cur_rule;
+  if (rules == NULL)
+  {
+    return NULL;
+  }
+
+  profile_t *profile = thread_profile;
+  rule_headers_t *headers = __atomic_load_n (&(rules->storage->headers), __ATOMIC_ACQUIRE);
+  int number = headers->number;
+  bool counting = counting_rows;
+  native_t *native = rules->storage->native;
+  prefilter_t *prefilter = rules->storage->prefilter;
+
+  if (native != NULL && profile == NULL && counting == false)
+  {
+    int row = native->match ((const uint8_t *) packet, &(native->calls));
 
-  for (cur_rule = rules; cur_rule != NULL; cur_rule = cur_rule->next)
+    return row >= 0 ? matched_member (native->rows[row], packet) : NULL;
+  }
+
+  if (counting == true)
+  {
+    COUNT (headers->packets, 1);
+  }
+
+  if (prefilter != NULL)
   {
-    if (strcmp (cur_rule->protocol, STRING_HTTP) == 0 || strcmp (cur_rule->protocol, STRING_TCP) == 0)
+    prefilter_start (prefilter);
+  }
+
+  for (int i = 0; i < number; i++)
+  {
+    if (profile == NULL)
     {
-      if (strcmp (STRING_TCP, packet->transport_protocol) != 0)
+      if (check_header (headers, i, packet) == false ||
+          (headers->patterns[i] >= 0 &&
+           pattern_missing (prefilter, headers->patterns[i], packet, counters) == true))
       {
-        fprintf (stderr, "Packet's transport protocol %s is not %s\n", packet->transport_protocol, STRING_TCP); fflush (stderr);
         continue;
       }
-    }
-    else
-    {
-      if (strcmp (cur_rule->protocol, packet->transport_protocol) != 0)
+
+      bool matched = check_options (headers->rules[i], packet, NULL);
+
+      if (counting == true)
       {
-        fprintf (stderr, "Packet's transport protocol %s is not %s\n", packet->transport_protocol, cur_rule->protocol); fflush (stderr);
-        continue;
+        count_row (headers, i, matched);
       }
-    }
 
-    bool matched;
+      if (matched == true)
+      {
+        return matched_member (headers->rules[i], packet);
+      }
 
-    matched = check_ip (&(cur_rule->source_ip), packet->source_IP);
-    if (matched == false)
-    {
-      fprintf (stderr, "Packet's source IP was not matched\n"); fflush (stderr);
       continue;
     }
 
-    matched = check_port (&(cur_rule->source_port), packet->source_port);
-    if (matched == false)
+    uint64_t start = read_cycles ();
+
+    bool passed = check_header (headers, i, packet) == true &&
+      (headers->patterns[i] < 0 || pattern_missing (prefilter, headers->patterns[i], packet, counters) == false);
+    bool matched = passed == true && check_options (headers->rules[i], packet, profile) == true;
+
+    add_cost (&(profile->rules[headers->rules[i]->id]), matched, read_cycles () - start);
+
+    if (counting == true && passed == true)
     {
-      fprintf (stderr, "Packet's source port was not matched\n"); fflush (stderr);
-      continue;
+      count_row (headers, i, matched);
     }
 
-    matched = check_ip (&(cur_rule->dest_ip), packet->dest_IP);
-    if (matched == false)
+    if (matched == true)
     {
-      fprintf (stderr, "Packet's destination IP was not matched\n"); fflush (stderr);
-      continue;
+      return matched_member (headers->rules[i], packet);
     }
+  }
 
-    matched = check_port (&(cur_rule->dest_port), packet->dest_port);
-    if (matched == false)
+  return NULL;
+}
+
+/* Whether the fast pattern of a row is missing from the payload, in
+   which case the row cannot match */
+bool pattern_missing (prefilter_t *prefilter, int32_t pattern, packet_t *packet, counters_t *counters)
+{
+  COUNT (counters->prefiltered, 1);
+
+  if (prefilter_found (prefilter, pattern, (const uint8_t *) packet->data, packet->data_length) == true)
+  {
+    return false;
+  }
+
+  COUNT (counters->prefilter_skipped, 1);
+
+  return true;
+}
+
+/* Only the capture thread writes the counters of an ordering */
+void count_row (rule_headers_t *headers, int i, bool matched)
+{
+  COUNT (headers->passed[i], 1);
+
+  if (matched == true)
+  {
+    COUNT (headers->matched[i], 1);
+  }
+}
+
+/* A row merged by the analysis stands for several rules with the same
+   options, of which the first whose header matches the packet fires */
+rule_t *matched_member (rule_t *rule, packet_t *packet)
+{
+  if (rule->members == NULL)
+  {
+    return rule;
+  }
+
+  for (int i = 0; i < rule->number_of_members; i++)
+  {
+    rule_t *member = rule->members[i];
+
+    if (check_ip (&(member->source_ip), packet->source_IP) == true &&
+        check_ip (&(member->dest_ip), packet->dest_IP) == true &&
+        check_port (&(member->source_port), packet->source_port) == true &&
+        check_port (&(member->dest_port), packet->dest_port) == true)
     {
-      fprintf (stderr, "Packet's destination port was not matched\n"); fflush (stderr);
-      continue;
+      return member;
     }
+  }
 
-    option_t *cur_option;
-    for (cur_option = cur_rule->options; cur_option != NULL; cur_option = cur_option->next)
+  return rule->members[0];
+}
+
+bool check_header (rule_headers_t *headers, int i, packet_t *packet)
+{
+  if (headers->protocols[i] != packet->protocol)
+  {
+    LOG_DEBUG ("Packet's transport protocol %s is not %s\n", packet->transport_protocol, headers->rules[i]->protocol);
+    return false;
+  }
+
+  if (packet->source_IP < headers->source_ip_start[i] || packet->source_IP > headers->source_ip_finish[i])
+  {
+    LOG_DEBUG ("Packet's source IP was not matched\n");
+    return false;
+  }
+
+  if (packet->source_port < headers->source_port_start[i] || packet->source_port > headers->source_port_finish[i] ||
+      ((headers->port_lists[i] & SOURCE_PORT_LIST) != 0 &&
+       check_port (&(headers->rules[i]->source_port), packet->source_port) == false))
+  {
+    LOG_DEBUG ("Packet's source port was not matched\n");
+    return false;
+  }
+
+  if (packet->dest_IP < headers->dest_ip_start[i] || packet->dest_IP > headers->dest_ip_finish[i])
+  {
+    LOG_DEBUG ("Packet's destination IP was not matched\n");
+    return false;
+  }
+
+  if (packet->dest_port < headers->dest_port_start[i] || packet->dest_port > headers->dest_port_finish[i] ||
+      ((headers->port_lists[i] & DEST_PORT_LIST) != 0 &&
+       check_port (&(headers->rules[i]->dest_port), packet->dest_port) == false))
+  {
+    LOG_DEBUG ("Packet's destination port was not matched\n");
+    return false;
+  }
+
+  return true;
+}
+
+bool check_options (rule_t *rule, packet_t *packet, profile_t *profile)
+{
+  bool matched = true;
+
+  MATCH_BEGIN (options_start);
+
+  for (option_t *cur_option = rule->options; cur_option != NULL; cur_option = cur_option->next)
+  {
+    if (profile == NULL)
     {
       matched = check_option (cur_option, packet);
-      if (matched == false)
-      {
-        fprintf (stderr, "Packet's option %s was not matched\n", cur_option->name); fflush (stderr);
-        break;
-      }
     }
-
-    if (cur_option != NULL)
+    else
     {
-      continue;
+      uint64_t start = read_cycles ();
+
+      matched = check_option (cur_option, packet);
+
+      add_cost (&(profile->options[cur_option->id]), matched, read_cycles () - start);
     }
 
-    break;
+    if (matched == false)
+    {
+      LOG_DEBUG ("Packet's option %s was not matched\n", cur_option->name);
+      break;
+    }
   }
 
-  return cur_rule;
+  MATCH_END (options_start);
+
+  return matched;
+}
+
+void add_cost (cost_t *cost, bool matched, uint64_t cycles)
+{
+  cost->checks++;
+  cost->matches += matched == true ? 1 : 0;
+  cost->cycles += cycles;
+
+  if (cycles > cost->max_cycles)
+  {
+    cost->max_cycles = cycles;
+  }
 }
 
 bool check_ip (ip_t *rule_ip, uint32_t ip)
@@ -113,6 +270,9 @@ bool check_port (port_t *rule_port, uint16_t port)
 }
 
 uint8_t set_bit (uint8_t, int);
+bool match_content (option_t *, const uint8_t *, size_t, size_t, int *);
+bool content_window (option_t *, size_t, size_t, size_t *, size_t *);
+const uint8_t *search_window (option_t *, const uint8_t *, size_t, size_t);
 
 bool check_option (option_t *option, packet_t *packet)
 {
@@ -120,7 +280,8 @@ bool check_option (option_t *option, packet_t *packet)
   uint16_t value_16;
   uint32_t value_32;
 
-  if (strcmp (option->name, STRING_MSG) == 0)
+  /* Modifiers are part of the window of their content */
+  if (option->modifier == true || strcmp (option->name, STRING_MSG) == 0)
   {
     return true;
   }
@@ -162,28 +323,7 @@ bool check_option (option_t *option, packet_t *packet)
 
   if (strcmp (option->name, STRING_FLAGS) == 0)
   {
-    value_8 = 0;
-
-    if (strstr (option->value, "F") != NULL)
-    {
-      value_8 = set_bit (value_8, 8);
-    }
-    if (strstr (option->value, "S") != NULL)
-    {
-      value_8 = set_bit (value_8, 7);
-    }
-    if (strstr (option->value, "R") != NULL)
-    {
-      value_8 = set_bit (value_8, 6);
-    }
-    if (strstr (option->value, "P") != NULL)
-    {
-      value_8 = set_bit (value_8, 5);
-    }
-    if (strstr (option->value, "A") != NULL)
-    {
-      value_8 = set_bit (value_8, 4);
-    }
+    value_8 = flags_mask (option->value);
 
     return (value_8 & packet->flags) == value_8 ? true : false;
   }
@@ -219,13 +359,142 @@ bool check_option (option_t *option, packet_t *packet)
 
   if (strcmp (option->name, STRING_CONTENT) == 0)
   {
-    return find_needle (packet->data, packet->data_length,
-                        (void *) option->value, strlen (option->value)) == NULL ? false : true;
+    /* A relative content is checked with the content it follows */
+    if (option->content.relative == true)
+    {
+      return true;
+    }
+
+    int searches = CONTENT_SEARCHES;
+
+    return match_content (option, (const uint8_t *) packet->data, packet->data_length, 0, &searches);
+  }
+
+  return false;
+}
+
+/* Whether the content and the relative contents after it match. When a
+   relative content with a bounded window does not match after the first
+   match of the content, later matches are tried, within a total of
+   searches; an unbounded window would only get shorter. */
+bool match_content (option_t *option, const uint8_t *data, size_t length, size_t base, int *searches)
+{
+  size_t from, end;
+
+  if (content_window (option, length, base, &from, &end) == false)
+  {
+    return false;
+  }
+
+  size_t needle_length = (size_t) option->value_length;
+  option_t *following = option->content.following;
+
+  while (*searches > 0)
+  {
+    (*searches)--;
+
+    const uint8_t *found = search_window (option, data, from, end);
+
+    if (found == NULL)
+    {
+      return false;
+    }
+
+    size_t matched_end = (size_t) (found - data) + needle_length;
+
+    if (following == NULL || match_content (following, data, length, matched_end, searches) == true)
+    {
+      return true;
+    }
+
+    if (following->content.length == 0)
+    {
+      return false;
+    }
+
+    from = (size_t) (found - data) + 1;
   }
 
   return false;
 }
 
+/* The bytes [from, end) of the payload a content is searched in. base is
+   the end of the previous match, for a relative content. */
+bool content_window (option_t *option, size_t length, size_t base, size_t *from, size_t *end)
+{
+  content_t *content = &(option->content);
+
+  long start = (content->relative == true ? (long) base : 0) + content->start;
+
+  if (start < 0)
+  {
+    start = 0;
+  }
+
+  if ((size_t) start >= length)
+  {
+    return false;
+  }
+
+  *from = (size_t) start;
+  *end = content->length > 0 && (size_t) content->length < length - *from ? *from + content->length : length;
+
+  return true;
+}
+
+const uint8_t *search_window (option_t *option, const uint8_t *data, size_t from, size_t end)
+{
+  if (option->content.nocase == true)
+  {
+    return find_needle_nocase (data + from, end - from, option->value, option->value_length);
+  }
+
+  return find_needle (data + from, end - from, option->value, option->value_length);
+}
+
+/* First match of a content in its window, for a relative content the
+   window after base; NULL if there is none */
+const uint8_t *find_content (option_t *option, const uint8_t *data, size_t length, size_t base)
+{
+  size_t from, end;
+
+  if (content_window (option, length, base, &from, &end) == false)
+  {
+    return NULL;
+  }
+
+  return search_window (option, data, from, end);
+}
+
+/* TCP flags a flags option requires */
+uint8_t flags_mask (char *value)
+{
+  uint8_t mask = 0;
+
+  if (strstr (value, "F") != NULL)
+  {
+    mask = set_bit (mask, 8);
+  }
+  if (strstr (value, "S") != NULL)
+  {
+    mask = set_bit (mask, 7);
+  }
+  if (strstr (value, "R") != NULL)
+  {
+    mask = set_bit (mask, 6);
+  }
+  if (strstr (value, "P") != NULL)
+  {
+    mask = set_bit (mask, 5);
+  }
+  if (strstr (value, "A") != NULL)
+  {
+    mask = set_bit (mask, 4);
+  }
+
+  return mask;
+}
+
 uint8_t set_bit (uint8_t number, int bit)
 {
   assert (bit > 0 && bit < 9);
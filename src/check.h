@@ -3,6 +3,11 @@
 
 #include "structures.h"
 
-rule_t *check_with_rules (packet_t *, rule_t *);
+rule_t *check_with_rules (packet_t *, rule_t *, counters_t *);
+bool check_ip (ip_t *, uint32_t);
+bool check_port (port_t *, uint16_t);
+bool check_option (option_t *, packet_t *);
+uint8_t flags_mask (char *);
+const uint8_t *find_content (option_t *, const uint8_t *, size_t, size_t);
 
 #endif
@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "compress.h"
+
+#define GZIP_WINDOW_BITS (15 + 16)
+#define MEMORY_LEVEL (8)
+
+ssize_t compressor_write (void *, const char *, size_t);
+int compressor_close (void *);
+void *compress_thread (void *);
+
+/* Returns a stream whose data is gzipped into filename. Compression runs
+   on a separate thread: the writer fills one block while the other is
+   compressed. If the writer ever catches up with the thread, the rest of
+   the file is written as stored (uncompressed) deflate blocks, so the
+   file stays valid gzip. With never_wait, the block that caught up is
+   queued behind the one being compressed instead of waiting for the
+   thread, and the stream is unbuffered so that every write is a whole
+   line. Totals are added to stats on close. */
+FILE *compressed_fopen (const char *filename, compression_stats_t *stats, bool never_wait)
+{
+  compressor_t *compressor = (compressor_t *) calloc (1, sizeof (compressor_t));
+
+  compressor->output = fopen (filename, "wb");
+  if (compressor->output == NULL)
+  {
+    fprintf (stderr, "Could not open %s\n", filename);
+    exit (EXIT_FAILURE);
+  }
+
+  setvbuf (compressor->output, NULL, _IOFBF, COMPRESS_BLOCK_SIZE);
+
+  int rv = deflateInit2 (&(compressor->stream), COMPRESS_LEVEL, Z_DEFLATED,
+                         GZIP_WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+  if (rv != Z_OK)
+  {
+    fprintf (stderr, "Could not initialise compression: %s\n", zError (rv));
+    exit (EXIT_FAILURE);
+  }
+
+  compressor->out_buffer = (uint8_t *) malloc (COMPRESS_BLOCK_SIZE);
+  compressor->blocks[0] = (uint8_t *) malloc (COMPRESS_BLOCK_SIZE);
+  compressor->blocks[1] = (uint8_t *) malloc (COMPRESS_BLOCK_SIZE);
+
+  compressor->totals = stats;
+  compressor->never_wait = never_wait;
+
+  pthread_mutex_init (&(compressor->mutex), NULL);
+  pthread_cond_init (&(compressor->cond), NULL);
+
+  if (pthread_create (&(compressor->thread), NULL, compress_thread, (void *) compressor) != 0)
+  {
+    fprintf (stderr, "Could not start compression thread\n");
+    exit (EXIT_FAILURE);
+  }
+
+  cookie_io_functions_t functions;
+
+  memset (&functions, 0, sizeof (functions));
+  functions.write = compressor_write;
+  functions.close = compressor_close;
+
+  FILE *file = fopencookie ((void *) compressor, "w", functions);
+  if (file == NULL)
+  {
+    fprintf (stderr, "Could not open compressed stream %s\n", filename);
+    exit (EXIT_FAILURE);
+  }
+
+  if (never_wait == true)
+  {
+    setvbuf (file, NULL, _IONBF, 0);
+  }
+
+  return file;
+}
+
+bool hand_over_block (compressor_t *);
+
+ssize_t compressor_write (void *cookie, const char *buffer, size_t size)
+{
+  compressor_t *compressor = (compressor_t *) cookie;
+
+  /* A write that does not fit starts a new block, so that a line is never
+     split around a block that could not be queued. Refusing the write
+     makes the caller's fprintf fail, and nothing of it is kept. */
+  if (compressor->never_wait == true &&
+      compressor->lengths[compressor->active] + size > COMPRESS_BLOCK_SIZE &&
+      compressor->lengths[compressor->active] > 0 &&
+      hand_over_block (compressor) == false)
+  {
+    compressor->stats.dropped += size;
+    return 0;
+  }
+
+  size_t written = 0;
+
+  while (written < size)
+  {
+    int active = compressor->active;
+    size_t space = COMPRESS_BLOCK_SIZE - compressor->lengths[active];
+    size_t length = size - written < space ? size - written : space;
+
+    memcpy (compressor->blocks[active] + compressor->lengths[active], buffer + written, length);
+
+    compressor->lengths[active] += length;
+    written += length;
+
+    if (compressor->lengths[active] == COMPRESS_BLOCK_SIZE && hand_over_block (compressor) == false)
+    {
+      compressor->stats.dropped += size - written;
+      return (ssize_t) written;
+    }
+  }
+
+  return (ssize_t) size;
+}
+
+bool queue_pending (compressor_t *);
+
+/* Queues the active block for compression and switches to the other one.
+   If the other one is still being compressed, waits for it or, with
+   never_wait, moves the active block to the pending list and starts a new
+   one. Returns false only when there was no memory for that, leaving the
+   active block as it was. */
+bool hand_over_block (compressor_t *compressor)
+{
+  pthread_mutex_lock (&(compressor->mutex));
+
+  if (compressor->full == true || compressor->pending != NULL)
+  {
+    compressor->degraded = true;
+
+    if (compressor->never_wait == true)
+    {
+      bool queued = queue_pending (compressor);
+
+      if (queued == true)
+      {
+        compressor->stats.stalls++;
+      }
+
+      pthread_cond_broadcast (&(compressor->cond));
+      pthread_mutex_unlock (&(compressor->mutex));
+
+      return queued;
+    }
+
+    compressor->stats.stalls++;
+
+    while (compressor->full == true)
+    {
+      pthread_cond_wait (&(compressor->cond), &(compressor->mutex));
+    }
+  }
+
+  compressor->active = 1 - compressor->active;
+  compressor->lengths[compressor->active] = 0;
+  compressor->full = true;
+
+  pthread_cond_broadcast (&(compressor->cond));
+  pthread_mutex_unlock (&(compressor->mutex));
+
+  return true;
+}
+
+/* Appends the active block to the pending list, which the thread
+   compresses after the full block, and gives the writer a new one */
+bool queue_pending (compressor_t *compressor)
+{
+  pending_block_t *pending = (pending_block_t *) malloc (sizeof (pending_block_t));
+  uint8_t *block = (uint8_t *) malloc (COMPRESS_BLOCK_SIZE);
+
+  if (pending == NULL || block == NULL)
+  {
+    free (pending);
+    free (block);
+    return false;
+  }
+
+  int active = compressor->active;
+
+  pending->data = compressor->blocks[active];
+  pending->length = compressor->lengths[active];
+  pending->next = NULL;
+
+  if (compressor->pending == NULL)
+  {
+    compressor->pending = pending;
+  }
+  else
+  {
+    compressor->pending_tail->next = pending;
+  }
+
+  compressor->pending_tail = pending;
+
+  compressor->blocks[active] = block;
+  compressor->lengths[active] = 0;
+
+  return true;
+}
+
+void deflate_block (compressor_t *, uint8_t *, size_t, int);
+void store_uncompressed (compressor_t *);
+
+void *compress_thread (void *arg)
+{
+  compressor_t *compressor = (compressor_t *) arg;
+
+  pthread_mutex_lock (&(compressor->mutex));
+
+  while (true)
+  {
+    while (compressor->full == false && compressor->pending == NULL && compressor->finish == false)
+    {
+      pthread_cond_wait (&(compressor->cond), &(compressor->mutex));
+    }
+
+    /* The full block is older than any pending one: blocks are only
+       queued as pending while it is there or others are pending */
+    pending_block_t *pending = NULL;
+    uint8_t *block;
+    size_t length;
+
+    if (compressor->full == true)
+    {
+      block = compressor->blocks[1 - compressor->active];
+      length = compressor->lengths[1 - compressor->active];
+    }
+    else if (compressor->pending != NULL)
+    {
+      pending = compressor->pending;
+      compressor->pending = pending->next;
+
+      block = pending->data;
+      length = pending->length;
+    }
+    else
+    {
+      break;
+    }
+
+    bool lower_level = compressor->degraded == true && compressor->level_lowered == false;
+
+    pthread_mutex_unlock (&(compressor->mutex));
+
+    if (lower_level == true)
+    {
+      store_uncompressed (compressor);
+    }
+
+    deflate_block (compressor, block, length, Z_NO_FLUSH);
+
+    if (pending != NULL)
+    {
+      free (pending->data);
+      free (pending);
+    }
+
+    pthread_mutex_lock (&(compressor->mutex));
+
+    if (pending == NULL)
+    {
+      compressor->full = false;
+    }
+
+    pthread_cond_broadcast (&(compressor->cond));
+  }
+
+  pthread_mutex_unlock (&(compressor->mutex));
+
+  int active = compressor->active;
+  deflate_block (compressor, compressor->blocks[active], compressor->lengths[active], Z_FINISH);
+
+  return NULL;
+}
+
+/* Compresses one block with the given zlib flush mode */
+void deflate_block (compressor_t *compressor, uint8_t *block, size_t length, int flush)
+{
+  z_stream *stream = &(compressor->stream);
+
+  struct timespec start, finish;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  stream->next_in = block;
+  stream->avail_in = (uInt) length;
+
+  int rv;
+
+  do
+  {
+    stream->next_out = compressor->out_buffer;
+    stream->avail_out = COMPRESS_BLOCK_SIZE;
+
+    rv = deflate (stream, flush);
+
+    size_t produced = COMPRESS_BLOCK_SIZE - stream->avail_out;
+
+    fwrite (compressor->out_buffer, 1, produced, compressor->output);
+    compressor->stats.bytes_out += produced;
+  }
+  while (stream->avail_out == 0 || (flush == Z_FINISH && rv == Z_OK));
+
+  if (length > 0)
+  {
+    compressor->stats.bytes_in += length;
+    compressor->stats.blocks++;
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &finish);
+
+  compressor->stats.seconds += (double) (finish.tv_sec - start.tv_sec) +
+                               (double) (finish.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Switches the stream to stored blocks once the writer has caught up with us */
+void store_uncompressed (compressor_t *compressor)
+{
+  z_stream *stream = &(compressor->stream);
+
+  int rv;
+
+  do
+  {
+    stream->next_in = NULL;
+    stream->avail_in = 0;
+    stream->next_out = compressor->out_buffer;
+    stream->avail_out = COMPRESS_BLOCK_SIZE;
+
+    rv = deflateParams (stream, Z_NO_COMPRESSION, Z_DEFAULT_STRATEGY);
+
+    size_t produced = COMPRESS_BLOCK_SIZE - stream->avail_out;
+
+    fwrite (compressor->out_buffer, 1, produced, compressor->output);
+    compressor->stats.bytes_out += produced;
+  }
+  while (rv == Z_BUF_ERROR && stream->avail_out == 0);
+
+  compressor->level_lowered = true;
+}
+
+int compressor_close (void *cookie)
+{
+  compressor_t *compressor = (compressor_t *) cookie;
+
+  pthread_mutex_lock (&(compressor->mutex));
+  compressor->finish = true;
+  pthread_cond_broadcast (&(compressor->cond));
+  pthread_mutex_unlock (&(compressor->mutex));
+
+  pthread_join (compressor->thread, NULL);
+
+  deflateEnd (&(compressor->stream));
+  fclose (compressor->output);
+
+  compression_stats_t *totals = compressor->totals;
+  if (totals != NULL)
+  {
+    totals->bytes_in += compressor->stats.bytes_in;
+    totals->bytes_out += compressor->stats.bytes_out;
+    totals->blocks += compressor->stats.blocks;
+    totals->stalls += compressor->stats.stalls;
+    totals->dropped += compressor->stats.dropped;
+    totals->seconds += compressor->stats.seconds;
+  }
+
+  pthread_mutex_destroy (&(compressor->mutex));
+  pthread_cond_destroy (&(compressor->cond));
+
+  free (compressor->blocks[0]);
+  free (compressor->blocks[1]);
+  free (compressor->out_buffer);
+  free (compressor);
+
+  return 0;
+}
+
+void print_compression (const char *name, compression_stats_t *stats)
+{
+  if (stats->bytes_in == 0 && stats->dropped == 0)
+  {
+    return;
+  }
+
+  double ratio = stats->bytes_out > 0 ? (double) stats->bytes_in / (double) stats->bytes_out : 0;
+  double throughput = stats->seconds > 0 ? (double) stats->bytes_in / stats->seconds / 1e6 : 0;
+
+  printf ("Compressed %s: %lu -> %lu bytes, ratio %.2f, %.1f MB/s, %lu of %lu blocks stalled, %lu bytes dropped\n",
+          name, (long unsigned) stats->bytes_in, (long unsigned) stats->bytes_out,
+          ratio, throughput, (long unsigned) stats->stalls, (long unsigned) stats->blocks,
+          (long unsigned) stats->dropped);
+}
@@ -0,0 +1,9 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "structures.h"
+
+FILE *compressed_fopen (const char *, compression_stats_t *, bool);
+void print_compression (const char *, compression_stats_t *);
+
+#endif
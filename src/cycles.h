@@ -0,0 +1,18 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include "libraries.h"
+
+/* Time stamp counter where available, nanoseconds otherwise */
+static inline uint64_t read_cycles (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc ();
+#else
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+#endif
+}
+
+#endif
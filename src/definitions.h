@@ -7,6 +7,64 @@
 #define MAX_NUM_CAPTURES (0x20)
 #define MAX_DEPTH (0xA)
 
+#define HOT_ARENA_BLOCK_SIZE (0x10000)
+#define COLD_ARENA_BLOCK_SIZE (0x40000)
+#define REUSE_GENERATIONS (4) /* rule storages a reloaded list may share */
+
+#define FNV_OFFSET (0xCBF29CE484222325ULL)
+#define FNV_PRIME (0x100000001B3ULL)
+
+#define RULE_CACHE_MAGIC "NIDSRULE"
+#define RULE_CACHE_VERSION (4)
+#define RULE_CACHE_BYTE_ORDER (0x01020304U)
+
+#define RECORD_LENGTH (0x80)
+#define DEFAULT_RECORDER_SIZE (0x400)
+#define ALERT_DUMP_INTERVAL (10)
+
+#define EXPORT_QUEUE_SIZE (0x1000000)
+#define EXPORT_BUFFER_SIZE (0x100000)
+#define DEFAULT_EXPORT_FILE_SIZE (100L * 0x100000)
+#define DEFAULT_EXPORT_FILE_TIME (3600)
+
+#define COMPRESS_BLOCK_SIZE (0x40000)
+#define COMPRESS_LEVEL (6)
+#define ALERT_LOG_BUFFER_SIZE (0x10000)
+
+/* Build with -DNO_STAGE_TIMING to compile out the per-stage probes */
+#ifndef NO_STAGE_TIMING
+#define STAGE_TIMING
+#endif
+
+#define NUMBER_OF_STAGES (6)
+#define HISTOGRAM_SUB_BITS (4)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+#define NUMBER_OF_REJECT_REASONS (7)
+#define STATS_INTERVAL (1)
+#define METRICS_BACKLOG (8)
+#define EPOCH_WAIT (50) /* microseconds between checks for readers to leave */
+
+#define SEGMENT_MAGIC (0x5344494EU) /* "NIDS" */
+#define SEGMENT_VERSION (1)
+#define SEGMENT_WORKERS (0x10)
+#define SEGMENT_TOP_RULES (0x10)
+#define SEGMENT_MESSAGE_LENGTH (0x40)
+
+#define SCAN_SETS (0x200)
+#define SCAN_WAYS (8)
+#define SCAN_BITMAP_BITS (0x200)
+#define SCAN_MAX_DISTINCT (1000) /* the bitmaps are too full to count further */
+#define DEFAULT_SCAN_WINDOW (60)
+
+#define RATE_DEPTH (4) /* rows of a count-min sketch */
+#define RATE_WIDTH (0x800) /* counters per row */
+#define RATE_ALERTED_BITS (0x1000)
+
+#define TALKER_COUNTERS (0x80) /* per summary */
+#define TALKER_SLOTS (0x200) /* of the index of a summary, a power of two */
+#define TALKER_SUMMARIES (8)
+
 #define ANY "any"
 
 #define STRING_HTTP "http"
@@ -21,5 +79,15 @@
 #define STRING_FLAGS "flags"
 #define STRING_HTTP_REQ "http_request"
 #define STRING_CONTENT "content"
+#define STRING_DEPTH "depth"
+#define STRING_DISTANCE "distance"
+#define STRING_WITHIN "within"
+#define STRING_NOCASE "nocase"
+
+#ifdef DEBUG
+#define LOG_DEBUG(...) do { fprintf (stderr, __VA_ARGS__); fflush (stderr); } while (0)
+#else
+#define LOG_DEBUG(...) do { } while (0)
+#endif
 
 #endif
@@ -0,0 +1,212 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "capture.h"
+#include "recorder.h"
+#include "export.h"
+#include "compress.h"
+#include "profile.h"
+#include "stages.h"
+#include "stats.h"
+#include "metrics.h"
+#include "segment.h"
+#include "epoch.h"
+#include "reload.h"
+#include "order.h"
+#include "scan.h"
+#include "rate.h"
+#include "talkers.h"
+
+#include "engine.h"
+
+FILE *open_alert_log (settings_t *, compression_stats_t *);
+
+void settings_defaults (settings_t *settings)
+{
+  memset (settings, 0, sizeof (settings_t));
+
+  settings->rules_filename = NULL;
+  settings->rule_cache = NULL;
+  settings->sample_rate = 0;
+  settings->recorder_size = DEFAULT_RECORDER_SIZE;
+  settings->export_prefix = NULL;
+  settings->export_context = 0;
+  settings->export_file_size = DEFAULT_EXPORT_FILE_SIZE;
+  settings->export_file_time = DEFAULT_EXPORT_FILE_TIME;
+  settings->alert_log = NULL;
+  settings->compress = false;
+  settings->profile_top = 0;
+  settings->stage_interval = 0;
+  settings->stats_file = NULL;
+  settings->metrics_address = NULL;
+  settings->segment_name = NULL;
+  settings->order_interval = 0;
+  settings->native_rules = false;
+  settings->scan_ports = 0;
+  settings->scan_hosts = 0;
+  settings->scan_window = DEFAULT_SCAN_WINDOW;
+  settings->syn_rate = 0;
+  settings->udp_rate = 0;
+  settings->top_talkers = 0;
+}
+
+/* Prepares the context for process_packet on packets read from handle.
+   Must be called on the thread that will run the capture loop. */
+void engine_init (context_t *context, settings_t *settings, rule_t *rules, pcap_t *handle)
+{
+  memset (context, 0, sizeof (context_t));
+
+  context->rules = rules;
+  context->active_rules = rules;
+  context->data_link_offset = pcap_datalink_offset (handle);
+  context->settings = settings;
+  context->recorder = recorder_init (settings->recorder_size);
+
+  if (settings->export_prefix != NULL)
+  {
+    context->exporter = exporter_init (settings, handle);
+  }
+
+  if (settings->alert_log != NULL)
+  {
+    context->alert_log = open_alert_log (settings, &(context->alert_log_compression));
+  }
+
+  if (settings->scan_ports > 0 || settings->scan_hosts > 0)
+  {
+    context->scans = scan_init (settings);
+  }
+
+  if (settings->syn_rate > 0 || settings->udp_rate > 0)
+  {
+    context->rates = rate_init (settings);
+  }
+
+  if (settings->segment_name != NULL)
+  {
+    context->segment = segment_init (settings->segment_name, context);
+  }
+
+  context->stats = stats_init (settings, &(context->counters), context->exporter,
+                               context->segment, handle);
+
+  if (settings->metrics_address != NULL)
+  {
+    context->metrics = metrics_init (settings->metrics_address, context);
+  }
+
+  if (settings->profile_top > 0 && thread_profile == NULL)
+  {
+    profile_init (rules);
+  }
+
+  if (thread_stages == NULL)
+  {
+    stages_init ();
+  }
+
+  if (settings->top_talkers > 0 && thread_talkers == NULL)
+  {
+    talkers_init ();
+  }
+
+  epoch_register ();
+
+  counting_rows = settings->order_interval > 0;
+
+  /* Only a rule set read from a file can be reloaded */
+  if (settings->rules_filename != NULL)
+  {
+    context->reloader = reloader_init (context);
+  }
+}
+
+/* Prints the final reports and releases what engine_init opened */
+void engine_finish (context_t *context)
+{
+  settings_t *settings = context->settings;
+
+  if (context->reloader != NULL)
+  {
+    reloader_close (context->reloader);
+  }
+
+  recorder_dump (context->recorder, true);
+
+  if (settings->profile_top > 0)
+  {
+    if (context->rules != context->active_rules)
+    {
+      profile_reset (context->rules);
+    }
+
+    profile_report (context->rules, settings->profile_top);
+  }
+
+  stages_report (false, true);
+
+  if (context->metrics != NULL)
+  {
+    metrics_close (context->metrics);
+  }
+
+  if (thread_talkers != NULL)
+  {
+    talkers_publish (thread_talkers);
+  }
+
+  stats_close (context->stats);
+
+  if (context->segment != NULL)
+  {
+    segment_close (context->segment);
+  }
+
+  if (context->exporter != NULL)
+  {
+    exporter_close (context->exporter);
+  }
+
+  if (context->alert_log != NULL)
+  {
+    fclose (context->alert_log);
+    print_compression ("alert log", &(context->alert_log_compression));
+  }
+
+  if (context->scans != NULL)
+  {
+    scan_free (context->scans);
+  }
+
+  if (context->rates != NULL)
+  {
+    rate_free (context->rates);
+  }
+
+  recorder_free (context->recorder);
+}
+
+FILE *open_alert_log (settings_t *settings, compression_stats_t *stats)
+{
+  if (settings->compress == true)
+  {
+    char filename[LINE_LENGTH];
+
+    snprintf (filename, LINE_LENGTH, "%s.gz", settings->alert_log);
+
+    /* Written by the capture thread, which must not wait for compression */
+    return compressed_fopen (filename, stats, true);
+  }
+
+  FILE *file = fopen (settings->alert_log, "a");
+  if (file == NULL)
+  {
+    fprintf (stderr, "Could not open %s\n", settings->alert_log);
+    exit (EXIT_FAILURE);
+  }
+
+  setvbuf (file, NULL, _IOFBF, ALERT_LOG_BUFFER_SIZE);
+
+  return file;
+}
@@ -0,0 +1,10 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "structures.h"
+
+void settings_defaults (settings_t *);
+void engine_init (context_t *, settings_t *, rule_t *, pcap_t *);
+void engine_finish (context_t *);
+
+#endif
@@ -0,0 +1,94 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "epoch.h"
+
+/* Epoch based reclamation of rule sets. Readers only store to their own
+   slot, so matching never takes a lock. A writer that unpublished a set
+   calls epoch_synchronize, which returns once every reader that could
+   still see the set has left its read section; it can then be freed.
+   The epoch starts at 1 so that 0 can mean "not reading". */
+
+__thread epoch_reader_t *thread_reader = NULL;
+
+uint64_t global_epoch = 1;
+
+epoch_reader_t *all_readers = NULL;
+pthread_mutex_t readers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called once by each thread that reads rule sets */
+void epoch_register (void)
+{
+  if (thread_reader != NULL)
+  {
+    return;
+  }
+
+  epoch_reader_t *reader = (epoch_reader_t *) calloc (1, sizeof (epoch_reader_t));
+  if (reader == NULL)
+  {
+    fprintf (stderr, "Could not allocate an epoch reader\n");
+    exit (EXIT_FAILURE);
+  }
+
+  pthread_mutex_lock (&readers_mutex);
+  reader->next = all_readers;
+  all_readers = reader;
+  pthread_mutex_unlock (&readers_mutex);
+
+  thread_reader = reader;
+}
+
+/* Called by a registered thread before it exits, outside a read section */
+void epoch_unregister (void)
+{
+  if (thread_reader == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock (&readers_mutex);
+
+  for (epoch_reader_t **cur = &all_readers; *cur != NULL; cur = &((*cur)->next))
+  {
+    if (*cur == thread_reader)
+    {
+      *cur = thread_reader->next;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock (&readers_mutex);
+
+  free (thread_reader);
+  thread_reader = NULL;
+}
+
+/* Waits until no reader can hold a pointer unpublished before the call.
+   Readers that enter after the epoch moved load the new pointer. */
+void epoch_synchronize (void)
+{
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+  uint64_t target = __atomic_add_fetch (&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock (&readers_mutex);
+
+  for (epoch_reader_t *reader = all_readers; reader != NULL; reader = reader->next)
+  {
+    while (true)
+    {
+      uint64_t active = __atomic_load_n (&(reader->active), __ATOMIC_ACQUIRE);
+
+      if (active == 0 || active >= target)
+      {
+        break;
+      }
+
+      usleep (EPOCH_WAIT);
+    }
+  }
+
+  pthread_mutex_unlock (&readers_mutex);
+}
@@ -0,0 +1,38 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "structures.h"
+
+extern __thread epoch_reader_t *thread_reader;
+extern uint64_t global_epoch;
+
+void epoch_register (void);
+void epoch_unregister (void);
+void epoch_synchronize (void);
+
+/* Marks the start of a read section. Pointers to a rule set must be
+   loaded after it and not used after epoch_exit. The fence keeps the
+   load from being seen before the announcement. */
+static inline void epoch_enter (void)
+{
+  epoch_reader_t *reader = thread_reader;
+
+  if (reader != NULL)
+  {
+    __atomic_store_n (&(reader->active), __atomic_load_n (&global_epoch, __ATOMIC_ACQUIRE),
+                      __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  }
+}
+
+static inline void epoch_exit (void)
+{
+  epoch_reader_t *reader = thread_reader;
+
+  if (reader != NULL)
+  {
+    __atomic_store_n (&(reader->active), 0, __ATOMIC_RELEASE);
+  }
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "queue.h"
+#include "compress.h"
+
+#include "export.h"
+
+#define IDLE_SLEEP (1000) /* microseconds */
+#define IDLE_FLUSH (1000) /* idle rounds before buffered packets are flushed */
+
+void *export_thread (void *);
+
+exporter_t *exporter_init (settings_t *settings, pcap_t *handle)
+{
+  exporter_t *exporter = (exporter_t *) calloc (1, sizeof (exporter_t));
+
+  exporter->queue = queue_init (EXPORT_QUEUE_SIZE);
+
+  exporter->dead_handle = pcap_open_dead (pcap_datalink (handle), pcap_snapshot (handle));
+  if (exporter->dead_handle == NULL)
+  {
+    fprintf (stderr, "Could not open pcap handle for export\n");
+    exit (EXIT_FAILURE);
+  }
+
+  exporter->prefix = settings->export_prefix;
+  exporter->file_size_limit = settings->export_file_size;
+  exporter->file_time_limit = settings->export_file_time;
+  exporter->compress = settings->compress;
+
+  exporter->stop = false;
+
+  if (pthread_create (&(exporter->thread), NULL, export_thread, (void *) exporter) != 0)
+  {
+    fprintf (stderr, "Could not start export thread\n");
+    exit (EXIT_FAILURE);
+  }
+
+  return exporter;
+}
+
+/* Capture thread: copies the packet into the queue, dropping it if the
+   writer has fallen too far behind */
+void exporter_add (exporter_t *exporter, const struct pcap_pkthdr *pkthdr, const u_char *raw)
+{
+  uint64_t length = sizeof (struct pcap_pkthdr) + pkthdr->caplen;
+
+  uint8_t *entry = (uint8_t *) queue_reserve (exporter->queue, length);
+  if (entry == NULL)
+  {
+    __atomic_store_n (&(exporter->dropped), exporter->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  memcpy (entry, pkthdr, sizeof (struct pcap_pkthdr));
+  memcpy (entry + sizeof (struct pcap_pkthdr), raw, pkthdr->caplen);
+
+  queue_commit (exporter->queue);
+}
+
+bool same_flow (record_t *, record_t *);
+
+/* Exports a matched packet, preceded by up to flow_packets earlier packets
+   of its flow found in the flight recorder. The matched packet must be the
+   newest record, and is skipped when it was exported already. Context
+   packets are cut to the recorder's snapshot length. */
+void exporter_add_match (exporter_t *exporter, recorder_t *recorder, int flow_packets,
+                         const struct pcap_pkthdr *pkthdr, const u_char *raw)
+{
+  uint64_t size = recorder->mask + 1;
+  uint64_t last = recorder->head - 1;
+  uint64_t first = recorder->head > size ? recorder->head - size : 0;
+
+  record_t *match = &(recorder->records[last & recorder->mask]);
+
+  if (match->exported == true)
+  {
+    return;
+  }
+
+  uint64_t found[flow_packets > 0 ? flow_packets : 1];
+  int number_found = 0;
+
+  for (uint64_t i = last; i > first && number_found < flow_packets; i--)
+  {
+    record_t *record = &(recorder->records[(i - 1) & recorder->mask]);
+
+    if (record->exported == false && same_flow (record, match) == true)
+    {
+      found[number_found++] = i - 1;
+    }
+  }
+
+  for (int i = number_found - 1; i >= 0; i--)
+  {
+    record_t *record = &(recorder->records[found[i] & recorder->mask]);
+
+    struct pcap_pkthdr header = record->header;
+    header.caplen = record->raw_length;
+
+    exporter_add (exporter, &header, record->raw);
+    record->exported = true;
+  }
+
+  exporter_add (exporter, pkthdr, raw);
+  match->exported = true;
+}
+
+bool same_flow (record_t *a, record_t *b)
+{
+  if (a->valid == false || b->valid == false || a->tcp != b->tcp)
+  {
+    return false;
+  }
+
+  if (a->source_IP == b->source_IP && a->dest_IP == b->dest_IP &&
+      a->source_port == b->source_port && a->dest_port == b->dest_port)
+  {
+    return true;
+  }
+
+  return a->source_IP == b->dest_IP && a->dest_IP == b->source_IP &&
+         a->source_port == b->dest_port && a->dest_port == b->source_port;
+}
+
+void open_export_file (exporter_t *);
+void close_export_file (exporter_t *);
+
+void *export_thread (void *arg)
+{
+  exporter_t *exporter = (exporter_t *) arg;
+
+  int idle_rounds = 0;
+
+  while (true)
+  {
+    uint64_t length;
+    uint8_t *entry = (uint8_t *) queue_peek (exporter->queue, &length);
+
+    if (entry == NULL)
+    {
+      if (__atomic_load_n (&(exporter->stop), __ATOMIC_ACQUIRE) == true)
+      {
+        break;
+      }
+
+      if (++idle_rounds == IDLE_FLUSH && exporter->dumper != NULL)
+      {
+        pcap_dump_flush (exporter->dumper);
+      }
+
+      usleep (IDLE_SLEEP);
+      continue;
+    }
+
+    idle_rounds = 0;
+
+    struct pcap_pkthdr header;
+    memcpy (&header, entry, sizeof (struct pcap_pkthdr));
+
+    long record_size = (long) (sizeof (uint32_t) * 4 + header.caplen);
+
+    if (exporter->dumper != NULL &&
+        (exporter->file_size + record_size > exporter->file_size_limit ||
+         time (NULL) - exporter->file_opened >= exporter->file_time_limit))
+    {
+      close_export_file (exporter);
+    }
+
+    if (exporter->dumper == NULL)
+    {
+      open_export_file (exporter);
+    }
+
+    pcap_dump ((u_char *) exporter->dumper, &header, entry + sizeof (struct pcap_pkthdr));
+    exporter->file_size += record_size;
+
+    queue_release (exporter->queue, length);
+
+    __atomic_store_n (&(exporter->exported), exporter->exported + 1, __ATOMIC_RELAXED);
+  }
+
+  if (exporter->dumper != NULL)
+  {
+    close_export_file (exporter);
+  }
+
+  return NULL;
+}
+
+void open_export_file (exporter_t *exporter)
+{
+  char filename[LINE_LENGTH];
+
+  exporter->file_opened = time (NULL);
+
+  snprintf (filename, LINE_LENGTH, "%s-%ld-%d.pcap%s", exporter->prefix,
+            (long) exporter->file_opened, exporter->file_count,
+            exporter->compress == true ? ".gz" : "");
+
+  if (exporter->compress == true)
+  {
+    exporter->file = compressed_fopen (filename, &(exporter->compression), false);
+  }
+
+  else
+  {
+    exporter->file = fopen (filename, "wb");
+    if (exporter->file == NULL)
+    {
+      fprintf (stderr, "Could not open %s\n", filename);
+      exit (EXIT_FAILURE);
+    }
+
+    setvbuf (exporter->file, NULL, _IOFBF, EXPORT_BUFFER_SIZE);
+  }
+
+  exporter->dumper = pcap_dump_fopen (exporter->dead_handle, exporter->file);
+  if (exporter->dumper == NULL)
+  {
+    fprintf (stderr, "Could not write %s: %s\n", filename, pcap_geterr (exporter->dead_handle));
+    exit (EXIT_FAILURE);
+  }
+
+  exporter->file_size = (long) (sizeof (uint32_t) * 6);
+  exporter->file_count++;
+}
+
+void close_export_file (exporter_t *exporter)
+{
+  pcap_dump_close (exporter->dumper);
+
+  exporter->dumper = NULL;
+  exporter->file = NULL;
+}
+
+/* Drains the queue, closes the current file and prints a summary */
+void exporter_close (exporter_t *exporter)
+{
+  __atomic_store_n (&(exporter->stop), true, __ATOMIC_RELEASE);
+
+  pthread_join (exporter->thread, NULL);
+
+  printf ("Exported %lu packets to %d files, %lu dropped\n",
+          (long unsigned) exporter->exported, exporter->file_count,
+          (long unsigned) exporter->dropped);
+
+  print_compression ("pcap export", &(exporter->compression));
+
+  pcap_close (exporter->dead_handle);
+  queue_free (exporter->queue);
+  free (exporter);
+}
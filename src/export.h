@@ -0,0 +1,12 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "structures.h"
+
+exporter_t *exporter_init (settings_t *, pcap_t *);
+void exporter_add (exporter_t *, const struct pcap_pkthdr *, const u_char *);
+void exporter_add_match (exporter_t *, recorder_t *, int,
+                         const struct pcap_pkthdr *, const u_char *);
+void exporter_close (exporter_t *);
+
+#endif
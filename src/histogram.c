@@ -0,0 +1,119 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "histogram.h"
+
+/* Values below 2^(SUB_BITS + 1) have a bucket each. Above that, every
+   power of two is split into 2^SUB_BITS linear sub-buckets, so a bucket
+   is never wider than 1/16 of its values. */
+
+#define SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+int bucket_index (uint64_t);
+
+int bucket_index (uint64_t value)
+{
+  if (value < 2 * SUB_BUCKETS)
+  {
+    return (int) value;
+  }
+
+  int msb = 63 - __builtin_clzll (value);
+  int shift = msb - HISTOGRAM_SUB_BITS;
+
+  return (shift + 1) * SUB_BUCKETS + (int) ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* Largest value counted in the given bucket */
+uint64_t histogram_bucket_limit (int index)
+{
+  if (index < 2 * SUB_BUCKETS)
+  {
+    return (uint64_t) index;
+  }
+
+  int shift = index / SUB_BUCKETS - 1;
+  uint64_t sub = (uint64_t) (index % SUB_BUCKETS) + SUB_BUCKETS;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+void histogram_add (histogram_t *histogram, uint64_t value)
+{
+  histogram->buckets[bucket_index (value)]++;
+  histogram->count++;
+  histogram->sum += value;
+
+  if (value > histogram->max)
+  {
+    histogram->max = value;
+  }
+}
+
+void histogram_merge (histogram_t *to, histogram_t *from)
+{
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    to->buckets[i] += from->buckets[i];
+  }
+
+  to->count += from->count;
+  to->sum += from->sum;
+
+  if (from->max > to->max)
+  {
+    to->max = from->max;
+  }
+}
+
+/* Like histogram_merge, for a histogram another thread is still filling.
+   The copy is not a snapshot, but no counter in it ever goes backwards. */
+void histogram_load (histogram_t *to, histogram_t *from)
+{
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    to->buckets[i] += __atomic_load_n (&(from->buckets[i]), __ATOMIC_RELAXED);
+  }
+
+  to->count += __atomic_load_n (&(from->count), __ATOMIC_RELAXED);
+  to->sum += __atomic_load_n (&(from->sum), __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n (&(from->max), __ATOMIC_RELAXED);
+
+  if (max > to->max)
+  {
+    to->max = max;
+  }
+}
+
+/* Upper bound of the value below which the given percentage of values lie */
+uint64_t histogram_percentile (histogram_t *histogram, double percent)
+{
+  if (histogram->count == 0)
+  {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t) ((double) histogram->count * percent / 100.0);
+  if (rank >= histogram->count)
+  {
+    rank = histogram->count - 1;
+  }
+
+  uint64_t seen = 0;
+
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    seen += histogram->buckets[i];
+
+    if (seen > rank)
+    {
+      uint64_t limit = histogram_bucket_limit (i);
+
+      return limit < histogram->max ? limit : histogram->max;
+    }
+  }
+
+  return histogram->max;
+}
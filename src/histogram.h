@@ -0,0 +1,12 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "structures.h"
+
+void histogram_add (histogram_t *, uint64_t);
+void histogram_merge (histogram_t *, histogram_t *);
+void histogram_load (histogram_t *, histogram_t *);
+uint64_t histogram_percentile (histogram_t *, double);
+uint64_t histogram_bucket_limit (int);
+
+#endif
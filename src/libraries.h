@@ -6,10 +6,26 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <assert.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <dlfcn.h>
 #include <pcap/pcap.h>
+#include <zlib.h>
 
 #endif
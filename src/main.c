@@ -6,29 +6,241 @@
 #include "output.h"
 #include "capture.h"
 #include "process.h"
+#include "signals.h"
+#include "engine.h"
+#include "cache.h"
+#include "analysis.h"
+#include "native.h"
+#include "prefilter.h"
+
+void print_usage (char *);
+void parse_settings (settings_t *, int, char *[]);
 
 int main (int argc, char *argv[])
 {
-  if (argc != 2)
+  settings_t settings;
+
+  parse_settings (&settings, argc, argv);
+
+  rule_t *rules;
+
+  if (settings.rule_cache != NULL)
   {
-    fprintf (stderr, "Please, provide a rules file\n");
-    exit (EXIT_FAILURE);
+    rules = get_cached_rules (settings.rules_filename, settings.rule_cache);
+  }
+  else
+  {
+    rules = get_rules (settings.rules_filename);
   }
 
-  rule_t *rules = get_rules (argv[1]);
   print_rules (rules);
+  print_analysis (rules);
+  print_prefilter (rules);
+
+  if (settings.native_rules == true)
+  {
+    compile_rules (rules);
+  }
 
   pcap_t *handle = pcap_init ();
 
-  int data_link_offset = pcap_datalink_offset (handle);
+  context_t context;
+
+  engine_init (&context, &settings, rules, handle);
 
-  void *arg = malloc (sizeof (rule_t *) + sizeof (int));
+  signals_init (handle);
 
-  *((rule_t **) arg) = rules;
+  pcap_loop (handle, -1, process_packet, (u_char *) &context);
 
-  *((int *) (arg + sizeof (rule_t *))) = data_link_offset;
+  engine_finish (&context);
 
-  pcap_loop (handle, -1, process_packet, (u_char *) arg);
+  pcap_close (handle);
 
   return 0;
 }
+
+void print_usage (char *program)
+{
+  fprintf (stderr, "Usage: %s [options] rules_file\n", program);
+  fprintf (stderr, "  -s N   print one of every N packets that match no rule (default: none)\n");
+  fprintf (stderr, "  -R N   keep the last N packets in the flight recorder (default: %d)\n", DEFAULT_RECORDER_SIZE);
+  fprintf (stderr, "  -w P   write matched packets to pcap files named P-<time>-<n>.pcap\n");
+  fprintf (stderr, "  -K N   also write up to N earlier packets of the matched flow (default: 0)\n");
+  fprintf (stderr, "  -C MB  start a new pcap file after MB megabytes (default: %ld)\n", DEFAULT_EXPORT_FILE_SIZE / 0x100000);
+  fprintf (stderr, "  -G S   start a new pcap file after S seconds (default: %d)\n", DEFAULT_EXPORT_FILE_TIME);
+  fprintf (stderr, "  -l F   append one line per alert to file F\n");
+  fprintf (stderr, "  -P N   profile rules, print the N costliest on SIGUSR1 and at exit\n");
+  fprintf (stderr, "  -I S   print per-stage timing every S seconds (always printed at exit)\n");
+  fprintf (stderr, "  -S F   rewrite capture and packet counters to file F every second\n");
+  fprintf (stderr, "  -M A   serve Prometheus metrics on Unix socket A, or on 127.0.0.1 port A\n");
+  fprintf (stderr, "  -c F   load the compiled rules from cache file F, rebuilding it when the rule file changed\n");
+  fprintf (stderr, "  -O S   every S seconds, check first the rules that match most for their cost, where that cannot change the alert\n");
+  fprintf (stderr, "  -N     compile every rule set to native code with the system compiler (cc, or $CC)\n");
+  fprintf (stderr, "  -V N   alert when one source probes N destination ports within the scan window (default: off)\n");
+  fprintf (stderr, "  -H N   alert when one source probes N destination hosts within the scan window (default: off)\n");
+  fprintf (stderr, "  -W S   scan window in seconds (default: %d)\n", DEFAULT_SCAN_WINDOW);
+  fprintf (stderr, "  -Y N   alert when one destination receives N SYN packets per second (default: off)\n");
+  fprintf (stderr, "  -U N   alert when one source sends N UDP packets per second (default: off)\n");
+  fprintf (stderr, "  -E N   report the N heaviest sources, destinations, ports and flows by packets and bytes\n");
+  fprintf (stderr, "  -T N   publish live counters in shared memory N (e.g. /nids) for nids_top\n");
+  fprintf (stderr, "  -z     gzip the pcap files and the alert log on a background thread\n");
+}
+
+void parse_settings (settings_t *settings, int argc, char *argv[])
+{
+  settings_defaults (settings);
+
+  int c;
+
+  while ((c = getopt (argc, argv, "s:R:w:K:C:G:l:zP:I:S:M:T:c:O:NV:H:W:Y:U:E:")) != -1)
+  {
+    switch (c)
+    {
+    case 's':
+      settings->sample_rate = (int) atol (optarg);
+      break;
+
+    case 'R':
+      settings->recorder_size = (int) atol (optarg);
+      break;
+
+    case 'w':
+      settings->export_prefix = optarg;
+      break;
+
+    case 'K':
+      settings->export_context = (int) atol (optarg);
+      break;
+
+    case 'C':
+      settings->export_file_size = atol (optarg) * 0x100000;
+      break;
+
+    case 'G':
+      settings->export_file_time = (int) atol (optarg);
+      break;
+
+    case 'l':
+      settings->alert_log = optarg;
+      break;
+
+    case 'z':
+      settings->compress = true;
+      break;
+
+    case 'P':
+      settings->profile_top = (int) atol (optarg);
+      break;
+
+    case 'I':
+      settings->stage_interval = (int) atol (optarg);
+      break;
+
+    case 'S':
+      settings->stats_file = optarg;
+      break;
+
+    case 'M':
+      settings->metrics_address = optarg;
+      break;
+
+    case 'T':
+      settings->segment_name = optarg;
+      break;
+
+    case 'c':
+      settings->rule_cache = optarg;
+      break;
+
+    case 'O':
+      settings->order_interval = (int) atol (optarg);
+      break;
+
+    case 'N':
+      settings->native_rules = true;
+      break;
+
+    case 'V':
+      settings->scan_ports = (int) atol (optarg);
+      break;
+
+    case 'H':
+      settings->scan_hosts = (int) atol (optarg);
+      break;
+
+    case 'W':
+      settings->scan_window = (int) atol (optarg);
+      break;
+
+    case 'Y':
+      settings->syn_rate = (int) atol (optarg);
+      break;
+
+    case 'U':
+      settings->udp_rate = (int) atol (optarg);
+      break;
+
+    case 'E':
+      settings->top_talkers = (int) atol (optarg);
+      break;
+
+    default:
+      print_usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  if (optind != argc - 1)
+  {
+    fprintf (stderr, "Please, provide a rules file\n");
+    print_usage (argv[0]);
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->sample_rate < 0 || settings->recorder_size < 1)
+  {
+    fprintf (stderr, "Sample rate must be positive and the flight recorder must keep at least one packet\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->order_interval < 0)
+  {
+    fprintf (stderr, "The rule ordering interval cannot be negative\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->order_interval > 0 && settings->native_rules == true)
+  {
+    fprintf (stderr, "Rules compiled to native code cannot be reordered\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->scan_ports < 0 || settings->scan_ports > SCAN_MAX_DISTINCT ||
+      settings->scan_hosts < 0 || settings->scan_hosts > SCAN_MAX_DISTINCT || settings->scan_window < 2)
+  {
+    fprintf (stderr, "Scan thresholds must be between 0 and %d and the scan window at least 2 seconds\n",
+             SCAN_MAX_DISTINCT);
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->top_talkers < 0 || settings->top_talkers > TALKER_COUNTERS)
+  {
+    fprintf (stderr, "At most %d heavy hitters can be reported\n", TALKER_COUNTERS);
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->syn_rate < 0 || settings->udp_rate < 0)
+  {
+    fprintf (stderr, "Rate thresholds cannot be negative\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (settings->export_context < 0 || settings->export_context > settings->recorder_size ||
+      settings->export_file_size <= 0 || settings->export_file_time <= 0)
+  {
+    fprintf (stderr, "Invalid pcap export settings\n");
+    exit (EXIT_FAILURE);
+  }
+
+  settings->rules_filename = argv[optind];
+}
@@ -0,0 +1,461 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "packet.h"
+#include "output.h"
+#include "histogram.h"
+#include "stages.h"
+#include "queue.h"
+#include "epoch.h"
+#include "talkers.h"
+
+#include "metrics.h"
+
+/* Everything served here is read from counters the capture thread
+   updates without locks: relaxed loads of single-writer counters. A slow
+   scraper only ever holds up the metrics thread. */
+
+#define STOP_POLL (100) /* milliseconds */
+#define REQUEST_TIMEOUT (1) /* seconds */
+#define REQUEST_LENGTH (0x1000)
+
+#define FIRST_BUCKET_BITS (4) /* histogram buckets from 16 ns ... */
+#define LAST_BUCKET_BITS (30) /* ... to about a second */
+
+int listen_unix (char *);
+int listen_tcp (int);
+void *metrics_thread (void *);
+void serve_scrape (metrics_t *, int);
+void write_metrics (FILE *, context_t *);
+void write_histogram (FILE *, char *, histogram_t *, double);
+void write_talker_metrics (FILE *, int);
+void write_label (FILE *, char *);
+void write_memory (FILE *, context_t *);
+bool send_all (int, char *, size_t);
+
+/* address is a Unix socket path, or a port number to listen on 127.0.0.1 */
+metrics_t *metrics_init (char *address, context_t *context)
+{
+  metrics_t *metrics = (metrics_t *) calloc (1, sizeof (metrics_t));
+  if (metrics == NULL)
+  {
+    fprintf (stderr, "Could not allocate the metrics server\n");
+    exit (EXIT_FAILURE);
+  }
+
+  metrics->context = context;
+
+  if (strspn (address, "0123456789") == strlen (address))
+  {
+    metrics->listen_fd = listen_tcp ((int) atol (address));
+  }
+  else
+  {
+    metrics->listen_fd = listen_unix (address);
+    metrics->socket_path = address;
+  }
+
+  int rv = pthread_create (&(metrics->thread), NULL, metrics_thread, metrics);
+  if (rv != 0)
+  {
+    fprintf (stderr, "Could not start the metrics thread\n");
+    exit (EXIT_FAILURE);
+  }
+
+  return metrics;
+}
+
+int listen_unix (char *path)
+{
+  struct sockaddr_un address;
+
+  if (strlen (path) >= sizeof (address.sun_path))
+  {
+    fprintf (stderr, "Metrics socket path is too long: %s\n", path);
+    exit (EXIT_FAILURE);
+  }
+
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strcpy (address.sun_path, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  /* A socket left behind by an earlier run would make bind fail */
+  unlink (path);
+
+  if (fd < 0 || bind (fd, (struct sockaddr *) &address, sizeof (address)) != 0 ||
+      listen (fd, METRICS_BACKLOG) != 0)
+  {
+    fprintf (stderr, "Could not listen on %s\n", path);
+    exit (EXIT_FAILURE);
+  }
+
+  return fd;
+}
+
+int listen_tcp (int port)
+{
+  struct sockaddr_in address;
+  int yes = 1;
+
+  if (port <= 0 || port > 0xFFFF)
+  {
+    fprintf (stderr, "Invalid metrics port %d\n", port);
+    exit (EXIT_FAILURE);
+  }
+
+  memset (&address, 0, sizeof (address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons ((uint16_t) port);
+  address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0 || setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (yes)) != 0 ||
+      bind (fd, (struct sockaddr *) &address, sizeof (address)) != 0 ||
+      listen (fd, METRICS_BACKLOG) != 0)
+  {
+    fprintf (stderr, "Could not listen on 127.0.0.1:%d\n", port);
+    exit (EXIT_FAILURE);
+  }
+
+  return fd;
+}
+
+void *metrics_thread (void *arg)
+{
+  metrics_t *metrics = (metrics_t *) arg;
+
+  struct pollfd listener = {metrics->listen_fd, POLLIN, 0};
+
+  epoch_register ();
+
+  while (__atomic_load_n (&(metrics->stop), __ATOMIC_ACQUIRE) == false)
+  {
+    if (poll (&listener, 1, STOP_POLL) <= 0)
+    {
+      continue;
+    }
+
+    int fd = accept (metrics->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      continue;
+    }
+
+    serve_scrape (metrics, fd);
+    close (fd);
+  }
+
+  epoch_unregister ();
+
+  return NULL;
+}
+
+/* Answers any request with the metrics as an HTTP response, so both
+   Prometheus and curl --unix-socket can read them */
+void serve_scrape (metrics_t *metrics, int fd)
+{
+  struct timeval timeout = {REQUEST_TIMEOUT, 0};
+  char request[REQUEST_LENGTH];
+
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+  setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+
+  if (recv (fd, request, REQUEST_LENGTH, 0) <= 0)
+  {
+    return;
+  }
+
+  char *body = NULL;
+  size_t body_length = 0;
+
+  FILE *stream = open_memstream (&body, &body_length);
+  if (stream == NULL)
+  {
+    return;
+  }
+
+  write_metrics (stream, metrics->context);
+  fclose (stream);
+
+  char header[LINE_LENGTH];
+
+  int header_length = snprintf (header, LINE_LENGTH,
+                                "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %lu\r\n"
+                                "Connection: close\r\n\r\n",
+                                (long unsigned) body_length);
+
+  if (send_all (fd, header, header_length) == true)
+  {
+    send_all (fd, body, body_length);
+  }
+
+  free (body);
+}
+
+bool send_all (int fd, char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t sent = send (fd, data, length, MSG_NOSIGNAL);
+    if (sent <= 0)
+    {
+      return false;
+    }
+
+    data += sent;
+    length -= sent;
+  }
+
+  return true;
+}
+
+#define LOAD(counter) ((long unsigned) __atomic_load_n (&(counter), __ATOMIC_RELAXED))
+
+void write_metrics (FILE *file, context_t *context)
+{
+  counters_t *counters = &(context->counters);
+  capture_stats_t *capture = &(context->stats->capture);
+
+  if (__atomic_load_n (&(capture->available), __ATOMIC_RELAXED) == true)
+  {
+    fprintf (file, "# HELP nids_capture_received_total Packets received by the kernel filter.\n");
+    fprintf (file, "# TYPE nids_capture_received_total counter\n");
+    fprintf (file, "nids_capture_received_total %lu\n", LOAD (capture->received));
+    fprintf (file, "# HELP nids_capture_dropped_total Packets dropped because the capture buffer was full.\n");
+    fprintf (file, "# TYPE nids_capture_dropped_total counter\n");
+    fprintf (file, "nids_capture_dropped_total %lu\n", LOAD (capture->dropped));
+    fprintf (file, "# HELP nids_capture_interface_dropped_total Packets dropped by the interface or its driver.\n");
+    fprintf (file, "# TYPE nids_capture_interface_dropped_total counter\n");
+    fprintf (file, "nids_capture_interface_dropped_total %lu\n", LOAD (capture->interface_dropped));
+  }
+
+  fprintf (file, "# HELP nids_packets_total Packets handed to the engine.\n");
+  fprintf (file, "# TYPE nids_packets_total counter\n");
+  fprintf (file, "nids_packets_total %lu\n", LOAD (counters->packets));
+  fprintf (file, "# HELP nids_packets_parsed_total Packets parsed as TCP or UDP over IPv4.\n");
+  fprintf (file, "# TYPE nids_packets_parsed_total counter\n");
+  fprintf (file, "nids_packets_parsed_total %lu\n", LOAD (counters->parsed));
+  fprintf (file, "# HELP nids_packets_rejected_total Packets the parser rejected, by reason.\n");
+  fprintf (file, "# TYPE nids_packets_rejected_total counter\n");
+
+  for (int i = REJECT_NONE + 1; i < NUMBER_OF_REJECT_REASONS; i++)
+  {
+    fprintf (file, "nids_packets_rejected_total{reason=\"%s\"} %lu\n",
+             reject_reason_name (i), LOAD (counters->rejected[i]));
+  }
+
+  fprintf (file, "# HELP nids_prefilter_rows_total Rows with a fast pattern whose header matched a packet.\n");
+  fprintf (file, "# TYPE nids_prefilter_rows_total counter\n");
+  fprintf (file, "nids_prefilter_rows_total %lu\n", LOAD (counters->prefiltered));
+  fprintf (file, "# HELP nids_prefilter_skipped_total Rows skipped because their fast pattern was not in the payload.\n");
+  fprintf (file, "# TYPE nids_prefilter_skipped_total counter\n");
+  fprintf (file, "nids_prefilter_skipped_total %lu\n", LOAD (counters->prefilter_skipped));
+  fprintf (file, "# HELP nids_packets_matched_total Packets that matched a rule.\n");
+  fprintf (file, "# TYPE nids_packets_matched_total counter\n");
+  fprintf (file, "nids_packets_matched_total %lu\n", LOAD (counters->matched));
+  fprintf (file, "# HELP nids_scan_alerts_total Alerts of the port scan detector.\n");
+  fprintf (file, "# TYPE nids_scan_alerts_total counter\n");
+  fprintf (file, "nids_scan_alerts_total %lu\n", LOAD (counters->scan_alerts));
+  fprintf (file, "# HELP nids_scan_evictions_total Sources the scan detector forgot to make room for others.\n");
+  fprintf (file, "# TYPE nids_scan_evictions_total counter\n");
+  fprintf (file, "nids_scan_evictions_total %lu\n", LOAD (counters->scan_evictions));
+  fprintf (file, "# HELP nids_rate_alerts_total Alerts of the SYN and UDP rate detector.\n");
+  fprintf (file, "# TYPE nids_rate_alerts_total counter\n");
+  fprintf (file, "nids_rate_alerts_total %lu\n", LOAD (counters->rate_alerts));
+  fprintf (file, "# HELP nids_alerts_total Alerts raised.\n");
+  fprintf (file, "# TYPE nids_alerts_total counter\n");
+  fprintf (file, "nids_alerts_total %lu\n", LOAD (counters->alerts));
+  fprintf (file, "# HELP nids_output_bytes_total Bytes written to the alert log.\n");
+  fprintf (file, "# TYPE nids_output_bytes_total counter\n");
+  fprintf (file, "nids_output_bytes_total %lu\n", LOAD (counters->output_bytes));
+
+  if (context->exporter != NULL)
+  {
+    fprintf (file, "# HELP nids_export_packets_total Packets written to pcap files.\n");
+    fprintf (file, "# TYPE nids_export_packets_total counter\n");
+    fprintf (file, "nids_export_packets_total %lu\n", LOAD (context->exporter->exported));
+    fprintf (file, "# HELP nids_export_dropped_total Packets not exported because the queue was full.\n");
+    fprintf (file, "# TYPE nids_export_dropped_total counter\n");
+    fprintf (file, "nids_export_dropped_total %lu\n", LOAD (context->exporter->dropped));
+  }
+
+  fprintf (file, "# HELP nids_rule_hits_total Packets matched by each rule, by position in the rule file.\n");
+  fprintf (file, "# TYPE nids_rule_hits_total counter\n");
+
+  /* A reload keeps the hits of rules whose text did not change */
+  epoch_enter ();
+
+  rule_t *rules = __atomic_load_n (&(context->rules), __ATOMIC_ACQUIRE);
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    option_t *message = which_option (rule, STRING_MSG);
+
+    fprintf (file, "nids_rule_hits_total{rule=\"%d\",msg=\"", rule->id);
+    write_label (file, message != NULL ? message->value : "");
+    fprintf (file, "\"} %lu\n", LOAD (rule->hits));
+  }
+
+  epoch_exit ();
+
+  if (context->settings->top_talkers > 0)
+  {
+    write_talker_metrics (file, context->settings->top_talkers);
+  }
+
+#ifdef STAGE_TIMING
+  histogram_t *stages = (histogram_t *) calloc (NUMBER_OF_STAGES, sizeof (histogram_t));
+
+  stages_load (stages);
+
+  double scale = 1.0 / cycles_per_nanosecond ();
+
+  fprintf (file, "# HELP nids_stage_nanoseconds Time spent per packet in each stage of the engine.\n");
+  fprintf (file, "# TYPE nids_stage_nanoseconds histogram\n");
+
+  for (int i = 0; i < NUMBER_OF_STAGES; i++)
+  {
+    write_histogram (file, stage_name (i), &(stages[i]), i == STAGE_LATENCY ? 1.0 : scale);
+  }
+
+  free (stages);
+#endif
+
+  write_memory (file, context);
+}
+
+void write_talker_metrics (FILE *file, int top)
+{
+  talker_summary_t *summaries = talkers_load ();
+  char key[LINE_LENGTH];
+
+  fprintf (file, "# HELP nids_talker_count Packets or bytes of the heaviest talkers, never below the true count.\n");
+  fprintf (file, "# TYPE nids_talker_count gauge\n");
+
+  for (int i = 0; i < TALKER_SUMMARIES; i++)
+  {
+    for (int j = 0; j < top && j < summaries[i].number_of_talkers; j++)
+    {
+      format_talker (key, i, &(summaries[i].talkers[j]));
+      fprintf (file, "nids_talker_count{summary=\"%s\",key=\"%s\"} %lu\n",
+               talker_name (i), key, (long unsigned) summaries[i].talkers[j].count);
+    }
+  }
+
+  fprintf (file, "# HELP nids_talker_error Most a talker count may be above the true count.\n");
+  fprintf (file, "# TYPE nids_talker_error gauge\n");
+
+  for (int i = 0; i < TALKER_SUMMARIES; i++)
+  {
+    for (int j = 0; j < top && j < summaries[i].number_of_talkers; j++)
+    {
+      format_talker (key, i, &(summaries[i].talkers[j]));
+      fprintf (file, "nids_talker_error{summary=\"%s\",key=\"%s\"} %lu\n",
+               talker_name (i), key, (long unsigned) summaries[i].talkers[j].error);
+    }
+  }
+
+  free (summaries);
+}
+
+/* Coarse power of two buckets in nanoseconds, folded from the fine ones.
+   A fine bucket is counted under the first limit it lies entirely below. */
+void write_histogram (FILE *file, char *stage, histogram_t *histogram, double scale)
+{
+  uint64_t cumulative = 0;
+  int fine = 0;
+
+  for (int bits = FIRST_BUCKET_BITS; bits <= LAST_BUCKET_BITS; bits++)
+  {
+    double limit = (double) (1UL << bits);
+
+    while (fine < HISTOGRAM_BUCKETS && (double) histogram_bucket_limit (fine) * scale <= limit)
+    {
+      cumulative += histogram->buckets[fine++];
+    }
+
+    fprintf (file, "nids_stage_nanoseconds_bucket{stage=\"%s\",le=\"%lu\"} %lu\n",
+             stage, 1UL << bits, (long unsigned) cumulative);
+  }
+
+  fprintf (file, "nids_stage_nanoseconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n",
+           stage, (long unsigned) histogram->count);
+  fprintf (file, "nids_stage_nanoseconds_sum{stage=\"%s\"} %.0f\n", stage, (double) histogram->sum * scale);
+  fprintf (file, "nids_stage_nanoseconds_count{stage=\"%s\"} %lu\n", stage, (long unsigned) histogram->count);
+}
+
+void write_label (FILE *file, char *value)
+{
+  for (; *value != '\0'; value++)
+  {
+    if (*value == '\\' || *value == '"')
+    {
+      fprintf (file, "\\%c", *value);
+    }
+    else if (*value == '\n')
+    {
+      fprintf (file, "\\n");
+    }
+    else
+    {
+      fputc (*value, file);
+    }
+  }
+}
+
+void write_memory (FILE *file, context_t *context)
+{
+  long unsigned pages_virtual = 0, pages_resident = 0;
+  long page_size = sysconf (_SC_PAGESIZE);
+
+  FILE *statm = fopen ("/proc/self/statm", "r");
+
+  if (statm != NULL)
+  {
+    if (fscanf (statm, "%lu %lu", &pages_virtual, &pages_resident) != 2)
+    {
+      pages_virtual = pages_resident = 0;
+    }
+
+    fclose (statm);
+  }
+
+  fprintf (file, "# HELP nids_memory_virtual_bytes Virtual memory size of the process.\n");
+  fprintf (file, "# TYPE nids_memory_virtual_bytes gauge\n");
+  fprintf (file, "nids_memory_virtual_bytes %lu\n", pages_virtual * page_size);
+  fprintf (file, "# HELP nids_memory_resident_bytes Resident memory size of the process.\n");
+  fprintf (file, "# TYPE nids_memory_resident_bytes gauge\n");
+  fprintf (file, "nids_memory_resident_bytes %lu\n", pages_resident * page_size);
+  fprintf (file, "# HELP nids_recorder_bytes Memory of the flight recorder.\n");
+  fprintf (file, "# TYPE nids_recorder_bytes gauge\n");
+  fprintf (file, "nids_recorder_bytes %lu\n",
+           (long unsigned) ((context->recorder->mask + 1) * sizeof (record_t)));
+
+  if (context->exporter != NULL)
+  {
+    fprintf (file, "# HELP nids_export_queue_bytes Bytes waiting in the pcap export queue.\n");
+    fprintf (file, "# TYPE nids_export_queue_bytes gauge\n");
+    fprintf (file, "nids_export_queue_bytes %lu\n", (long unsigned) queue_used (context->exporter->queue));
+  }
+}
+
+void metrics_close (metrics_t *metrics)
+{
+  __atomic_store_n (&(metrics->stop), true, __ATOMIC_RELEASE);
+  pthread_join (metrics->thread, NULL);
+
+  close (metrics->listen_fd);
+
+  if (metrics->socket_path != NULL)
+  {
+    unlink (metrics->socket_path);
+  }
+
+  free (metrics);
+}
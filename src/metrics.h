@@ -0,0 +1,9 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "structures.h"
+
+metrics_t *metrics_init (char *, context_t *);
+void metrics_close (metrics_t *);
+
+#endif
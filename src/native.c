@@ -0,0 +1,618 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "check.h"
+#include "needle.h"
+
+#include "native.h"
+
+#define NATIVE_COMPILER "cc" /* unless CC is set */
+#define NATIVE_FLAGS "-O1 -fPIC -fvisibility=hidden -w"
+#define NATIVE_DIRECTORY "/tmp/nids-native-XXXXXX"
+#define NATIVE_CHUNK (256) /* rows per generated function, bounding compile time */
+#define NATIVE_PARTS (16) /* most sources compiled at the same time */
+
+/* The rows of a rule set are written out as C: every header field becomes
+   a comparison with a constant, or nothing when the rule takes any value,
+   port lists become switch statements and content options calls with a
+   fixed needle over their window. Rows of the other protocol are never
+   looked at, since no packet can match rows of both. The generated code
+   reads the packet at the offsets of packet_t in this build, so it needs
+   no header, and is split in parts the compiler builds on every processor
+   at once.
+
+   Options other than content and the numeric ones are left to
+   check_option, through native_calls_t, and so are contents followed by
+   a relative content, which are searched for again when it fails. */
+
+extern char **environ;
+
+void write_prologue (FILE *, native_t *);
+void write_protocol (FILE **, int, int *, native_t *, rule_headers_t *, uint8_t, char *);
+void write_row (FILE *, native_t *, rule_t *, int);
+int write_port_conditions (FILE *, port_t *, char *);
+void write_port_switch (FILE *, port_t *, char *);
+void write_ip_condition (FILE *, ip_t *, char *);
+void write_options (FILE *, native_t *, rule_t *);
+void write_content (FILE *, option_t *);
+void write_bytes (FILE *, char *, size_t);
+bool build_library (native_t *, rule_headers_t *, char *);
+pid_t run_compiler (char *, ...);
+bool compiler_succeeded (pid_t);
+int compare_ports (const void *, const void *);
+int unique_ports (port_t *, uint16_t *);
+
+/* Compiles the rows of a rule set that is not published yet, and attaches
+   the result to its storage. Returns false, leaving the rules to the
+   interpreter, when anything fails. */
+bool compile_rules (rule_t *rules)
+{
+  if (rules == NULL)
+  {
+    return false;
+  }
+
+  rule_storage_t *storage = rules->storage;
+  rule_headers_t *headers = storage->headers;
+
+  struct timespec start, finish;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  native_t *native = (native_t *) calloc (1, sizeof (native_t));
+  if (native == NULL)
+  {
+    fprintf (stderr, "Could not allocate the native rules\n");
+    return false;
+  }
+
+  native->number = headers->number;
+  native->rows = (rule_t **) malloc ((headers->number + 1) * sizeof (rule_t *));
+  if (native->rows == NULL)
+  {
+    fprintf (stderr, "Could not allocate the native rules\n");
+    free (native);
+    return false;
+  }
+
+  memcpy (native->rows, headers->rules, headers->number * sizeof (rule_t *));
+
+  native->calls.find_needle = find_needle;
+  native->calls.find_needle_nocase = find_needle_nocase;
+  native->calls.check_option = check_option;
+
+  char directory[] = NATIVE_DIRECTORY;
+
+  if (mkdtemp (directory) == NULL)
+  {
+    fprintf (stderr, "Could not create a directory for the native rules\n");
+    free_native (native);
+    return false;
+  }
+
+  if (build_library (native, headers, directory) == false)
+  {
+    fprintf (stderr, "Could not compile the rules to native code, the interpreter checks them\n");
+    rmdir (directory);
+    free_native (native);
+    return false;
+  }
+
+  rmdir (directory);
+
+  storage->native = native;
+
+  clock_gettime (CLOCK_MONOTONIC, &finish);
+
+  printf ("Rules compiled to native code: %d rows in %.1f ms\n", native->number,
+          (double) (finish.tv_sec - start.tv_sec) * 1e3 + (double) (finish.tv_nsec - start.tv_nsec) / 1e6);
+  fflush (stdout);
+
+  return true;
+}
+
+/* Writes the source in parts compiled at the same time, links and loads
+   them. The files are removed once the library is mapped. */
+bool build_library (native_t *native, rule_headers_t *headers, char *directory)
+{
+  long processors = sysconf (_SC_NPROCESSORS_ONLN);
+  int chunks = native->number / NATIVE_CHUNK + 2;
+
+  int parts = processors < 1 ? 1 : processors > NATIVE_PARTS ? NATIVE_PARTS : (int) processors;
+  parts = parts > chunks ? chunks : parts;
+
+  /* files[0] calls the chunks of rows, the other files hold them */
+  FILE *files[NATIVE_PARTS + 1] = {NULL};
+  char name[LINE_LENGTH];
+  bool built = true;
+
+  for (int i = 0; i <= parts; i++)
+  {
+    snprintf (name, LINE_LENGTH, "%s/%d.c", directory, i);
+
+    files[i] = fopen (name, "w");
+    if (files[i] == NULL)
+    {
+      fprintf (stderr, "Could not open %s\n", name);
+      built = false;
+      continue;
+    }
+
+    write_prologue (files[i], native);
+  }
+
+  if (built == true)
+  {
+    int next_part = 0;
+
+    write_protocol (files, parts, &next_part, native, headers, IPPROTO_TCP, "tcp");
+    write_protocol (files, parts, &next_part, native, headers, IPPROTO_UDP, "udp");
+
+    fprintf (files[0], "__attribute__ ((visibility (\"default\")))\n"
+                       "int nids_match (const uint8_t *packet, const calls_t *calls)\n{\n"
+                       "  switch (*(const uint8_t *) (packet + %zu))\n  {\n"
+                       "  case %d:\n    return tcp (packet, calls);\n"
+                       "  case %d:\n    return udp (packet, calls);\n"
+                       "  }\n\n  return -1;\n}\n",
+             offsetof (packet_t, protocol), IPPROTO_TCP, IPPROTO_UDP);
+  }
+
+  for (int i = 0; i <= parts; i++)
+  {
+    if (files[i] != NULL && fclose (files[i]) != 0)
+    {
+      fprintf (stderr, "Could not write the native rules\n");
+      built = false;
+    }
+  }
+
+  pid_t compilers[NATIVE_PARTS + 1];
+
+  for (int i = 0; i <= parts; i++)
+  {
+    compilers[i] = built == true ? run_compiler ("%s -c -o %s/%d.o %s/%d.c", NATIVE_FLAGS, directory, i, directory, i) : -1;
+  }
+
+  for (int i = 0; i <= parts; i++)
+  {
+    built = compiler_succeeded (compilers[i]) == true && built == true;
+  }
+
+  if (built == true)
+  {
+    built = compiler_succeeded (run_compiler ("-shared -o %s/rules.so %s/*.o", directory, directory));
+  }
+
+  for (int i = 0; i <= parts; i++)
+  {
+    snprintf (name, LINE_LENGTH, "%s/%d.c", directory, i);
+    unlink (name);
+    snprintf (name, LINE_LENGTH, "%s/%d.o", directory, i);
+    unlink (name);
+  }
+
+  snprintf (name, LINE_LENGTH, "%s/rules.so", directory);
+
+  if (built == true)
+  {
+    native->library = dlopen (name, RTLD_NOW | RTLD_LOCAL);
+  }
+
+  unlink (name);
+
+  if (native->library == NULL)
+  {
+    return false;
+  }
+
+  native->match = (native_match_t) dlsym (native->library, "nids_match");
+
+  return native->match != NULL;
+}
+
+/* Starts the compiler, CC when set, with the arguments. Not through
+   system (), which would ignore SIGINT in every thread meanwhile. */
+pid_t run_compiler (char *format, ...)
+{
+  char *compiler = getenv ("CC");
+  char arguments[3 * LINE_LENGTH];
+  char command[4 * LINE_LENGTH];
+
+  va_list list;
+  va_start (list, format);
+  vsnprintf (arguments, sizeof (arguments), format, list);
+  va_end (list);
+
+  snprintf (command, sizeof (command), "%s %s",
+            compiler != NULL && compiler[0] != '\0' ? compiler : NATIVE_COMPILER, arguments);
+
+  char *shell[] = {"sh", "-c", command, NULL};
+  pid_t child;
+
+  return posix_spawn (&child, "/bin/sh", NULL, NULL, shell, environ) == 0 ? child : -1;
+}
+
+bool compiler_succeeded (pid_t child)
+{
+  int status;
+
+  return child > 0 && waitpid (child, &status, 0) == child && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+void write_prologue (FILE *file, native_t *native)
+{
+  fprintf (file, "/* Generated from %d rows of rules, do not edit */\n\n", native->number);
+  fprintf (file, "#include <stddef.h>\n#include <stdint.h>\n\n");
+
+  fprintf (file, "typedef struct\n{\n"
+                 "  void *(*find_needle) (const void *, size_t, const void *, size_t);\n"
+                 "  void *(*find_needle_nocase) (const void *, size_t, const void *, size_t);\n"
+                 "  _Bool (*check_option) (void *, void *);\n"
+                 "  void **options;\n"
+                 "}\ncalls_t;\n\n");
+
+  fprintf (file, "#define FIELDS \\\n"
+                 "  uint32_t source_ip = *(const uint32_t *) (packet + %zu); \\\n"
+                 "  uint32_t dest_ip = *(const uint32_t *) (packet + %zu); \\\n"
+                 "  uint16_t source_port = *(const uint16_t *) (packet + %zu); \\\n"
+                 "  uint16_t dest_port = *(const uint16_t *) (packet + %zu); \\\n"
+                 "  uint8_t type_of_service = *(const uint8_t *) (packet + %zu); \\\n"
+                 "  uint8_t ip_header_length = *(const uint8_t *) (packet + %zu); \\\n"
+                 "  uint16_t frag_offset = *(const uint16_t *) (packet + %zu); \\\n"
+                 "  uint32_t seq_number = *(const uint32_t *) (packet + %zu); \\\n"
+                 "  uint32_t ack_number = *(const uint32_t *) (packet + %zu); \\\n"
+                 "  uint8_t flags = *(const uint8_t *) (packet + %zu); \\\n"
+                 "  const void *data = *(const void *const *) (packet + %zu); \\\n"
+                 "  size_t length = *(const size_t *) (packet + %zu);\n\n",
+           offsetof (packet_t, source_IP), offsetof (packet_t, dest_IP),
+           offsetof (packet_t, source_port), offsetof (packet_t, dest_port),
+           offsetof (packet_t, type_of_service), offsetof (packet_t, ip_header_length),
+           offsetof (packet_t, frag_offset), offsetof (packet_t, seq_number),
+           offsetof (packet_t, ack_number), offsetof (packet_t, flags),
+           offsetof (packet_t, data), offsetof (packet_t, data_length));
+}
+
+/* One function per NATIVE_CHUNK rows of the protocol, spread over the
+   parts and called in order by a function named after the protocol */
+void write_protocol (FILE **files, int parts, int *next_part, native_t *native, rule_headers_t *headers,
+                     uint8_t protocol, char *name)
+{
+  FILE *file = NULL;
+  int chunks = 0;
+  int rows_in_chunk = 0;
+
+  for (int i = 0; i < native->number; i++)
+  {
+    if (headers->protocols[i] != protocol)
+    {
+      continue;
+    }
+
+    if (rows_in_chunk == 0)
+    {
+      file = files[1 + (*next_part)++ % parts];
+
+      fprintf (file, "int %s_%d (const uint8_t *packet, const calls_t *calls)\n{\n  FIELDS\n\n", name, chunks);
+    }
+
+    write_row (file, native, native->rows[i], i);
+
+    if (++rows_in_chunk == NATIVE_CHUNK)
+    {
+      fprintf (file, "  return -1;\n}\n\n");
+      rows_in_chunk = 0;
+      chunks++;
+    }
+  }
+
+  if (rows_in_chunk > 0)
+  {
+    fprintf (file, "  return -1;\n}\n\n");
+    chunks++;
+  }
+
+  for (int i = 0; i < chunks; i++)
+  {
+    fprintf (files[0], "int %s_%d (const uint8_t *, const calls_t *);\n", name, i);
+  }
+
+  fprintf (files[0], "\nstatic int %s (const uint8_t *packet, const calls_t *calls)\n{\n  int row;\n\n", name);
+
+  for (int i = 0; i < chunks; i++)
+  {
+    fprintf (files[0], "  if ((row = %s_%d (packet, calls)) >= 0)\n    return row;\n", name, i);
+  }
+
+  fprintf (files[0], "\n  return -1;\n}\n\n");
+}
+
+/* Ranges and single ports are tested in the condition, port lists in
+   switch statements nested inside it */
+void write_row (FILE *file, native_t *native, rule_t *row, int index)
+{
+  fprintf (file, "  /* rule %d%s */\n  if (1", row->id, row->members != NULL ? " and the rules merged with it" : "");
+
+  write_ip_condition (file, &(row->dest_ip), "dest_ip");
+  bool dest_list = write_port_conditions (file, &(row->dest_port), "dest_port") < 0;
+  write_ip_condition (file, &(row->source_ip), "source_ip");
+  bool source_list = write_port_conditions (file, &(row->source_port), "source_port") < 0;
+
+  fprintf (file, ")\n  {\n");
+
+  if (dest_list == true)
+  {
+    write_port_switch (file, &(row->dest_port), "dest_port");
+  }
+
+  if (source_list == true)
+  {
+    write_port_switch (file, &(row->source_port), "source_port");
+  }
+
+  fprintf (file, "    if (1");
+  write_options (file, native, row);
+  fprintf (file, ")\n      return %d;\n", index);
+
+  if (source_list == true)
+  {
+    fprintf (file, "    }\n");
+  }
+
+  if (dest_list == true)
+  {
+    fprintf (file, "    }\n");
+  }
+
+  fprintf (file, "  }\n\n");
+}
+
+void write_ip_condition (FILE *file, ip_t *ip, char *variable)
+{
+  if (ip->start == 0 && ip->finish == UINT32_MAX)
+  {
+    return;
+  }
+
+  if (ip->start > ip->finish)
+  {
+    fprintf (file, " && 0");
+  }
+  else if (ip->start == ip->finish)
+  {
+    fprintf (file, " && %s == 0x%08xu", variable, ip->start);
+  }
+  else
+  {
+    fprintf (file, " && %s - 0x%08xu <= 0x%08xu", variable, ip->start, ip->finish - ip->start);
+  }
+}
+
+/* Returns -1 when the port list needs a switch statement */
+int write_port_conditions (FILE *file, port_t *port, char *variable)
+{
+  if (port->colon_found == false)
+  {
+    uint16_t ports[port->number_of_ports + 1];
+    int number = unique_ports (port, ports);
+
+    if (number == 0)
+    {
+      fprintf (file, " && 0");
+      return 1;
+    }
+
+    if (number > 1)
+    {
+      return -1;
+    }
+
+    fprintf (file, " && %s == %u", variable, ports[0]);
+    return 1;
+  }
+
+  if (port->start == 0 && port->finish == UINT16_MAX)
+  {
+    return 0;
+  }
+
+  if (port->start > port->finish)
+  {
+    fprintf (file, " && 0");
+  }
+  else if (port->start == port->finish)
+  {
+    fprintf (file, " && %s == %u", variable, port->start);
+  }
+  else
+  {
+    fprintf (file, " && (uint16_t) (%s - %uu) <= %uu", variable, port->start, port->finish - port->start);
+  }
+
+  return 1;
+}
+
+/* Opens a switch whose cases are the listed ports, closed by the caller */
+void write_port_switch (FILE *file, port_t *port, char *variable)
+{
+  uint16_t ports[port->number_of_ports + 1];
+  int number = unique_ports (port, ports);
+
+  fprintf (file, "    switch (%s)\n    {\n   ", variable);
+
+  for (int i = 0; i < number; i++)
+  {
+    fprintf (file, " case %u:", ports[i]);
+  }
+
+  fprintf (file, "\n");
+}
+
+/* Options in the order they are cheapest to check. They have no side
+   effects, so the order does not change the result. */
+void write_options (FILE *file, native_t *native, rule_t *row)
+{
+  for (option_t *option = row->options; option != NULL; option = option->next)
+  {
+    if (option->modifier == true)
+    {
+      continue;
+    }
+
+    if (strcmp (option->name, STRING_TOS) == 0)
+    {
+      fprintf (file, " && type_of_service == %u", (uint8_t) atol (option->value));
+    }
+    else if (strcmp (option->name, STRING_LEN) == 0)
+    {
+      fprintf (file, " && ip_header_length == %u", (uint8_t) atol (option->value));
+    }
+    else if (strcmp (option->name, STRING_OFF) == 0)
+    {
+      fprintf (file, " && frag_offset == %u", (uint16_t) atol (option->value));
+    }
+    else if (strcmp (option->name, STRING_SEQ) == 0)
+    {
+      fprintf (file, " && seq_number == %uu", (uint32_t) atol (option->value));
+    }
+    else if (strcmp (option->name, STRING_ACK) == 0)
+    {
+      fprintf (file, " && ack_number == %uu", (uint32_t) atol (option->value));
+    }
+    else if (strcmp (option->name, STRING_FLAGS) == 0)
+    {
+      uint8_t mask = flags_mask (option->value);
+
+      fprintf (file, " && (flags & %u) == %u", mask, mask);
+    }
+  }
+
+  for (option_t *option = row->options; option != NULL; option = option->next)
+  {
+    if (option->modifier == false && strcmp (option->name, STRING_CONTENT) == 0 &&
+        option->content.relative == false && option->content.following == NULL)
+    {
+      write_content (file, option);
+    }
+  }
+
+  for (option_t *option = row->options; option != NULL; option = option->next)
+  {
+    if (option->modifier == true || strcmp (option->name, STRING_MSG) == 0 || strcmp (option->name, STRING_TOS) == 0 ||
+        strcmp (option->name, STRING_LEN) == 0 || strcmp (option->name, STRING_OFF) == 0 ||
+        strcmp (option->name, STRING_SEQ) == 0 || strcmp (option->name, STRING_ACK) == 0 ||
+        strcmp (option->name, STRING_FLAGS) == 0 ||
+        (strcmp (option->name, STRING_CONTENT) == 0 &&
+         (option->content.relative == true || option->content.following == NULL)))
+    {
+      continue;
+    }
+
+    option_t **options = (option_t **) realloc (native->calls.options,
+                                                 (native->number_of_options + 1) * sizeof (option_t *));
+    if (options == NULL)
+    {
+      fprintf (stderr, "Could not allocate the native rules\n");
+      exit (EXIT_FAILURE);
+    }
+
+    native->calls.options = options;
+    native->calls.options[native->number_of_options] = option;
+
+    fprintf (file, "\n        && calls->check_option (calls->options[%d], (void *) packet)", native->number_of_options);
+
+    native->number_of_options++;
+  }
+}
+
+/* A search with a fixed needle over the window of the content, as
+   content_window computes it for a content that is not relative */
+void write_content (FILE *file, option_t *option)
+{
+  content_t *content = &(option->content);
+  size_t needle_length = (size_t) option->value_length;
+  char *search = content->nocase == true ? "find_needle_nocase" : "find_needle";
+
+  if (content->start == 0 && content->length == 0)
+  {
+    fprintf (file, "\n        && calls->%s (data, length, ", search);
+  }
+  else if (content->length == 0)
+  {
+    fprintf (file, "\n        && length > %d && calls->%s ((const char *) data + %d, length - %d, ",
+             content->start, search, content->start, content->start);
+  }
+  else
+  {
+    fprintf (file, "\n        && length > %d && calls->%s ((const char *) data + %d, "
+                   "length - %d < %d ? length - %d : %d, ",
+             content->start, search, content->start, content->start, content->length, content->start,
+             content->length);
+  }
+
+  write_bytes (file, option->value, needle_length);
+  fprintf (file, ", %zu) != 0", needle_length);
+}
+
+/* A string literal that survives any byte */
+void write_bytes (FILE *file, char *bytes, size_t length)
+{
+  fputc ('"', file);
+
+  for (size_t i = 0; i < length; i++)
+  {
+    unsigned char byte = (unsigned char) bytes[i];
+
+    if (isalnum (byte) || byte == ' ' || byte == '.' || byte == '/' || byte == '-' || byte == '_')
+    {
+      fputc (byte, file);
+    }
+    else
+    {
+      fprintf (file, "\\%03o", byte);
+    }
+  }
+
+  fputc ('"', file);
+}
+
+/* Sorted and without repeats, as case labels must be */
+int unique_ports (port_t *port, uint16_t *ports)
+{
+  memcpy (ports, port->ports, port->number_of_ports * sizeof (uint16_t));
+
+  qsort (ports, port->number_of_ports, sizeof (uint16_t), compare_ports);
+
+  int number = 0;
+
+  for (int i = 0; i < port->number_of_ports; i++)
+  {
+    if (number == 0 || ports[number - 1] != ports[i])
+    {
+      ports[number++] = ports[i];
+    }
+  }
+
+  return number;
+}
+
+int compare_ports (const void *a, const void *b)
+{
+  return (int) *(const uint16_t *) a - (int) *(const uint16_t *) b;
+}
+
+void free_native (native_t *native)
+{
+  if (native == NULL)
+  {
+    return;
+  }
+
+  if (native->library != NULL)
+  {
+    dlclose (native->library);
+  }
+
+  free (native->calls.options);
+  free (native->rows);
+  free (native);
+}
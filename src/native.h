@@ -0,0 +1,9 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "structures.h"
+
+bool compile_rules (rule_t *);
+void free_native (native_t *);
+
+#endif
@@ -32,6 +32,9 @@
  */
 #include <string.h>
 #include "needle.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 void *find_needle (const void *haystack, size_t n, const void *needle, size_t m)
 {
     if (m > n || !m || !n)
@@ -60,3 +63,62 @@ void *find_needle (const void *haystack, size_t n, const void *needle, size_t m)
     }
     return NULL;
 }
+
+/*
+ * ASCII case-insensitive search. Each block of 16 positions is case folded
+ * in registers and compared with the first and the last byte of the needle
+ * at once; only positions where both agree are compared in full. The
+ * payload is never copied or lowercased.
+ */
+static inline unsigned char fold(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char) (c | 0x20) : c;
+}
+static int same_folded(const unsigned char* a, const unsigned char* b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (fold(a[i]) != fold(b[i]))
+            return 0;
+    return 1;
+}
+#ifdef __SSE2__
+static inline __m128i fold_block(__m128i v)
+{
+    /* bytes from 0x80 are negative, so never taken for capitals */
+    __m128i capital = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                    _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(capital, _mm_set1_epi8(0x20)));
+}
+#endif
+void *find_needle_nocase (const void *haystack, size_t n, const void *needle, size_t m)
+{
+    if (m > n || !m || !n)
+        return NULL;
+    const unsigned char*  y = (const unsigned char*) haystack;
+    const unsigned char*  x = (const unsigned char*) needle;
+    unsigned char         first = fold(x[0]), last = fold(x[m-1]);
+    size_t                inner = m > 2 ? m - 2 : 0;
+    size_t                j = 0;
+#ifdef __SSE2__
+    __m128i               firsts = _mm_set1_epi8((char) first);
+    __m128i               lasts = _mm_set1_epi8((char) last);
+    while (j + m - 1 + 16 <= n) {
+        __m128i a = fold_block(_mm_loadu_si128((const __m128i*) (y + j)));
+        __m128i b = fold_block(_mm_loadu_si128((const __m128i*) (y + j + m - 1)));
+        unsigned mask = (unsigned) _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, firsts), _mm_cmpeq_epi8(b, lasts)));
+        while (mask) {
+            size_t i = j + (size_t) __builtin_ctz(mask);
+            if (same_folded(y + i + 1, x + 1, inner))
+                return (void*) &y[i];
+            mask &= mask - 1;
+        }
+        j += 16;
+    }
+#endif
+    for (; j <= n - m; j++) {
+        if (fold(y[j]) == first && fold(y[j+m-1]) == last && same_folded(y + j + 1, x + 1, inner))
+            return (void*) &y[j];
+    }
+    return NULL;
+}
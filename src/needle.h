@@ -4,5 +4,6 @@
 #include "libraries.h"
 
 void *find_needle (const void *, size_t, const void *, size_t);
+void *find_needle_nocase (const void *, size_t, const void *, size_t);
 
 #endif
@@ -0,0 +1,193 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "rules.h"
+#include "epoch.h"
+
+#include "order.h"
+
+#define ORDER_MIN_PACKETS (1000) /* counted on an ordering before it is judged */
+#define ORDER_REACH (1024) /* most rows one row may move ahead of */
+#define ORDER_OPTION_COST (4.0) /* checking options, relative to a header */
+#define ORDER_MIN_GAIN (0.02) /* smallest expected saving worth a new ordering */
+
+/* In first-match mode a packet is checked against every row before the
+   one it matches. The capture thread counts, per row of the current
+   ordering, the packets whose header matched and those the row matched;
+   the packets that reached a row follow from the matches of the rows
+   before it. Every order_interval seconds the rows are put in order of
+   matches per unit of cost, where rejecting on the header costs 1 and
+   checking the options ORDER_OPTION_COST more.
+
+   A row only moves ahead of rows no packet can match together with it,
+   so every packet is still matched by the same row. The new ordering is
+   published with a single pointer store and the old one freed once no
+   reader can see it; the capture thread never waits. */
+
+bool counting_rows = false;
+
+typedef struct row_score_tag
+{
+  int row;
+  double probability; /* of matching a packet that reaches the row */
+  double cost;
+  double score;
+}
+row_score_t;
+
+void score_rows (rule_headers_t *, row_score_t *);
+bool disjoint_rows (rule_headers_t *, int, int);
+int sort_rows (rule_headers_t *, row_score_t *, int);
+double expected_cost (row_score_t *, int);
+
+/* Called by the thread that replaces rule sets, so the set stays valid.
+   Returns whether a new ordering was published. */
+bool order_rules (rule_t *rules)
+{
+  if (rules == NULL)
+  {
+    return false;
+  }
+
+  rule_storage_t *storage = rules->storage;
+  rule_headers_t *headers = storage->headers;
+  int number = headers->number;
+
+  if (__atomic_load_n (&(headers->packets), __ATOMIC_RELAXED) < ORDER_MIN_PACKETS)
+  {
+    return false;
+  }
+
+  row_score_t *scores = (row_score_t *) calloc (number + 1, sizeof (row_score_t));
+  if (scores == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule ordering\n");
+    return false;
+  }
+
+  score_rows (headers, scores);
+
+  double cost_before = expected_cost (scores, number);
+
+  int moved = sort_rows (headers, scores, number);
+
+  double cost_after = expected_cost (scores, number);
+
+  /* Otherwise the counters keep adding up on the current ordering */
+  if (moved == 0 || cost_after > cost_before * (1.0 - ORDER_MIN_GAIN))
+  {
+    free (scores);
+    return false;
+  }
+
+  rule_headers_t *ordered = new_rule_headers (number);
+
+  for (int i = 0; i < number; i++)
+  {
+    set_row_header (ordered, i, headers->rules[scores[i].row]);
+  }
+
+  __atomic_store_n (&(storage->headers), ordered, __ATOMIC_RELEASE);
+
+  epoch_synchronize ();
+
+  free (headers);
+
+  printf ("Rules reordered: %d of %d rows moved, expected cost %.1f instead of %.1f header checks per packet\n",
+          moved, number, cost_after, cost_before);
+  fflush (stdout);
+
+  free (scores);
+
+  return true;
+}
+
+void score_rows (rule_headers_t *headers, row_score_t *scores)
+{
+  uint64_t reached = __atomic_load_n (&(headers->packets), __ATOMIC_RELAXED);
+
+  for (int i = 0; i < headers->number; i++)
+  {
+    uint64_t passed = __atomic_load_n (&(headers->passed[i]), __ATOMIC_RELAXED);
+    uint64_t matched = __atomic_load_n (&(headers->matched[i]), __ATOMIC_RELAXED);
+
+    row_score_t *score = &(scores[i]);
+
+    score->row = i;
+
+    /* Counters are read while they are written, so they are clamped */
+    if (reached > 0)
+    {
+      score->probability = matched < reached ? (double) matched / reached : 1.0;
+      score->cost = 1.0 + ORDER_OPTION_COST * (passed < reached ? (double) passed / reached : 1.0);
+    }
+    else
+    {
+      score->probability = 0.0;
+      score->cost = 1.0;
+    }
+
+    score->score = score->probability / score->cost;
+
+    reached = matched < reached ? reached - matched : 0;
+  }
+}
+
+/* Whether no packet can match both rows. Port lists are only compared by
+   their bounds, which may keep some disjoint rows in place. */
+bool disjoint_rows (rule_headers_t *headers, int a, int b)
+{
+  return headers->protocols[a] != headers->protocols[b] ||
+         headers->source_ip_finish[a] < headers->source_ip_start[b] ||
+         headers->source_ip_finish[b] < headers->source_ip_start[a] ||
+         headers->dest_ip_finish[a] < headers->dest_ip_start[b] ||
+         headers->dest_ip_finish[b] < headers->dest_ip_start[a] ||
+         headers->source_port_finish[a] < headers->source_port_start[b] ||
+         headers->source_port_finish[b] < headers->source_port_start[a] ||
+         headers->dest_port_finish[a] < headers->dest_port_start[b] ||
+         headers->dest_port_finish[b] < headers->dest_port_start[a];
+}
+
+/* Insertion sort by decreasing score, keeping ties in their order, where
+   a row stops at the first row it is not disjoint from. Only disjoint
+   neighbours are ever swapped, so rows that overlap keep their order.
+   Returns the number of rows moved. */
+int sort_rows (rule_headers_t *headers, row_score_t *scores, int number)
+{
+  int moved = 0;
+
+  for (int i = 1; i < number; i++)
+  {
+    row_score_t moving = scores[i];
+    int j = i;
+
+    while (j > 0 && i - j < ORDER_REACH && scores[j - 1].score < moving.score &&
+           disjoint_rows (headers, scores[j - 1].row, moving.row) == true)
+    {
+      scores[j] = scores[j - 1];
+      j--;
+    }
+
+    scores[j] = moving;
+    moved += j < i ? 1 : 0;
+  }
+
+  return moved;
+}
+
+/* Cost of a packet going through the rows in this order, taking their
+   matches as independent */
+double expected_cost (row_score_t *scores, int number)
+{
+  double reaching = 1.0;
+  double cost = 0.0;
+
+  for (int i = 0; i < number; i++)
+  {
+    cost += reaching * scores[i].cost;
+    reaching *= 1.0 - scores[i].probability;
+  }
+
+  return cost;
+}
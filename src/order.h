@@ -0,0 +1,10 @@
+#ifndef ORDER_H
+#define ORDER_H
+
+#include "structures.h"
+
+extern bool counting_rows;
+
+bool order_rules (rule_t *);
+
+#endif
@@ -2,7 +2,7 @@
 #include "definitions.h"
 #include "structures.h"
 
-#include "needle.h"
+#include "check.h"
 
 #include "output.h"
 
@@ -18,6 +18,7 @@ option_t *which_option (rule_t *, char *);
 void convert_ip_to_string (char *, uint32_t);
 void print_flags (option_t *);
 void print_payload (option_t *, packet_t *);
+void print_text (const uint8_t *, size_t, size_t);
 
 void print_packet_flags (uint8_t);
 
@@ -65,7 +66,7 @@ void print_one_rule (rule_t *rule)
 
   for (option_t* cur_option = rule->options; cur_option != NULL; cur_option = cur_option->next)
   {
-    printf ("    |-%s: %s\n", cur_option->name, cur_option->value);
+    printf ("    |-%s: ", cur_option->name); print_value (cur_option); printf ("\n");
   }
 }
 
@@ -264,7 +265,7 @@ option_t *which_option (rule_t *rule, char *option_name)
 
   for (cur_option = rule->options; cur_option != NULL; cur_option = cur_option->next)
   {
-    if (strcmp (cur_option->name, option_name) == 0)
+    if (cur_option->modifier == false && strcmp (cur_option->name, option_name) == 0)
     {
       break;
     }
@@ -316,53 +317,68 @@ void print_flags (option_t *option)
   }
 }
 
+/* The payload with the match of the content option in red. A relative
+   content is looked for from the start, and may not be highlighted. */
 void print_payload (option_t *option, packet_t *packet)
 {
-  if (option == NULL)
-  {
-    for (int i = 0; i < packet->data_length; i++)
-    {
-      if (isprint (((char *) packet->data)[i]))
-      {
-        printf ("%c", ((char *) packet->data)[i]);
-      }
-      else
-      {
-        printf (".");
-      }
-    }
+  const uint8_t *data = (const uint8_t *) packet->data;
+  size_t length = packet->data_length;
 
-    return;
-  }
+  const uint8_t *found = option != NULL ? find_content (option, data, length, 0) : NULL;
+
+  size_t before = found != NULL ? (size_t) (found - data) : length;
+  size_t matched = found != NULL ? (size_t) option->value_length : 0;
 
-  char *needle = find_needle (packet->data, packet->data_length,
-                              (void *) option->value, strlen (option->value));
+  print_text (data, 0, before);
 
-  int before = needle - (char *) packet->data;
+  printf (RED); print_text (data, before, before + matched); printf (RESET);
 
-  int after = packet->data_length - before - strlen (option->value);
+  print_text (data, before + matched, length);
+}
 
-  for (int i = 0; i < before; i++)
+/* The value of an option, a content as it could be written in the rule
+   file: bytes that cannot be printed in hex between two | */
+void print_value (option_t *option)
+{
+  if (strcmp (option->name, STRING_CONTENT) != 0)
   {
-    if (isprint (((char *) packet->data)[i]))
+    printf ("%s", option->value);
+    return;
+  }
+
+  bool hex = false;
+
+  for (int i = 0; i < option->value_length; i++)
+  {
+    uint8_t byte = (uint8_t) option->value[i];
+    bool printable = isprint (byte) && byte != '|';
+
+    if (printable == hex)
     {
-      printf ("%c", ((char *) packet->data)[i]);
+      printf ("|");
+      hex = !hex;
     }
-    else
+    else if (hex == true)
     {
-      printf (".");
+      printf (" ");
     }
+
+    printf (hex == true ? "%02X" : "%c", byte);
   }
 
-  printf (RED); printf ("%s", option->value); printf (RESET);
+  if (hex == true)
+  {
+    printf ("|");
+  }
+}
 
-  for (int i = before + strlen (option->value);
-       i < before + strlen (option->value) + after;
-       i++)
+void print_text (const uint8_t *data, size_t from, size_t to)
+{
+  for (size_t i = from; i < to; i++)
   {
-    if (isprint (((char *) packet->data)[i]))
+    if (isprint (data[i]))
     {
-      printf ("%c", ((char *) packet->data)[i]);
+      printf ("%c", data[i]);
     }
     else
     {
@@ -371,6 +387,50 @@ void print_payload (option_t *option, packet_t *packet)
   }
 }
 
+/* Fills rule as the rule a detector alerts with: it only carries the
+   alert text and matches any address and port, so print_output
+   highlights nothing of the header */
+void init_alert_rule (rule_t *rule, option_t *message, char *text)
+{
+  memset (rule, 0, sizeof (rule_t));
+  memset (message, 0, sizeof (option_t));
+
+  message->id = -1;
+  message->name = STRING_MSG;
+  message->value = text;
+  message->value_length = (int) strlen (text);
+
+  rule->id = -1;
+  rule->str = text;
+  rule->protocol = ANY;
+  rule->source_ip.str = ANY;
+  rule->dest_ip.str = ANY;
+  rule->source_port.str = ANY;
+  rule->dest_port.str = ANY;
+  rule->options = message;
+  rule->fast_pattern = -1;
+}
+
+/* One line per alert: time, message, protocol and endpoints. Returns the
+   number of bytes written. */
+int log_alert (FILE *log, rule_t *rule, packet_t *packet, const struct pcap_pkthdr *pkthdr)
+{
+  char source_ip[STRING_LENGTH];
+  char dest_ip[STRING_LENGTH];
+
+  convert_ip_to_string (source_ip, packet->source_IP);
+  convert_ip_to_string (dest_ip, packet->dest_IP);
+
+  option_t *message = which_option (rule, STRING_MSG);
+
+  return fprintf (log, "%ld.%06ld \"%s\" %s %s:%d -> %s:%d\n",
+                  (long) pkthdr->ts.tv_sec, (long) pkthdr->ts.tv_usec,
+                  message != NULL ? message->value : "",
+                  packet->transport_protocol,
+                  source_ip, (int) packet->source_port,
+                  dest_ip, (int) packet->dest_port);
+}
+
 void print_packet (packet_t *packet)
 {
   char source_ip[STRING_LENGTH];
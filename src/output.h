@@ -6,5 +6,9 @@
 void print_rules (rule_t *);
 void print_output (rule_t *, packet_t *);
 void print_packet (packet_t *);
+option_t *which_option (rule_t *, char *);
+void print_value (option_t *);
+void init_alert_rule (rule_t *, option_t *, char *);
+int log_alert (FILE *, rule_t *, packet_t *, const struct pcap_pkthdr *);
 
 #endif
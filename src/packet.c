@@ -20,10 +20,12 @@ uint16_t get_16_bits (uint16_t, int, int);
 void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_length)
 {
   packet->valid = false;
+  packet->reject_reason = REJECT_NONE;
 
   if (raw_length < data_link_offset)
   {
-    fprintf (stderr, "Packet is shorter than data link offset\n"); fflush (stderr);
+    LOG_DEBUG ("Packet is shorter than data link offset\n");
+    packet->reject_reason = REJECT_LINK;
     return;
   }
 
@@ -38,7 +40,8 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
 
   if (raw_length < MIN_IP_HEADER_LENGTH)
   {
-    fprintf (stderr, "Packet is shorter than min IP header length\n"); fflush (stderr);
+    LOG_DEBUG ("Packet is shorter than min IP header length\n");
+    packet->reject_reason = REJECT_IP_HEADER;
     return;
   }
 
@@ -54,7 +57,8 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
   uint8_t ip_header_length = ihl * (uint8_t) sizeof (uint32_t); /* number of bytes */
   if (raw_length < ip_header_length)
   {
-    fprintf (stderr, "Packet is shorter than actual IP header length\n"); fflush (stderr);
+    LOG_DEBUG ("Packet is shorter than actual IP header length\n");
+    packet->reject_reason = REJECT_IP_LENGTH;
     return;
   }
   packet->ip_header_length = ip_header_length;
@@ -70,6 +74,8 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
   /* ------------------------- */
 
   /* Check and copy protocol */
+  packet->protocol = ip_header->protocol;
+
   if (ip_header->protocol == TCP)
   {
     strcpy (packet->transport_protocol, "tcp");
@@ -80,7 +86,8 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
   }
   else
   {
-    fprintf (stderr, "Packet's transport protocol is neither TCP nor UDP\n"); fflush (stderr);
+    LOG_DEBUG ("Packet's transport protocol is neither TCP nor UDP\n");
+    packet->reject_reason = REJECT_PROTOCOL;
     return;
   }
   /* ----------------------- */
@@ -101,7 +108,8 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
 
     if (raw_length < MIN_TCP_HEADER_LENGTH)
     {
-      fprintf (stderr, "Packet is shorter than min TCP header length\n"); fflush (stderr);
+      LOG_DEBUG ("Packet is shorter than min TCP header length\n");
+      packet->reject_reason = REJECT_TCP_HEADER;
       return;
     }
 
@@ -128,7 +136,8 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
 
     if (raw_length < MIN_UDP_HEADER_LENGTH)
     {
-      fprintf (stderr, "Packet is shorter than min UDP header length\n"); fflush (stderr);
+      LOG_DEBUG ("Packet is shorter than min UDP header length\n");
+      packet->reject_reason = REJECT_UDP_HEADER;
       return;
     }
 
@@ -146,14 +155,38 @@ void parse_packet (packet_t *packet, int data_link_offset, void *raw, int raw_le
   raw += transport_header_length;
   raw_length -= transport_header_length;
 
+  /* The payload is terminated for the regular expressions of http_request,
+     though contents may match NUL bytes inside it */
   packet->data_length = (size_t) raw_length;
-  packet->data = malloc (packet->data_length);
+  packet->data = malloc (packet->data_length + 1);
 
   memmove (packet->data, raw, packet->data_length);
+  ((char *) packet->data)[packet->data_length] = '\0';
 
   packet->valid = true;
 }
 
+char *reject_reason_name (int reason)
+{
+  switch (reason)
+  {
+  case REJECT_LINK:
+    return "short_link_header";
+  case REJECT_IP_HEADER:
+    return "short_ip_header";
+  case REJECT_IP_LENGTH:
+    return "bad_ip_header_length";
+  case REJECT_PROTOCOL:
+    return "not_tcp_or_udp";
+  case REJECT_TCP_HEADER:
+    return "short_tcp_header";
+  case REJECT_UDP_HEADER:
+    return "short_udp_header";
+  default:
+    return "none";
+  }
+}
+
 uint8_t get_8_bits (uint8_t number, int start, int finish)
 {
   assert (start > 0 && finish > 0);
@@ -3,6 +3,11 @@
 
 #include "structures.h"
 
+/* Why parse_packet left a packet invalid */
+enum {REJECT_NONE = 0, REJECT_LINK, REJECT_IP_HEADER, REJECT_IP_LENGTH,
+      REJECT_PROTOCOL, REJECT_TCP_HEADER, REJECT_UDP_HEADER};
+
 void parse_packet (packet_t *, int, void *, int);
+char *reject_reason_name (int);
 
 #endif
@@ -0,0 +1,443 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "needle.h"
+
+#include "prefilter.h"
+
+#define PATTERN_LENGTH (16) /* longest fast pattern; a longer content gives its rarest part */
+#define MAX_CELLS (1 << 22) /* largest transition table, in states times columns */
+#define REPORT_FLAG (0x80000000U)
+#define SCAN_SEARCHES (8) /* single pattern searches in a payload before scanning for all */
+
+/* Every row with a content gets one fast pattern: among its contents and
+   their parts of PATTERN_LENGTH bytes, the one whose bytes are rarest in
+   traffic by the table below. Any content of a row must be in the payload
+   for the row to match, so looking for one of them first never loses a
+   match. Patterns are case folded, which only lets more rows through to
+   be checked.
+
+   A pattern is searched for on its own the first time a row needs it in
+   a payload, and the answer kept for the other rows with that pattern.
+   A single search reads several bytes per step, so it is cheaper than
+   going through the payload byte by byte. When a payload needs more than
+   SCAN_SEARCHES patterns, all of them are found instead with one run of
+   an automaton built from every pattern. Bytes that are in no pattern
+   share one column, so its table stays small. */
+
+/* How common each byte is in payloads, from 1 (rare) to 9 (very common):
+   text, HTTP headers and zeroed binary fields */
+const char byte_frequency[] =
+  "8222222224611622" "2222222222222222" "9232233333234566" "7776666666534543"
+  "2544454445334455" "4245543333222213" "1857796678247688" "6288864535222211"
+  "2222222222222222" "2222222222222222" "2222222222222222" "2222222222222222"
+  "2222222222222222" "2222222222222222" "2222222222222222" "2222222222222224";
+
+typedef struct candidate_tag
+{
+  uint8_t bytes[PATTERN_LENGTH];
+  int length;
+  int row;
+}
+candidate_t;
+
+uint8_t fold_byte (uint8_t);
+int rarity (uint8_t *, int);
+bool pick_pattern (rule_t *, candidate_t *);
+int compare_candidates (const void *, const void *);
+bool build_automaton (prefilter_t *, candidate_t *, int, int);
+void scan_payload (prefilter_t *, const uint8_t *, size_t);
+
+/* Builds the prefilter of the rows and sets their fast_pattern. Returns
+   NULL when no row has a content. */
+prefilter_t *build_prefilter (rule_t **rows, int number)
+{
+  candidate_t *candidates = (candidate_t *) malloc ((number + 1) * sizeof (candidate_t));
+  if (candidates == NULL)
+  {
+    fprintf (stderr, "Could not allocate the prefilter\n");
+    exit (EXIT_FAILURE);
+  }
+
+  int number_of_candidates = 0;
+
+  for (int i = 0; i < number; i++)
+  {
+    rows[i]->fast_pattern = -1;
+
+    if (pick_pattern (rows[i], &(candidates[number_of_candidates])) == true)
+    {
+      candidates[number_of_candidates++].row = i;
+    }
+  }
+
+  if (number_of_candidates == 0)
+  {
+    free (candidates);
+    return NULL;
+  }
+
+  /* Rows with the same pattern share it */
+  qsort (candidates, number_of_candidates, sizeof (candidate_t), compare_candidates);
+
+  int number_of_patterns = 0;
+  int total_length = 0;
+
+  for (int i = 0; i < number_of_candidates; i++)
+  {
+    if (i == 0 || compare_candidates (&(candidates[i - 1]), &(candidates[i])) != 0)
+    {
+      candidates[number_of_patterns++] = candidates[i];
+      total_length += candidates[i].length;
+    }
+
+    rows[candidates[i].row]->fast_pattern = number_of_patterns - 1;
+  }
+
+  prefilter_t *prefilter = (prefilter_t *) calloc (1, sizeof (prefilter_t));
+  if (prefilter == NULL)
+  {
+    fprintf (stderr, "Could not allocate the prefilter\n");
+    exit (EXIT_FAILURE);
+  }
+
+  prefilter->number_of_patterns = number_of_patterns;
+  prefilter->rows = number_of_candidates;
+  prefilter->bytes = (uint8_t *) malloc (number_of_patterns * PATTERN_LENGTH);
+  prefilter->lengths = (uint8_t *) malloc (number_of_patterns);
+  prefilter->seen = (uint32_t *) calloc (number_of_patterns, sizeof (uint32_t));
+  prefilter->searched = (uint32_t *) calloc (number_of_patterns, sizeof (uint32_t));
+  prefilter->found = (uint32_t *) calloc (number_of_patterns, sizeof (uint32_t));
+
+  if (prefilter->bytes == NULL || prefilter->lengths == NULL || prefilter->seen == NULL ||
+      prefilter->searched == NULL || prefilter->found == NULL)
+  {
+    fprintf (stderr, "Could not allocate the prefilter\n");
+    exit (EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < number_of_patterns; i++)
+  {
+    memcpy (&(prefilter->bytes[i * PATTERN_LENGTH]), candidates[i].bytes, candidates[i].length);
+    prefilter->lengths[i] = (uint8_t) candidates[i].length;
+  }
+
+  if (build_automaton (prefilter, candidates, number_of_patterns, total_length) == false)
+  {
+    fprintf (stderr, "Too many fast patterns (%d) for the automaton, they are only searched for one by one\n",
+             number_of_patterns);
+  }
+
+  free (candidates);
+
+  return prefilter;
+}
+
+uint8_t fold_byte (uint8_t byte)
+{
+  return byte >= 'A' && byte <= 'Z' ? byte | 0x20 : byte;
+}
+
+int rarity (uint8_t *bytes, int length)
+{
+  int sum = 0;
+
+  for (int i = 0; i < length; i++)
+  {
+    sum += 10 - (byte_frequency[bytes[i]] - '0');
+  }
+
+  return sum;
+}
+
+/* The rarest part of any content of the row, folded. False when the row
+   has no content to look for. */
+bool pick_pattern (rule_t *row, candidate_t *candidate)
+{
+  int best = 0;
+
+  for (option_t *option = row->options; option != NULL; option = option->next)
+  {
+    if (option->modifier == true || strcmp (option->name, STRING_CONTENT) != 0)
+    {
+      continue;
+    }
+
+    uint8_t *value = (uint8_t *) option->value;
+    int length = option->value_length;
+    int window = length < PATTERN_LENGTH ? length : PATTERN_LENGTH;
+    uint8_t folded[PATTERN_LENGTH];
+
+    for (int start = 0; start + window <= length && window > 0; start++)
+    {
+      for (int i = 0; i < window; i++)
+      {
+        folded[i] = fold_byte (value[start + i]);
+      }
+
+      int score = rarity (folded, window);
+
+      if (score > best)
+      {
+        best = score;
+        memcpy (candidate->bytes, folded, window);
+        candidate->length = window;
+      }
+    }
+  }
+
+  return best > 0;
+}
+
+int compare_candidates (const void *a, const void *b)
+{
+  const candidate_t *x = (const candidate_t *) a;
+  const candidate_t *y = (const candidate_t *) b;
+
+  if (x->length != y->length)
+  {
+    return x->length < y->length ? -1 : 1;
+  }
+
+  return memcmp (x->bytes, y->bytes, x->length);
+}
+
+/* Trie of the patterns, then failure links in breadth first order, which
+   fill in the missing transitions and the patterns each state ends */
+bool build_automaton (prefilter_t *prefilter, candidate_t *patterns, int number_of_patterns, int total_length)
+{
+  int columns = 1;
+
+  for (int i = 0; i < number_of_patterns; i++)
+  {
+    for (int j = 0; j < patterns[i].length; j++)
+    {
+      uint8_t byte = patterns[i].bytes[j];
+
+      if (prefilter->classes[byte] == 0)
+      {
+        prefilter->classes[byte] = (uint8_t) columns++;
+
+        if (byte >= 'a' && byte <= 'z')
+        {
+          prefilter->classes[byte - 0x20] = prefilter->classes[byte];
+        }
+      }
+    }
+  }
+
+  while ((1 << prefilter->shift) < columns)
+  {
+    prefilter->shift++;
+  }
+
+  int width = 1 << prefilter->shift;
+  int bound = total_length + 1;
+
+  if ((int64_t) bound * width > MAX_CELLS)
+  {
+    return false;
+  }
+
+  int32_t *next = (int32_t *) calloc ((size_t) bound * width, sizeof (int32_t));
+  int32_t *reports = (int32_t *) malloc (bound * sizeof (int32_t));
+  int32_t *failures = (int32_t *) calloc (bound, sizeof (int32_t));
+  int32_t *queue = (int32_t *) malloc (bound * sizeof (int32_t));
+
+  prefilter->suffixes = (int32_t *) malloc (number_of_patterns * sizeof (int32_t));
+
+  if (next == NULL || reports == NULL || failures == NULL || queue == NULL || prefilter->suffixes == NULL)
+  {
+    fprintf (stderr, "Could not allocate the prefilter\n");
+    exit (EXIT_FAILURE);
+  }
+
+  /* In the trie, 0 is no edge: no edge leads back to the root */
+  int states = 1;
+
+  reports[0] = -1;
+
+  for (int i = 0; i < number_of_patterns; i++)
+  {
+    int state = 0;
+
+    for (int j = 0; j < patterns[i].length; j++)
+    {
+      int32_t *edge = &(next[state * width + prefilter->classes[patterns[i].bytes[j]]]);
+
+      if (*edge == 0)
+      {
+        reports[states] = -1;
+        *edge = states++;
+      }
+
+      state = *edge;
+    }
+
+    reports[state] = i;
+  }
+
+  int head = 0, tail = 0;
+
+  for (int c = 0; c < width; c++)
+  {
+    if (next[c] != 0)
+    {
+      queue[tail++] = next[c];
+    }
+  }
+
+  while (head < tail)
+  {
+    int state = queue[head++];
+    int failure = failures[state];
+
+    /* The failure state is shallower, so it is complete already */
+    if (reports[state] >= 0)
+    {
+      prefilter->suffixes[reports[state]] = reports[failure];
+    }
+    else
+    {
+      reports[state] = reports[failure];
+    }
+
+    for (int c = 0; c < width; c++)
+    {
+      int32_t *edge = &(next[state * width + c]);
+
+      if (*edge != 0)
+      {
+        failures[*edge] = next[failure * width + c];
+        queue[tail++] = *edge;
+      }
+      else
+      {
+        *edge = next[failure * width + c];
+      }
+    }
+  }
+
+  /* Transitions hold the row offset of the next state, flagged where a
+     pattern ends, so the scan needs no other load for most bytes */
+  for (int i = 0; i < states * width; i++)
+  {
+    next[i] = (int32_t) (((uint32_t) next[i] << prefilter->shift) | (reports[next[i]] >= 0 ? REPORT_FLAG : 0));
+  }
+
+  prefilter->transitions = (int32_t *) realloc (next, (size_t) states * width * sizeof (int32_t));
+  prefilter->reports = (int32_t *) realloc (reports, states * sizeof (int32_t));
+  prefilter->number_of_states = states;
+
+  free (failures);
+  free (queue);
+
+  return true;
+}
+
+/* Starts a new payload: what was found in the previous one is forgotten */
+void prefilter_start (prefilter_t *prefilter)
+{
+  prefilter->searches = 0;
+  prefilter->scanned = false;
+
+  if (++(prefilter->stamp) == 0)
+  {
+    memset (prefilter->seen, 0, prefilter->number_of_patterns * sizeof (uint32_t));
+    memset (prefilter->searched, 0, prefilter->number_of_patterns * sizeof (uint32_t));
+    memset (prefilter->found, 0, prefilter->number_of_patterns * sizeof (uint32_t));
+    prefilter->stamp = 1;
+  }
+}
+
+/* Whether the pattern is in the payload given since prefilter_start */
+bool prefilter_found (prefilter_t *prefilter, int32_t pattern, const uint8_t *data, size_t length)
+{
+  uint32_t stamp = prefilter->stamp;
+
+  if (prefilter->scanned == false && prefilter->searched[pattern] != stamp)
+  {
+    if (++(prefilter->searches) > SCAN_SEARCHES && prefilter->transitions != NULL)
+    {
+      scan_payload (prefilter, data, length);
+      prefilter->scanned = true;
+    }
+    else
+    {
+      prefilter->searched[pattern] = stamp;
+
+      if (find_needle_nocase (data, length, &(prefilter->bytes[pattern * PATTERN_LENGTH]),
+                              prefilter->lengths[pattern]) != NULL)
+      {
+        prefilter->found[pattern] = stamp;
+      }
+    }
+  }
+
+  if (prefilter->scanned == true)
+  {
+    return prefilter->seen[pattern] == stamp;
+  }
+
+  return prefilter->found[pattern] == stamp;
+}
+
+/* Marks every pattern found in the payload with the current stamp */
+void scan_payload (prefilter_t *prefilter, const uint8_t *data, size_t length)
+{
+  const int32_t *transitions = prefilter->transitions;
+  const uint8_t *classes = prefilter->classes;
+  int shift = prefilter->shift;
+  uint32_t stamp = prefilter->stamp;
+  uint32_t offset = 0;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    offset = (uint32_t) transitions[offset + classes[data[i]]];
+
+    if ((offset & REPORT_FLAG) != 0)
+    {
+      offset &= ~REPORT_FLAG;
+
+      /* Patterns ending inside a pattern already seen were marked with it */
+      for (int32_t p = prefilter->reports[offset >> shift]; p >= 0 && prefilter->seen[p] != stamp;
+           p = prefilter->suffixes[p])
+      {
+        prefilter->seen[p] = stamp;
+      }
+    }
+  }
+}
+
+void print_prefilter (rule_t *rules)
+{
+  if (rules == NULL || rules->storage->prefilter == NULL)
+  {
+    return;
+  }
+
+  prefilter_t *prefilter = rules->storage->prefilter;
+
+  printf ("Prefilter: %d rows are only checked when their fast pattern is in the payload, "
+          "%d patterns in %d states\n\n", prefilter->rows, prefilter->number_of_patterns,
+          prefilter->number_of_states);
+}
+
+void free_prefilter (prefilter_t *prefilter)
+{
+  if (prefilter == NULL)
+  {
+    return;
+  }
+
+  free (prefilter->transitions);
+  free (prefilter->reports);
+  free (prefilter->suffixes);
+  free (prefilter->bytes);
+  free (prefilter->lengths);
+  free (prefilter->seen);
+  free (prefilter->searched);
+  free (prefilter->found);
+  free (prefilter);
+}
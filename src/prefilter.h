@@ -0,0 +1,12 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include "structures.h"
+
+prefilter_t *build_prefilter (rule_t **, int);
+void prefilter_start (prefilter_t *);
+bool prefilter_found (prefilter_t *, int32_t, const uint8_t *, size_t);
+void print_prefilter (rule_t *);
+void free_prefilter (prefilter_t *);
+
+#endif
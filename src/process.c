@@ -5,34 +5,177 @@
 #include "packet.h"
 #include "check.h"
 #include "output.h"
+#include "recorder.h"
+#include "export.h"
+#include "signals.h"
+#include "profile.h"
+#include "stages.h"
+#include "stats.h"
+#include "epoch.h"
+#include "scan.h"
+#include "rate.h"
+#include "talkers.h"
 
 #include "process.h"
 
+void raise_alert (context_t *, rule_t *, packet_t *, const struct pcap_pkthdr *);
+
 void process_packet (u_char *arg, const struct pcap_pkthdr *pkthdr,
                      const u_char *raw)
 {
-  rule_t *rules = *((rule_t **) arg);
+  context_t *context = (context_t *) arg;
+
+  STAGE_BEGIN (start);
 
-  int data_link_offset = *((int *) ((void *) arg + sizeof (rule_t *)));
+  counters_t *counters = &(context->counters);
 
   packet_t packet;
 
-  parse_packet (&packet, data_link_offset, (void *) raw, (int) pkthdr->caplen);
+  parse_packet (&packet, context->data_link_offset, (void *) raw, (int) pkthdr->caplen);
+
+  COUNT (counters->packets, 1);
 
   if (packet.valid == true)
   {
-    rule_t *match_rule = check_with_rules (&packet, rules);
+    COUNT (counters->parsed, 1);
+  }
+  else
+  {
+    COUNT (counters->rejected[packet.reject_reason], 1);
+  }
+
+  recorder_add (context->recorder, pkthdr, raw, &packet);
+
+  STAGE_NEXT (STAGE_PARSE, start);
+
+  /* The rule set may be replaced at any time, but not freed before this
+     packet is done with it */
+  epoch_enter ();
+
+  rule_t *rules = __atomic_load_n (&(context->rules), __ATOMIC_ACQUIRE);
+
+  if (rules != context->active_rules)
+  {
+    context->active_rules = rules;
+
+    if (thread_profile != NULL)
+    {
+      profile_reset (rules);
+    }
+  }
+
+  if (dump_requested)
+  {
+    dump_requested = 0;
+    recorder_dump (context->recorder, true);
+  }
+
+  if (profile_requested)
+  {
+    profile_requested = 0;
+    profile_report (rules, context->settings->profile_top);
+  }
+
+  if (packet.valid == true)
+  {
+    rule_t *match_rule = check_with_rules (&packet, rules, counters);
+
+    STAGE_CHECKED (start);
+
+    if (thread_talkers != NULL)
+    {
+      talkers_add (thread_talkers, &packet, pkthdr);
+    }
+
+    rule_t *alerts[3];
+    int number_of_alerts = 0;
+
+    if (context->scans != NULL)
+    {
+      number_of_alerts = scan_packet (context->scans, &packet, pkthdr, counters, alerts);
+    }
+
+    if (context->rates != NULL)
+    {
+      alerts[number_of_alerts] = rate_packet (context->rates, &packet, pkthdr, counters);
+
+      if (alerts[number_of_alerts] != NULL)
+      {
+        number_of_alerts++;
+      }
+    }
+
+    /* A packet raising several alerts is dumped and exported only once */
+    if (match_rule != NULL || number_of_alerts > 0)
+    {
+      recorder_dump_alert (context->recorder, pkthdr);
+    }
 
     if (match_rule != NULL)
     {
-      print_output (match_rule, &packet);
+      COUNT (counters->matched, 1);
+      COUNT (match_rule->hits, 1);
+
+      raise_alert (context, match_rule, &packet, pkthdr);
+
+      STAGE_LATENCY (pkthdr);
+    }
+
+    else if (context->settings->sample_rate > 0)
+    {
+      context->benign_packets++;
+
+      if (context->benign_packets % context->settings->sample_rate == 0)
+      {
+        print_packet (&packet);
+      }
+    }
+
+    for (int i = 0; i < number_of_alerts; i++)
+    {
+      COUNT (alerts[i]->hits, 1);
+      raise_alert (context, alerts[i], &packet, pkthdr);
     }
 
-    else
+    if ((match_rule != NULL || number_of_alerts > 0) && context->exporter != NULL)
     {
-      print_packet (&packet);
+      exporter_add_match (context->exporter, context->recorder,
+                          context->settings->export_context, pkthdr, raw);
     }
 
+    STAGE_NEXT (STAGE_OUTPUT, start);
+
     free (packet.data);
   }
+
+  epoch_exit ();
+
+  stats_tick (context->stats, pkthdr);
+
+  stages_tick (context->settings->stage_interval);
+
+  STAGE_END ();
+}
+
+/* Prints and logs the packet as matched by rule, which is a rule of the
+   set or the rule of a detector */
+void raise_alert (context_t *context, rule_t *rule, packet_t *packet,
+                  const struct pcap_pkthdr *pkthdr)
+{
+  counters_t *counters = &(context->counters);
+
+  print_output (rule, packet);
+
+  COUNT (counters->alerts, 1);
+
+  if (context->alert_log != NULL)
+  {
+    int written = log_alert (context->alert_log, rule, packet, pkthdr);
+
+    /* A compressed log refuses the whole line when it cannot keep it */
+    if (written > 0)
+    {
+      COUNT (counters->output_bytes, written);
+    }
+  }
 }
@@ -0,0 +1,255 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "output.h"
+
+#include "profile.h"
+
+/* Each thread counts into its own profile, so the packet path needs no
+   atomics. The list of profiles is only touched when a thread starts
+   profiling and when a report is printed. */
+
+__thread profile_t *thread_profile = NULL;
+
+profile_t *all_profiles = NULL;
+pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void size_profile (profile_t *, rule_t *);
+
+/* Creates the calling thread's profile for the given rules */
+profile_t *profile_init (rule_t *rules)
+{
+  profile_t *profile = (profile_t *) calloc (1, sizeof (profile_t));
+
+  size_profile (profile, rules);
+
+  pthread_mutex_lock (&profiles_mutex);
+  profile->next = all_profiles;
+  all_profiles = profile;
+  pthread_mutex_unlock (&profiles_mutex);
+
+  thread_profile = profile;
+
+  return profile;
+}
+
+/* Ids of a reloaded rule set mean other rules, so the calling thread's
+   costs start over, sized for the new set */
+void profile_reset (rule_t *rules)
+{
+  profile_t *profile = thread_profile;
+
+  cost_t *old_rules = profile->rules;
+  cost_t *old_options = profile->options;
+
+  pthread_mutex_lock (&profiles_mutex);
+  size_profile (profile, rules);
+  pthread_mutex_unlock (&profiles_mutex);
+
+  free (old_rules);
+  free (old_options);
+}
+
+void size_profile (profile_t *profile, rule_t *rules)
+{
+  profile->number_of_rules = 0;
+  profile->number_of_options = 0;
+
+  for (rule_t *cur_rule = rules; cur_rule != NULL; cur_rule = cur_rule->next)
+  {
+    if (cur_rule->id >= profile->number_of_rules)
+    {
+      profile->number_of_rules = cur_rule->id + 1;
+    }
+
+    for (option_t *cur_option = cur_rule->options; cur_option != NULL; cur_option = cur_option->next)
+    {
+      if (cur_option->id >= profile->number_of_options)
+      {
+        profile->number_of_options = cur_option->id + 1;
+      }
+    }
+  }
+
+  profile->rules = (cost_t *) calloc (profile->number_of_rules + 1, sizeof (cost_t));
+  profile->options = (cost_t *) calloc (profile->number_of_options + 1, sizeof (cost_t));
+}
+
+typedef struct ranked_tag
+{
+  int id;
+  cost_t cost;
+}
+ranked_t;
+
+void merge_costs (ranked_t *, int, bool);
+int compare_ranked (const void *, const void *);
+void print_ranked (ranked_t *, int, int, char *, rule_t **, option_t **);
+
+/* Prints the top rules and options by total cycles, summed over all threads */
+void profile_report (rule_t *rules_list, int top)
+{
+  pthread_mutex_lock (&profiles_mutex);
+
+  if (all_profiles == NULL)
+  {
+    pthread_mutex_unlock (&profiles_mutex);
+    return;
+  }
+
+  int number_of_rules = 0;
+  int number_of_options = 0;
+
+  for (profile_t *profile = all_profiles; profile != NULL; profile = profile->next)
+  {
+    if (profile->number_of_rules > number_of_rules)
+    {
+      number_of_rules = profile->number_of_rules;
+    }
+
+    if (profile->number_of_options > number_of_options)
+    {
+      number_of_options = profile->number_of_options;
+    }
+  }
+
+  ranked_t *rules = (ranked_t *) calloc (number_of_rules + 1, sizeof (ranked_t));
+  ranked_t *options = (ranked_t *) calloc (number_of_options + 1, sizeof (ranked_t));
+
+  merge_costs (rules, number_of_rules, true);
+  merge_costs (options, number_of_options, false);
+
+  pthread_mutex_unlock (&profiles_mutex);
+
+  rule_t **rules_by_id = (rule_t **) calloc (number_of_rules + 1, sizeof (rule_t *));
+  option_t **options_by_id = (option_t **) calloc (number_of_options + 1, sizeof (option_t *));
+  rule_t **rules_by_option = (rule_t **) calloc (number_of_options + 1, sizeof (rule_t *));
+
+  for (rule_t *cur_rule = rules_list; cur_rule != NULL; cur_rule = cur_rule->next)
+  {
+    if (cur_rule->id < number_of_rules)
+    {
+      rules_by_id[cur_rule->id] = cur_rule;
+    }
+
+    for (option_t *cur_option = cur_rule->options; cur_option != NULL; cur_option = cur_option->next)
+    {
+      if (cur_option->id < number_of_options)
+      {
+        options_by_id[cur_option->id] = cur_option;
+        rules_by_option[cur_option->id] = cur_rule;
+      }
+    }
+  }
+
+  qsort (rules, number_of_rules, sizeof (ranked_t), compare_ranked);
+  qsort (options, number_of_options, sizeof (ranked_t), compare_ranked);
+
+  print_ranked (rules, number_of_rules, top, "rules", rules_by_id, NULL);
+  print_ranked (options, number_of_options, top, "options", rules_by_option, options_by_id);
+
+  free (rules_by_id);
+  free (options_by_id);
+  free (rules_by_option);
+  free (rules);
+  free (options);
+}
+
+void merge_costs (ranked_t *ranked, int number, bool rules)
+{
+  for (int i = 0; i < number; i++)
+  {
+    ranked[i].id = i;
+  }
+
+  for (profile_t *profile = all_profiles; profile != NULL; profile = profile->next)
+  {
+    cost_t *costs = rules == true ? profile->rules : profile->options;
+    int own = rules == true ? profile->number_of_rules : profile->number_of_options;
+
+    for (int i = 0; i < number && i < own; i++)
+    {
+      ranked[i].cost.checks += costs[i].checks;
+      ranked[i].cost.matches += costs[i].matches;
+      ranked[i].cost.cycles += costs[i].cycles;
+
+      if (costs[i].max_cycles > ranked[i].cost.max_cycles)
+      {
+        ranked[i].cost.max_cycles = costs[i].max_cycles;
+      }
+    }
+  }
+}
+
+int compare_ranked (const void *a, const void *b)
+{
+  uint64_t cycles_a = ((ranked_t *) a)->cost.cycles;
+  uint64_t cycles_b = ((ranked_t *) b)->cost.cycles;
+
+  if (cycles_a == cycles_b)
+  {
+    return 0;
+  }
+
+  return cycles_a > cycles_b ? -1 : 1;
+}
+
+void print_ranked (ranked_t *ranked, int number, int top, char *what,
+                   rule_t **rules_by_id, option_t **options_by_id)
+{
+  uint64_t total = 0;
+
+  for (int i = 0; i < number; i++)
+  {
+    total += ranked[i].cost.cycles;
+  }
+
+  if (top > number)
+  {
+    top = number;
+  }
+
+  printf ("Top %d of %d %s by total cycles\n", top, number, what);
+  printf ("%6s %12s %12s %12s %12s %16s %7s  %s\n",
+          "rule", "checks", "matches", "avg cycles", "max cycles", "total cycles", "total", what);
+
+  /* Ids with no rule in the current set are skipped without taking a
+     place in the top */
+  int printed = 0;
+
+  for (int i = 0; i < number && printed < top; i++)
+  {
+    cost_t *cost = &(ranked[i].cost);
+
+    rule_t *rule = rules_by_id[ranked[i].id];
+    option_t *option = options_by_id != NULL ? options_by_id[ranked[i].id] : NULL;
+
+    if (rule == NULL)
+    {
+      continue;
+    }
+
+    printed++;
+
+    printf ("%6d %12lu %12lu %12lu %12lu %16lu %6.2f%%  ",
+            rule->id + 1,
+            (long unsigned) cost->checks,
+            (long unsigned) cost->matches,
+            (long unsigned) (cost->checks > 0 ? cost->cycles / cost->checks : 0),
+            (long unsigned) cost->max_cycles,
+            (long unsigned) cost->cycles,
+            total > 0 ? 100.0 * (double) cost->cycles / (double) total : 0.0);
+
+    if (option != NULL)
+    {
+      printf ("%s: ", option->name); print_value (option); printf ("\n");
+    }
+    else
+    {
+      printf ("%.*s\n", (int) strcspn (rule->str, "\r\n"), rule->str);
+    }
+  }
+
+  printf ("\n");
+}
@@ -0,0 +1,12 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "structures.h"
+
+extern __thread profile_t *thread_profile;
+
+profile_t *profile_init (rule_t *);
+void profile_reset (rule_t *);
+void profile_report (rule_t *, int);
+
+#endif
@@ -0,0 +1,124 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "queue.h"
+
+/* Entries are a 64 bit length followed by the data, padded to 8 bytes.
+   An entry never wraps around the end of the buffer: a length of
+   WRAP_MARKER tells the consumer to continue at the start. */
+
+#define ALIGNMENT (8)
+#define WRAP_MARKER (UINT64_MAX)
+
+uint64_t entry_size (uint64_t);
+
+queue_t *queue_init (uint64_t size)
+{
+  uint64_t rounded = ALIGNMENT;
+
+  while (rounded < size)
+  {
+    rounded <<= 1;
+  }
+
+  queue_t *queue = (queue_t *) malloc (sizeof (queue_t));
+
+  queue->buffer = (uint8_t *) malloc (rounded);
+  if (queue->buffer == NULL)
+  {
+    fprintf (stderr, "Could not allocate queue of %lu bytes\n", (long unsigned) rounded);
+    exit (EXIT_FAILURE);
+  }
+
+  queue->size = rounded;
+  queue->head = 0;
+  queue->tail = 0;
+  queue->reserved = 0;
+
+  return queue;
+}
+
+uint64_t entry_size (uint64_t length)
+{
+  return sizeof (uint64_t) + ((length + ALIGNMENT - 1) & ~((uint64_t) ALIGNMENT - 1));
+}
+
+/* Producer side: returns space for length bytes, or NULL if the queue is full */
+void *queue_reserve (queue_t *queue, uint64_t length)
+{
+  uint64_t needed = entry_size (length);
+  uint64_t tail = __atomic_load_n (&(queue->tail), __ATOMIC_ACQUIRE);
+  uint64_t offset = queue->head & (queue->size - 1);
+  uint64_t padding = 0;
+
+  if (offset + needed > queue->size)
+  {
+    padding = queue->size - offset;
+  }
+
+  if (queue->head + padding + needed - tail > queue->size)
+  {
+    return NULL;
+  }
+
+  /* The consumer sees the marker and the entry together, once head is
+     moved past both in queue_commit */
+  if (padding > 0)
+  {
+    *((uint64_t *) (queue->buffer + offset)) = WRAP_MARKER;
+    offset = 0;
+  }
+
+  *((uint64_t *) (queue->buffer + offset)) = length;
+  queue->reserved = padding + needed;
+
+  return queue->buffer + offset + sizeof (uint64_t);
+}
+
+void queue_commit (queue_t *queue)
+{
+  __atomic_store_n (&(queue->head), queue->head + queue->reserved, __ATOMIC_RELEASE);
+  queue->reserved = 0;
+}
+
+/* Consumer side: returns the oldest entry, or NULL if the queue is empty */
+void *queue_peek (queue_t *queue, uint64_t *length)
+{
+  uint64_t head = __atomic_load_n (&(queue->head), __ATOMIC_ACQUIRE);
+
+  while (queue->tail != head)
+  {
+    uint64_t offset = queue->tail & (queue->size - 1);
+    uint64_t value = *((uint64_t *) (queue->buffer + offset));
+
+    if (value == WRAP_MARKER)
+    {
+      __atomic_store_n (&(queue->tail), queue->tail + queue->size - offset, __ATOMIC_RELEASE);
+      continue;
+    }
+
+    *length = value;
+
+    return queue->buffer + offset + sizeof (uint64_t);
+  }
+
+  return NULL;
+}
+
+void queue_release (queue_t *queue, uint64_t length)
+{
+  __atomic_store_n (&(queue->tail), queue->tail + entry_size (length), __ATOMIC_RELEASE);
+}
+
+uint64_t queue_used (queue_t *queue)
+{
+  return __atomic_load_n (&(queue->head), __ATOMIC_RELAXED) -
+         __atomic_load_n (&(queue->tail), __ATOMIC_RELAXED);
+}
+
+void queue_free (queue_t *queue)
+{
+  free (queue->buffer);
+  free (queue);
+}
@@ -0,0 +1,14 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "structures.h"
+
+queue_t *queue_init (uint64_t);
+void *queue_reserve (queue_t *, uint64_t);
+void queue_commit (queue_t *);
+void *queue_peek (queue_t *, uint64_t *);
+void queue_release (queue_t *, uint64_t);
+uint64_t queue_used (queue_t *);
+void queue_free (queue_t *);
+
+#endif
@@ -0,0 +1,174 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "stats.h"
+#include "output.h"
+
+#include "rate.h"
+
+#define TCP_SYN (0x02)
+#define TCP_ACK (0x10)
+#define MICROSECONDS (1000000)
+
+/* Rates are counted per key in count-min sketches: a key adds one to a
+   counter in each row and its count is the smallest of them, which is
+   never below the true count and above it by at most e / RATE_WIDTH of
+   all the packets of the second, except with probability e^-RATE_DEPTH.
+   Only the counters holding the smallest value are incremented
+   (conservative update), which keeps them closer still. Memory and the
+   work per packet do not depend on the number of keys. */
+
+bool sketch_add (rate_sketch_t *, uint32_t, const struct timeval *);
+void advance_second (rate_sketch_t *, int64_t);
+void init_sketch (rate_sketch_t *, int, char *);
+
+/* Odd multipliers of the row hashes, and of the alerted bitmap */
+uint32_t row_multipliers[RATE_DEPTH + 1] = {
+  0x9E3779B1U, 0x85EBCA77U, 0xC2B2AE3DU, 0x27D4EB2FU, 0x165667B1U
+};
+
+rate_detector_t *rate_init (settings_t *settings)
+{
+  rate_detector_t *detector = (rate_detector_t *) calloc (1, sizeof (rate_detector_t));
+  if (detector == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rate sketches\n");
+    exit (EXIT_FAILURE);
+  }
+
+  init_sketch (&(detector->syn), settings->syn_rate, "SYN flood: %d SYN packets per second to one destination");
+  init_sketch (&(detector->udp), settings->udp_rate, "UDP flood: %d packets per second from one source");
+
+  return detector;
+}
+
+/* Counts a packet and returns the rule to alert with when its key is at
+   the threshold and was not alerted for in this second, NULL otherwise */
+rule_t *rate_packet (rate_detector_t *detector, packet_t *packet, const struct pcap_pkthdr *pkthdr,
+                     counters_t *counters)
+{
+  rate_sketch_t *sketch = NULL;
+  uint32_t key = 0;
+
+  if (packet->protocol == IPPROTO_TCP)
+  {
+    if ((packet->flags & (TCP_SYN | TCP_ACK)) == TCP_SYN)
+    {
+      sketch = &(detector->syn);
+      key = packet->dest_IP;
+    }
+  }
+  else
+  {
+    sketch = &(detector->udp);
+    key = packet->source_IP;
+  }
+
+  if (sketch == NULL || sketch->threshold == 0 || sketch_add (sketch, key, &(pkthdr->ts)) == false)
+  {
+    return NULL;
+  }
+
+  COUNT (counters->rate_alerts, 1);
+
+  return &(sketch->rule);
+}
+
+void rate_free (rate_detector_t *detector)
+{
+  free (detector);
+}
+
+/* Adds a packet of key at time ts. Returns true if the rate of key just
+   reached the threshold for the first time in this second. */
+bool sketch_add (rate_sketch_t *sketch, uint32_t key, const struct timeval *ts)
+{
+  if ((int64_t) ts->tv_sec > sketch->second)
+  {
+    advance_second (sketch, (int64_t) ts->tv_sec);
+  }
+
+  uint32_t *current = sketch->counts[sketch->second & 1];
+  uint32_t *previous = sketch->counts[(sketch->second + 1) & 1];
+
+  /* Millionths of the previous second within one second of the packet */
+  uint64_t weight = (uint64_t) (MICROSECONDS - ts->tv_usec);
+
+  key ^= key >> 16;
+
+  size_t cells[RATE_DEPTH];
+  uint32_t smallest = UINT32_MAX;
+
+  for (int i = 0; i < RATE_DEPTH; i++)
+  {
+    uint32_t hash = key * row_multipliers[i];
+
+    cells[i] = (size_t) i * RATE_WIDTH + (size_t) (((uint64_t) hash * RATE_WIDTH) >> 32);
+
+    if (current[cells[i]] < smallest)
+    {
+      smallest = current[cells[i]];
+    }
+  }
+
+  uint64_t rate = UINT64_MAX;
+
+  for (int i = 0; i < RATE_DEPTH; i++)
+  {
+    if (current[cells[i]] == smallest)
+    {
+      current[cells[i]]++;
+    }
+
+    uint64_t row_rate = current[cells[i]] + previous[cells[i]] * weight / MICROSECONDS;
+
+    if (row_rate < rate)
+    {
+      rate = row_rate;
+    }
+  }
+
+  if (rate < sketch->threshold)
+  {
+    return false;
+  }
+
+  /* Two keys sharing a bit only lose the second alert of the second */
+  uint32_t bit = (uint32_t) (((uint64_t) (key * row_multipliers[RATE_DEPTH]) * RATE_ALERTED_BITS) >> 32);
+  uint64_t mask = 1ULL << (bit % 64);
+
+  if ((sketch->alerted[bit / 64] & mask) != 0)
+  {
+    return false;
+  }
+
+  sketch->alerted[bit / 64] |= mask;
+
+  return true;
+}
+
+/* Makes second the current one. The counts of the second before it are
+   kept as the previous ones, older counts are dropped. */
+void advance_second (rate_sketch_t *sketch, int64_t second)
+{
+  memset (sketch->counts[second & 1], 0, sizeof (sketch->counts[0]));
+
+  if (second - sketch->second > 1)
+  {
+    memset (sketch->counts[(second + 1) & 1], 0, sizeof (sketch->counts[0]));
+  }
+
+  memset (sketch->alerted, 0, sizeof (sketch->alerted));
+
+  sketch->second = second;
+}
+
+void init_sketch (rate_sketch_t *sketch, int threshold, char *format)
+{
+  sketch->threshold = (uint32_t) threshold;
+
+  snprintf (sketch->text, LINE_LENGTH, format, threshold);
+
+  init_alert_rule (&(sketch->rule), &(sketch->message), sketch->text);
+}
@@ -0,0 +1,10 @@
+#ifndef RATE_H
+#define RATE_H
+
+#include "structures.h"
+
+rate_detector_t *rate_init (settings_t *);
+rule_t *rate_packet (rate_detector_t *, packet_t *, const struct pcap_pkthdr *, counters_t *);
+void rate_free (rate_detector_t *);
+
+#endif
@@ -0,0 +1,144 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "recorder.h"
+
+recorder_t *recorder_init (int size)
+{
+  uint64_t rounded = 1;
+
+  while (rounded < (uint64_t) size)
+  {
+    rounded <<= 1;
+  }
+
+  recorder_t *recorder = (recorder_t *) malloc (sizeof (recorder_t));
+
+  recorder->records = (record_t *) calloc (rounded, sizeof (record_t));
+  if (recorder->records == NULL)
+  {
+    fprintf (stderr, "Could not allocate flight recorder of %lu packets\n", (long unsigned) rounded);
+    exit (EXIT_FAILURE);
+  }
+
+  recorder->mask = rounded - 1;
+  recorder->head = 0;
+  recorder->dumped = 0;
+  recorder->next_alert_dump = 0;
+
+  return recorder;
+}
+
+/* Called for every captured packet, so it only copies: the summary is
+   formatted when the ring is dumped */
+void recorder_add (recorder_t *recorder, const struct pcap_pkthdr *pkthdr,
+                   const u_char *raw, packet_t *packet)
+{
+  record_t *record = &(recorder->records[recorder->head & recorder->mask]);
+
+  record->header = *pkthdr;
+
+  record->exported = false;
+
+  record->valid = packet->valid;
+  if (packet->valid == true)
+  {
+    record->tcp = packet->transport_protocol[0] == 't';
+    record->flags = packet->flags;
+    record->source_IP = packet->source_IP;
+    record->dest_IP = packet->dest_IP;
+    record->source_port = packet->source_port;
+    record->dest_port = packet->dest_port;
+  }
+
+  record->raw_length = pkthdr->caplen < RECORD_LENGTH ? pkthdr->caplen : RECORD_LENGTH;
+  memcpy (record->raw, raw, record->raw_length);
+
+  recorder->head++;
+}
+
+void print_record (record_t *);
+
+/* Prints the records that were not dumped yet, or the whole ring if all is true */
+void recorder_dump (recorder_t *recorder, bool all)
+{
+  uint64_t size = recorder->mask + 1;
+  uint64_t first = all == true ? 0 : recorder->dumped;
+
+  if (recorder->head > size && first < recorder->head - size)
+  {
+    first = recorder->head - size;
+  }
+
+  if (first == recorder->head)
+  {
+    return;
+  }
+
+  printf ("Flight recorder: %lu packets\n", (long unsigned) (recorder->head - first));
+
+  for (uint64_t i = first; i < recorder->head; i++)
+  {
+    print_record (&(recorder->records[i & recorder->mask]));
+  }
+
+  printf ("\n");
+
+  recorder->dumped = recorder->head;
+}
+
+/* Called by the capture thread on an alert: dumps like recorder_dump, but
+   at most once every ALERT_DUMP_INTERVAL seconds of packet time, so a burst
+   of alerts does not print the ring over and over */
+void recorder_dump_alert (recorder_t *recorder, const struct pcap_pkthdr *pkthdr)
+{
+  if ((int64_t) pkthdr->ts.tv_sec < recorder->next_alert_dump)
+  {
+    return;
+  }
+
+  recorder->next_alert_dump = (int64_t) pkthdr->ts.tv_sec + ALERT_DUMP_INTERVAL;
+
+  recorder_dump (recorder, false);
+}
+
+void print_record (record_t *record)
+{
+  printf ("\t|-%ld.%06ld ", (long) record->header.ts.tv_sec, (long) record->header.ts.tv_usec);
+
+  if (record->valid == false)
+  {
+    printf ("unparsed, %u bytes\n", (unsigned) record->header.len);
+    return;
+  }
+
+  char source_ip[INET_ADDRSTRLEN];
+  char dest_ip[INET_ADDRSTRLEN];
+
+  struct in_addr address;
+
+  address.s_addr = htonl (record->source_IP);
+  inet_ntop (AF_INET, (void *) &address, source_ip, INET_ADDRSTRLEN);
+
+  address.s_addr = htonl (record->dest_IP);
+  inet_ntop (AF_INET, (void *) &address, dest_ip, INET_ADDRSTRLEN);
+
+  printf ("%s %s:%d -> %s:%d",
+          record->tcp == true ? STRING_TCP : "udp",
+          source_ip, (int) record->source_port,
+          dest_ip, (int) record->dest_port);
+
+  if (record->tcp == true)
+  {
+    printf (" flags 0x%02x", (unsigned) record->flags);
+  }
+
+  printf (", %u bytes\n", (unsigned) record->header.len);
+}
+
+void recorder_free (recorder_t *recorder)
+{
+  free (recorder->records);
+  free (recorder);
+}
@@ -0,0 +1,12 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "structures.h"
+
+recorder_t *recorder_init (int);
+void recorder_add (recorder_t *, const struct pcap_pkthdr *, const u_char *, packet_t *);
+void recorder_dump (recorder_t *, bool);
+void recorder_dump_alert (recorder_t *, const struct pcap_pkthdr *);
+void recorder_free (recorder_t *);
+
+#endif
@@ -0,0 +1,184 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "rules.h"
+#include "cache.h"
+#include "epoch.h"
+#include "signals.h"
+#include "analysis.h"
+#include "order.h"
+#include "native.h"
+#include "prefilter.h"
+
+#include "reload.h"
+
+#define RELOAD_POLL (100000) /* microseconds */
+
+/* The thread also replaces the ordering of the rules every order_interval
+   seconds when asked to; see order.c.
+
+   A reload parses the rule file into a new set while the capture thread
+   keeps matching with the current one. Rules whose text did not change
+   are copied from the current set rather than parsed again. The new set
+   is published with a single pointer exchange, and the old one is freed
+   once no reader can still be using it. A file that does not parse
+   leaves the current set in place. */
+
+void *reload_thread (void *);
+void reload_rules (reloader_t *);
+int number_of_rules (rule_t *);
+double milliseconds_between (struct timespec *, struct timespec *);
+
+reloader_t *reloader_init (context_t *context)
+{
+  reloader_t *reloader = (reloader_t *) calloc (1, sizeof (reloader_t));
+  if (reloader == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule reloader\n");
+    exit (EXIT_FAILURE);
+  }
+
+  reloader->context = context;
+
+  if (pthread_create (&(reloader->thread), NULL, reload_thread, reloader) != 0)
+  {
+    fprintf (stderr, "Could not start the reload thread\n");
+    exit (EXIT_FAILURE);
+  }
+
+  return reloader;
+}
+
+void *reload_thread (void *arg)
+{
+  reloader_t *reloader = (reloader_t *) arg;
+  int order_interval = reloader->context->settings->order_interval;
+
+  reloader->last_ordering = time (NULL);
+
+  while (__atomic_load_n (&(reloader->stop), __ATOMIC_ACQUIRE) == false)
+  {
+    if (reload_requested)
+    {
+      reload_requested = 0;
+      reload_rules (reloader);
+      reloader->last_ordering = time (NULL);
+    }
+
+    if (order_interval > 0 && time (NULL) - reloader->last_ordering >= order_interval)
+    {
+      reloader->orderings += order_rules (reloader->context->rules) == true ? 1 : 0;
+      reloader->last_ordering = time (NULL);
+    }
+
+    usleep (RELOAD_POLL);
+  }
+
+  return NULL;
+}
+
+void reload_rules (reloader_t *reloader)
+{
+  context_t *context = reloader->context;
+  settings_t *settings = context->settings;
+
+  struct timespec start, parsed, published, synchronized, finish;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  /* Only this thread replaces the rules, so they stay valid here */
+  rule_t *current = context->rules;
+  rule_t *rules;
+  rule_reuse_t reuse;
+  bool loaded;
+
+  memset (&reuse, 0, sizeof (rule_reuse_t));
+
+  if (settings->rule_cache != NULL)
+  {
+    loaded = read_cached_rules (settings->rules_filename, settings->rule_cache, current, &rules, &reuse);
+  }
+  else
+  {
+    loaded = read_rules (settings->rules_filename, current, &rules, &reuse);
+  }
+
+  if (loaded == false)
+  {
+    reloader->failures++;
+    fprintf (stderr, "Rule reload failed, still matching with the previous rules\n");
+    return;
+  }
+
+  if (settings->native_rules == true)
+  {
+    compile_rules (rules);
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &parsed);
+
+  rule_t *old_rules = __atomic_exchange_n (&(context->rules), rules, __ATOMIC_SEQ_CST);
+
+  clock_gettime (CLOCK_MONOTONIC, &published);
+
+  epoch_synchronize ();
+
+  clock_gettime (CLOCK_MONOTONIC, &synchronized);
+
+  int old_number = number_of_rules (old_rules);
+
+  free_rules (old_rules);
+
+  clock_gettime (CLOCK_MONOTONIC, &finish);
+
+  reloader->reloads++;
+
+  printf ("Rules reloaded from %s: %d rules, previously %d\n", settings->rules_filename,
+          number_of_rules (rules), old_number);
+
+  if (reuse.reused + reuse.parsed > 0)
+  {
+    printf ("  %d reused, %d parsed, %d removed%s\n", reuse.reused, reuse.parsed, reuse.removed,
+            reuse.rebuilt == true ? ", most lines changed so the rest was parsed" : "");
+  }
+  printf ("  %-16s%10.3f ms\n", "parse", milliseconds_between (&start, &parsed));
+  printf ("  %-16s%10.3f ms\n", "publish", milliseconds_between (&parsed, &published));
+  printf ("  %-16s%10.3f ms\n", "grace period", milliseconds_between (&published, &synchronized));
+  printf ("  %-16s%10.3f ms\n", "free", milliseconds_between (&synchronized, &finish));
+  printf ("  %-16s%10.3f ms\n\n", "total", milliseconds_between (&start, &finish));
+  print_analysis (rules);
+  print_prefilter (rules);
+  fflush (stdout);
+}
+
+int number_of_rules (rule_t *rules)
+{
+  return rules != NULL ? rules->storage->analysis.rules : 0;
+}
+
+double milliseconds_between (struct timespec *start, struct timespec *finish)
+{
+  return (double) (finish->tv_sec - start->tv_sec) * 1e3 +
+         (double) (finish->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Stops the thread. A reload in progress is finished first. */
+void reloader_close (reloader_t *reloader)
+{
+  __atomic_store_n (&(reloader->stop), true, __ATOMIC_RELEASE);
+
+  pthread_join (reloader->thread, NULL);
+
+  if (reloader->reloads > 0 || reloader->failures > 0)
+  {
+    printf ("Rules reloaded %d times, %d reloads failed\n", reloader->reloads, reloader->failures);
+  }
+
+  if (reloader->orderings > 0)
+  {
+    printf ("Rules reordered %d times\n", reloader->orderings);
+  }
+
+  free (reloader);
+}
@@ -0,0 +1,9 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "structures.h"
+
+reloader_t *reloader_init (context_t *);
+void reloader_close (reloader_t *);
+
+#endif
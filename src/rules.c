@@ -2,125 +2,973 @@
 #include "definitions.h"
 #include "structures.h"
 
-#include "subreg.h"
+#include "arena.h"
+#include "native.h"
+#include "prefilter.h"
 
 #include "rules.h"
+#include "analysis.h"
 
 #define MAX_32 (0xFFFFFFFF)
 #define MAX_16 (0xFFFF)
 
-enum {WHOLE = 0, PROTOCOL, SOURCE_IP, SOURCE_PORT, DEST_IP, DEST_PORT};
+#define WORD_CHARACTERS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_"
+#define IP_CHARACTERS "0123456789./"
+#define PORT_CHARACTERS "0123456789:,"
+#define NUMBER_CHARACTERS "-0123456789"
 
-void set_ranges (rule_t *);
+#define SPACE_CHARACTERS " \t\n\v\f\r"
 
-rule_t *get_rules (char *filename)
+#define REUSE_PROBE (256) /* lines looked up before deciding to stop */
+#define MAX_WINDOW (0x1000000) /* largest offset, depth, distance or within */
+
+/* Single pass over each line of the rule file:
+
+     alert PROTOCOL IP PORT -> IP PORT [(NAME: VALUE; ...)]
+
+   VALUE is a word or a double quoted string in which a backslash escapes
+   the next character; in a content, bytes may be given in hex between two
+   |. The modifiers after a content option (offset, depth, distance,
+   within and nocase, which has no value) are folded into it as they are
+   read. Blank lines and lines starting with # are skipped, anything else
+   that does not parse is reported with the line and column, and the whole
+   file is rejected. */
+
+/* On a reload, the rules of the loaded set by the hash of their text
+   without the surrounding spaces. A line with the same text parses to the
+   same rule, so its strings, options and ports are shared instead. */
+typedef struct previous_entry_tag
 {
-  rule_t *rules = NULL;
+  rule_t *rule; /* NULL once reused, so duplicate lines pair up */
+  uint64_t hash;
+}
+previous_entry_t;
 
-  char regex[LINE_LENGTH];
-  char line[LINE_LENGTH];
+typedef struct previous_tag
+{
+  previous_entry_t *entries;
+  uint64_t mask;
+
+  int lookups;
+  int misses;
+}
+previous_t;
 
-  subreg_capture_t captures[MAX_NUM_CAPTURES];
+typedef struct parser_tag
+{
+  char *filename;
+  int line_number;
 
-  strcpy (regex, "\\s*alert\\s+((?tcp)|(?udp)|(?http))\\s+"
-                 "((?any)|(?(?\\d|\\.|/)+))\\s+((?any)|(?(?\\d|:|,)+))\\s*"
-                 "->\\s*"
-                 "((?any)|(?(?\\d|\\.|/)+))\\s+((?any)|(?(?\\d|:|,)+))\\s*"
-                 "(?\\("
-                 "(?\\s*((?\\w)+)\\s*:\\s*(?(?\\q((?\\Q)*)\\q)|((?\\w)+))\\s*;?\\s*)*"
-                 "\\))?\\s*");
+  char *line;
+  char *cursor;
+
+  rule_storage_t *storage; /* where the rules are allocated */
+  previous_t *previous; /* NULL unless rules can be reused */
+
+  jmp_buf failure; /* where parse_error returns to */
+}
+parser_t;
+
+rule_t *parse_rule (parser_t *, int, int *);
+previous_t *index_previous (rule_t *);
+void free_previous (previous_t *);
+rule_t *reuse_rule (parser_t *, int, rule_reuse_t *);
+void borrow_storage (rule_storage_t *, rule_storage_t *);
+uint64_t hash_text (char *, size_t *);
+bool content_modifier (char *, option_t *);
+void parse_modifier (parser_t *, option_t *, option_t *, option_t *);
+void parse_error (parser_t *, char *, char *);
+void skip_spaces (parser_t *);
+void expect_spaces (parser_t *);
+void expect (parser_t *, char *);
+char *read_span (parser_t *, char *, char *);
+char *read_quoted (parser_t *, bool, int *);
+int hex_digit (char);
+void parse_ip (parser_t *, ip_t *);
+void parse_port (parser_t *, port_t *);
+bool set_ip_range (ip_t *);
+bool set_port_values (port_t *, arena_t *);
 
+rule_t *get_rules (char *filename)
+{
+  rule_t *rules;
+
+  if (read_rules (filename, NULL, &rules, NULL) == false)
+  {
+    exit (EXIT_FAILURE);
+  }
+
+  return rules;
+}
+
+/* Returns false, after printing why, when the file cannot be read or any
+   rule in it does not parse. Nothing is left allocated in that case.
+   Rules of previous, the set being replaced, are reused where the text
+   did not change; reuse, if given, tells how many. */
+bool read_rules (char *filename, rule_t *previous, rule_t **rules_out, rule_reuse_t *reuse)
+{
   FILE *file = fopen (filename, "r");
   if (file == NULL)
   {
     fprintf (stderr, "Could not open %s\n", filename);
+    return false;
+  }
+
+  /* Kept out of the stack frame, which longjmp leaves undefined */
+  parser_t *parser = (parser_t *) calloc (1, sizeof (parser_t));
+  rule_reuse_t *counts = (rule_reuse_t *) calloc (1, sizeof (rule_reuse_t));
+  if (parser == NULL || counts == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule parser\n");
+    exit (EXIT_FAILURE);
+  }
+
+  parser->filename = filename;
+  parser->storage = new_rule_storage ();
+
+  /* Reused options keep their ids, new ones come after them */
+  int number_of_options = 0;
+
+  if (previous != NULL)
+  {
+    number_of_options = previous->storage->next_option_id;
+
+    /* Every reload that reuses rules keeps the storage of the one
+       before alive, so after a few of them everything is parsed again */
+    if (previous->storage->number_borrowed < REUSE_GENERATIONS)
+    {
+      parser->previous = index_previous (previous);
+    }
+    else
+    {
+      counts->rebuilt = true;
+    }
+  }
+
+  if (setjmp (parser->failure) != 0)
+  {
+    free_previous (parser->previous);
+    free_rules_storage (parser->storage);
+    free (parser->line);
+    free (parser);
+    free (counts);
+    fclose (file);
+    return false;
+  }
+
+  rule_t *rules = NULL;
+
+  int number_of_rules = 0;
+
+  size_t allocated = 0;
+
+  while (getline (&(parser->line), &allocated, file) != -1)
+  {
+    parser->line_number++;
+    parser->cursor = parser->line;
+
+    skip_spaces (parser);
+
+    if (*parser->cursor == '\0' || *parser->cursor == '#')
+    {
+      continue;
+    }
+
+    rule_t *new_rule = NULL;
+
+    if (parser->previous != NULL)
+    {
+      new_rule = reuse_rule (parser, number_of_rules, counts);
+    }
+
+    if (new_rule == NULL)
+    {
+      new_rule = parse_rule (parser, number_of_rules, &number_of_options);
+      counts->parsed++;
+    }
+
+    number_of_rules++;
+
+    new_rule->prev = NULL;
+    new_rule->next = rules;
+
+    if (rules != NULL)
+    {
+      rules->prev = new_rule;
+    }
+
+    rules = new_rule;
+  }
+
+  rule_storage_t *storage = parser->storage;
+
+  storage->next_option_id = number_of_options;
+
+  free_previous (parser->previous);
+  free (parser->line);
+  free (parser);
+  fclose (file);
+
+  if (rules == NULL)
+  {
+    free_rules_storage (storage);
+  }
+  else
+  {
+    index_rules (storage, rules, NULL, 0);
+  }
+
+  counts->rules = number_of_rules;
+  counts->removed = (previous != NULL ? previous->storage->analysis.rules : 0) - counts->reused;
+
+  if (reuse != NULL)
+  {
+    *reuse = *counts;
+  }
+
+  free (counts);
+
+  *rules_out = rules;
+
+  return true;
+}
+
+previous_t *index_previous (rule_t *rules)
+{
+  previous_t *previous = (previous_t *) calloc (1, sizeof (previous_t));
+
+  uint64_t size = 1;
+
+  while (size < 2 * (uint64_t) rules->storage->analysis.rules)
+  {
+    size *= 2;
+  }
+
+  previous->entries = (previous_entry_t *) calloc (size, sizeof (previous_entry_t));
+  previous->mask = size - 1;
+
+  if (previous->entries == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule index\n");
     exit (EXIT_FAILURE);
   }
 
-  while (fgets (line, LINE_LENGTH, file))
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    /* Rules loaded from the cache are hashed here */
+    if (rule->hash == 0)
+    {
+      size_t length;
+
+      rule->hash = hash_text (rule->str + strspn (rule->str, SPACE_CHARACTERS), &length);
+    }
+
+    uint64_t slot = rule->hash & previous->mask;
+
+    while (previous->entries[slot].rule != NULL)
+    {
+      slot = (slot + 1) & previous->mask;
+    }
+
+    previous->entries[slot].rule = rule;
+    previous->entries[slot].hash = rule->hash;
+  }
+
+  return previous;
+}
+
+void free_previous (previous_t *previous)
+{
+  if (previous != NULL)
+  {
+    free (previous->entries);
+    free (previous);
+  }
+}
+
+/* Returns a rule sharing everything but its place in the list with the
+   old rule of the same text, or NULL to have the line parsed. When most
+   of the first lines changed, lookups stop and the rest is parsed. */
+rule_t *reuse_rule (parser_t *parser, int id, rule_reuse_t *counts)
+{
+  previous_t *previous = parser->previous;
+
+  if (previous->lookups == REUSE_PROBE && 2 * previous->misses > previous->lookups)
   {
-    if (strlen (line) < 4)
+    counts->rebuilt = true;
+    return NULL;
+  }
+
+  previous->lookups++;
+
+  size_t length;
+  uint64_t hash = hash_text (parser->cursor, &length);
+
+  /* Reused entries keep their hash so that probing goes past them */
+  for (uint64_t slot = hash & previous->mask; previous->entries[slot].hash != 0;
+       slot = (slot + 1) & previous->mask)
+  {
+    previous_entry_t *entry = &(previous->entries[slot]);
+
+    if (entry->rule == NULL || entry->hash != hash)
     {
       continue;
     }
 
-    int number_of_captures = subreg_match (regex, line, captures, MAX_NUM_CAPTURES, MAX_DEPTH);
-    if (number_of_captures < 6)
+    char *old_text = entry->rule->str + strspn (entry->rule->str, SPACE_CHARACTERS);
+    size_t old_length;
+
+    hash_text (old_text, &old_length);
+
+    if (old_length != length || memcmp (old_text, parser->cursor, length) != 0)
     {
       continue;
     }
 
-    rule_t *new_rule = (rule_t *) malloc (sizeof (rule_t));
+    rule_t *rule = (rule_t *) arena_alloc (&(parser->storage->cold), sizeof (rule_t), sizeof (void *));
 
-    new_rule->str = strndup (captures[WHOLE].start, captures[WHOLE].length);
+    *rule = *(entry->rule);
+    rule->id = id;
 
-    new_rule->protocol = strndup (captures[PROTOCOL].start, captures[PROTOCOL].length);
+    /* Packets matched between here and the switch are not carried */
+    rule->hits = __atomic_load_n (&(entry->rule->hits), __ATOMIC_RELAXED);
 
-    new_rule->source_ip.str = strndup (captures[SOURCE_IP].start, captures[SOURCE_IP].length);
+    borrow_storage (parser->storage, rule->origin);
 
-    new_rule->source_port.str = strndup (captures[SOURCE_PORT].start, captures[SOURCE_PORT].length);
+    entry->rule = NULL;
+    counts->reused++;
 
-    new_rule->dest_ip.str = strndup (captures[DEST_IP].start, captures[DEST_IP].length);
+    return rule;
+  }
 
-    new_rule->dest_port.str = strndup (captures[DEST_PORT].start, captures[DEST_PORT].length);
+  previous->misses++;
 
-    new_rule->options = NULL;
+  return NULL;
+}
 
-    for (int i = DEST_PORT + 1; i < number_of_captures; i += 2)
+/* Keeps the storage a reused rule points into alive as long as storage */
+void borrow_storage (rule_storage_t *storage, rule_storage_t *origin)
+{
+  for (int i = 0; i < storage->number_borrowed; i++)
+  {
+    if (storage->borrowed[i] == origin)
     {
-      option_t *new_option = (option_t *) malloc (sizeof (option_t));
+      return;
+    }
+  }
 
-      new_option->name = strndup (captures[i].start, captures[i].length);
+  storage->borrowed[storage->number_borrowed++] = origin;
+  origin->references++;
+}
 
-      new_option->value = strndup (captures[i+1].start, captures[i+1].length);
+/* FNV-1a of the text up to its trailing spaces, never 0 */
+uint64_t hash_text (char *text, size_t *length)
+{
+  size_t end = strlen (text);
 
-      new_option->next = new_rule->options;
+  while (end > 0 && isspace ((unsigned char) text[end - 1]))
+  {
+    end--;
+  }
+
+  uint64_t hash = FNV_OFFSET;
+
+  for (size_t i = 0; i < end; i++)
+  {
+    hash = (hash ^ (uint8_t) text[i]) * FNV_PRIME;
+  }
+
+  *length = end;
+
+  return hash != 0 ? hash : 1;
+}
+
+rule_storage_t *new_rule_storage (void)
+{
+  rule_storage_t *storage = (rule_storage_t *) calloc (1, sizeof (rule_storage_t));
+  if (storage == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rules\n");
+    exit (EXIT_FAILURE);
+  }
+
+  arena_init (&(storage->hot), HOT_ARENA_BLOCK_SIZE);
+  arena_init (&(storage->cold), COLD_ARENA_BLOCK_SIZE);
+
+  storage->references = 1;
+
+  return storage;
+}
+
+/* Points every rule at the storage, picks the fast patterns of the rows
+   and lays out their header fields, in list order. Rows are left to the
+   analysis when NULL, otherwise the analysis must already be filled in. */
+void index_rules (rule_storage_t *storage, rule_t *rules, rule_t **rows, int number)
+{
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    rule->storage = storage;
+  }
+
+  if (rows == NULL)
+  {
+    rows = analyse_rules (storage, rules, &number);
+  }
+
+  storage->prefilter = build_prefilter (rows, number);
+  storage->headers = new_rule_headers (number);
+
+  for (int i = 0; i < number; i++)
+  {
+    set_row_header (storage->headers, i, rows[i]);
+  }
+}
+
+size_t aligned_size (size_t, size_t);
+
+/* The arrays follow the structure in the same allocation, widest first */
+rule_headers_t *new_rule_headers (int number)
+{
+  size_t size = aligned_size (sizeof (rule_headers_t), sizeof (uint64_t)) +
+                number * (2 * sizeof (uint64_t) + sizeof (rule_t *) + 4 * sizeof (uint32_t) +
+                          sizeof (int32_t) + 4 * sizeof (uint16_t) + 2);
+
+  rule_headers_t *headers = (rule_headers_t *) calloc (1, size);
+  if (headers == NULL)
+  {
+    fprintf (stderr, "Could not allocate the rule headers\n");
+    exit (EXIT_FAILURE);
+  }
+
+  uint8_t *next = (uint8_t *) headers + aligned_size (sizeof (rule_headers_t), sizeof (uint64_t));
+
+  headers->number = number;
+
+  headers->passed = (uint64_t *) next; next += number * sizeof (uint64_t);
+  headers->matched = (uint64_t *) next; next += number * sizeof (uint64_t);
+  headers->rules = (rule_t **) next; next += number * sizeof (rule_t *);
+  headers->source_ip_start = (uint32_t *) next; next += number * sizeof (uint32_t);
+  headers->source_ip_finish = (uint32_t *) next; next += number * sizeof (uint32_t);
+  headers->dest_ip_start = (uint32_t *) next; next += number * sizeof (uint32_t);
+  headers->dest_ip_finish = (uint32_t *) next; next += number * sizeof (uint32_t);
+  headers->patterns = (int32_t *) next; next += number * sizeof (int32_t);
+  headers->source_port_start = (uint16_t *) next; next += number * sizeof (uint16_t);
+  headers->source_port_finish = (uint16_t *) next; next += number * sizeof (uint16_t);
+  headers->dest_port_start = (uint16_t *) next; next += number * sizeof (uint16_t);
+  headers->dest_port_finish = (uint16_t *) next; next += number * sizeof (uint16_t);
+  headers->protocols = next; next += number;
+  headers->port_lists = next;
+
+  return headers;
+}
+
+size_t aligned_size (size_t size, size_t alignment)
+{
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void set_row_header (rule_headers_t *headers, int i, rule_t *rule)
+{
+  headers->rules[i] = rule;
+  headers->protocols[i] = protocol_number (rule);
+  headers->patterns[i] = rule->fast_pattern;
+
+  headers->source_ip_start[i] = rule->source_ip.start;
+  headers->source_ip_finish[i] = rule->source_ip.finish;
+  headers->dest_ip_start[i] = rule->dest_ip.start;
+  headers->dest_ip_finish[i] = rule->dest_ip.finish;
+
+  /* A list is first checked against the range of its ports */
+  set_port_header (&(rule->source_port), &(headers->source_port_start[i]), &(headers->source_port_finish[i]));
+  set_port_header (&(rule->dest_port), &(headers->dest_port_start[i]), &(headers->dest_port_finish[i]));
+
+  headers->port_lists[i] = (rule->source_port.colon_found == false ? SOURCE_PORT_LIST : 0) |
+                           (rule->dest_port.colon_found == false ? DEST_PORT_LIST : 0);
+}
+
+uint8_t protocol_number (rule_t *rule)
+{
+  return strcmp (rule->protocol, "udp") == 0 ? IPPROTO_UDP : IPPROTO_TCP;
+}
+
+void set_port_header (port_t *port, uint16_t *start, uint16_t *finish)
+{
+  if (port->colon_found == true)
+  {
+    *start = port->start;
+    *finish = port->finish;
+    return;
+  }
+
+  *start = MAX_16;
+  *finish = 0;
+
+  for (int i = 0; i < port->number_of_ports; i++)
+  {
+    *start = port->ports[i] < *start ? port->ports[i] : *start;
+    *finish = port->ports[i] > *finish ? port->ports[i] : *finish;
+  }
+}
+
+/* Options are kept in reverse order of the rule file, as they always were */
+rule_t *parse_rule (parser_t *parser, int id, int *number_of_options)
+{
+  arena_t *cold = &(parser->storage->cold);
+
+  rule_t *new_rule = (rule_t *) arena_alloc (cold, sizeof (rule_t), sizeof (void *));
+
+  size_t length;
+
+  new_rule->id = id;
+  new_rule->str = arena_strndup (cold, parser->line, strlen (parser->line));
+  new_rule->hash = hash_text (parser->cursor, &length);
+  new_rule->origin = parser->storage;
+
+  expect (parser, "alert");
+  expect_spaces (parser);
+
+  char *start = parser->cursor;
+
+  new_rule->protocol = read_span (parser, WORD_CHARACTERS, "expected a protocol");
+
+  if (strcmp (new_rule->protocol, "tcp") != 0 && strcmp (new_rule->protocol, "udp") != 0 &&
+      strcmp (new_rule->protocol, STRING_HTTP) != 0)
+  {
+    parser->cursor = start;
+    parse_error (parser, "unknown protocol", new_rule->protocol);
+  }
+
+  expect_spaces (parser);
+  parse_ip (parser, &(new_rule->source_ip));
+  expect_spaces (parser);
+  parse_port (parser, &(new_rule->source_port));
+
+  skip_spaces (parser);
+  expect (parser, "->");
+  skip_spaces (parser);
+
+  parse_ip (parser, &(new_rule->dest_ip));
+  expect_spaces (parser);
+  parse_port (parser, &(new_rule->dest_port));
+
+  skip_spaces (parser);
+
+  if (*parser->cursor == '(')
+  {
+    option_t *content = NULL; /* the last content so far, which modifiers apply to */
+    option_t *previous_content = NULL;
+
+    parser->cursor++;
+
+    while (true)
+    {
+      skip_spaces (parser);
+
+      if (*parser->cursor == ')')
+      {
+        parser->cursor++;
+        break;
+      }
+
+      option_t *new_option = (option_t *) arena_alloc (cold, sizeof (option_t), sizeof (void *));
+
+      new_option->id = (*number_of_options)++;
+
+      char *name_start = parser->cursor;
+
+      new_option->name = read_span (parser, WORD_CHARACTERS, "expected an option name or ')'");
+
+      skip_spaces (parser);
+
+      if (content_modifier (new_option->name, content) == true)
+      {
+        if (content == NULL)
+        {
+          parser->cursor = name_start;
+          parse_error (parser, "content modifier without a content option before it", new_option->name);
+        }
+
+        parse_modifier (parser, new_option, content, previous_content);
+      }
+      else
+      {
+        expect (parser, ":");
+        skip_spaces (parser);
+
+        if (*parser->cursor == '"')
+        {
+          new_option->value = read_quoted (parser, strcmp (new_option->name, STRING_CONTENT) == 0,
+                                           &(new_option->value_length));
+        }
+        else
+        {
+          new_option->value = read_span (parser, WORD_CHARACTERS, "expected an option value");
+          new_option->value_length = (int) strlen (new_option->value);
+        }
+      }
+
+      if (strcmp (new_option->name, STRING_CONTENT) == 0)
+      {
+        previous_content = content;
+        content = new_option;
+      }
 
+      new_option->next = new_rule->options;
       new_rule->options = new_option;
+
+      skip_spaces (parser);
+
+      if (*parser->cursor == ';')
+      {
+        parser->cursor++;
+      }
     }
 
-    set_ranges (new_rule);
+    skip_spaces (parser);
+  }
 
-    new_rule->prev = NULL;
-    new_rule->next = rules;
+  if (*parser->cursor != '\0')
+  {
+    parse_error (parser, "unexpected text after the rule", NULL);
+  }
 
-    if (rules != NULL)
+  return new_rule;
+}
+
+/* depth, distance, within and nocase only exist after a content; offset
+   after a content moves its window, before any it is the fragment offset */
+bool content_modifier (char *name, option_t *content)
+{
+  return strcmp (name, STRING_DEPTH) == 0 || strcmp (name, STRING_DISTANCE) == 0 ||
+         strcmp (name, STRING_WITHIN) == 0 || strcmp (name, STRING_NOCASE) == 0 ||
+         (strcmp (name, STRING_OFF) == 0 && content != NULL);
+}
+
+/* Folds a modifier into the window of the content before it. offset and
+   depth count from the start of the payload, distance and within from the
+   end of the match of the previous content, and the two kinds cannot be
+   mixed on one content. */
+void parse_modifier (parser_t *parser, option_t *modifier, option_t *option, option_t *previous)
+{
+  content_t *content = &(option->content);
+
+  modifier->modifier = true;
+
+  if (strcmp (modifier->name, STRING_NOCASE) == 0)
+  {
+    modifier->value = arena_strndup (&(parser->storage->cold), "", 0);
+    modifier->value_length = 0;
+    content->nocase = true;
+    return;
+  }
+
+  expect (parser, ":");
+  skip_spaces (parser);
+
+  char *start = parser->cursor;
+
+  modifier->value = read_span (parser, NUMBER_CHARACTERS, "expected a number");
+  modifier->value_length = (int) strlen (modifier->value);
+
+  char *end;
+  long number = strtol (modifier->value, &end, 10);
+
+  if (*end != '\0' || number > MAX_WINDOW || number < -MAX_WINDOW)
+  {
+    parser->cursor = start;
+    parse_error (parser, "expected a number", modifier->value);
+  }
+
+  bool relative = strcmp (modifier->name, STRING_DISTANCE) == 0 || strcmp (modifier->name, STRING_WITHIN) == 0;
+  bool sets_start = strcmp (modifier->name, STRING_OFF) == 0 || strcmp (modifier->name, STRING_DISTANCE) == 0;
+
+  if (relative != content->relative && (content->relative == true || content->start != 0 || content->length != 0))
+  {
+    parser->cursor = start;
+    parse_error (parser, "offset and depth cannot be mixed with distance and within", modifier->name);
+  }
+
+  if (relative == true && previous == NULL)
+  {
+    parser->cursor = start;
+    parse_error (parser, "distance and within need an earlier content", modifier->name);
+  }
+
+  if (number < 0 && strcmp (modifier->name, STRING_DISTANCE) != 0)
+  {
+    parser->cursor = start;
+    parse_error (parser, "only distance can be negative", modifier->value);
+  }
+
+  if (sets_start == false && number < option->value_length)
+  {
+    parser->cursor = start;
+    parse_error (parser, "the window is shorter than the content", modifier->value);
+  }
+
+  if (sets_start == true)
+  {
+    content->start = (int) number;
+  }
+  else
+  {
+    content->length = (int) number;
+  }
+
+  if (relative == true)
+  {
+    content->relative = true;
+    content->previous = previous;
+    previous->content.following = option;
+  }
+}
+
+void parse_error (parser_t *parser, char *message, char *detail)
+{
+  fprintf (stderr, "%s:%d:%d: %s", parser->filename, parser->line_number,
+           (int) (parser->cursor - parser->line) + 1, message);
+
+  if (detail != NULL)
+  {
+    fprintf (stderr, ": %s", detail);
+  }
+
+  fprintf (stderr, "\n");
+  longjmp (parser->failure, 1);
+}
+
+void skip_spaces (parser_t *parser)
+{
+  while (isspace ((unsigned char) *parser->cursor))
+  {
+    parser->cursor++;
+  }
+}
+
+void expect_spaces (parser_t *parser)
+{
+  if (isspace ((unsigned char) *parser->cursor) == false)
+  {
+    parse_error (parser, "expected a space", NULL);
+  }
+
+  skip_spaces (parser);
+}
+
+void expect (parser_t *parser, char *text)
+{
+  size_t length = strlen (text);
+
+  if (strncmp (parser->cursor, text, length) != 0)
+  {
+    char message[STRING_LENGTH];
+
+    snprintf (message, STRING_LENGTH, "expected '%s'", text);
+    parse_error (parser, message, NULL);
+  }
+
+  parser->cursor += length;
+}
+
+/* Returns a copy of the longest run of the given characters */
+char *read_span (parser_t *parser, char *characters, char *message)
+{
+  size_t length = strspn (parser->cursor, characters);
+
+  if (length == 0)
+  {
+    parse_error (parser, message, NULL);
+  }
+
+  char *span = arena_strndup (&(parser->storage->cold), parser->cursor, length);
+  parser->cursor += length;
+
+  return span;
+}
+
+/* Returns the unescaped contents of a double quoted string and sets their
+   length. With hex, the bytes between two | are given as pairs of hex
+   digits, which spaces may separate ("GET|20 2F|"); the value may then
+   hold any byte, NUL included, and \| is a | of its own. */
+char *read_quoted (parser_t *parser, bool hex, int *value_length)
+{
+  char *start = parser->cursor++;
+  size_t length = 0;
+
+  /* First pass finds the end and the unescaped length, which decoding
+     the hex digits can only shorten */
+  while (*parser->cursor != '"')
+  {
+    if (*parser->cursor == '\\' && parser->cursor[1] != '\0' && parser->cursor[1] != '\n')
     {
-      rules->prev = new_rule;
+      parser->cursor++;
+    }
+    else if (*parser->cursor == '\0' || *parser->cursor == '\n')
+    {
+      parser->cursor = start;
+      parse_error (parser, "unterminated string", NULL);
     }
 
-    rules = new_rule;
+    parser->cursor++;
+    length++;
   }
 
-  fclose (file);
+  char *end = parser->cursor;
+  char *value = (char *) arena_alloc (&(parser->storage->cold), length + 1, 1);
+  char *from = start + 1;
+  char *bar = NULL; /* opening the hex digits being read */
+  int decoded = 0;
 
-  return rules;
+  while (from < end)
+  {
+    if (*from == '\\')
+    {
+      value[decoded++] = from[1];
+      from += 2;
+    }
+    else if (hex == true && *from == '|')
+    {
+      bar = bar == NULL ? from : NULL;
+      from++;
+    }
+    else if (bar == NULL)
+    {
+      value[decoded++] = *(from++);
+    }
+    else if (*from == ' ')
+    {
+      from++;
+    }
+    else if (hex_digit (from[0]) >= 0 && hex_digit (from[1]) >= 0)
+    {
+      value[decoded++] = (char) (hex_digit (from[0]) << 4 | hex_digit (from[1]));
+      from += 2;
+    }
+    else
+    {
+      parser->cursor = from;
+      parse_error (parser, "expected two hex digits", NULL);
+    }
+  }
+
+  if (bar != NULL)
+  {
+    parser->cursor = bar;
+    parse_error (parser, "unterminated hex bytes", NULL);
+  }
+
+  parser->cursor++;
+  *value_length = decoded;
+
+  return value;
+}
+
+int hex_digit (char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+void parse_ip (parser_t *parser, ip_t *ip)
+{
+  char *start = parser->cursor;
+
+  if (strncmp (parser->cursor, ANY, strlen (ANY)) == 0)
+  {
+    ip->str = read_span (parser, WORD_CHARACTERS, NULL);
+  }
+  else
+  {
+    ip->str = read_span (parser, IP_CHARACTERS, "expected an IP address or 'any'");
+  }
+
+  if (set_ip_range (ip) == false)
+  {
+    parser->cursor = start;
+    parse_error (parser, "invalid IP address", ip->str);
+  }
 }
 
-void set_ip_range (ip_t *);
-void set_port_values (port_t *);
+void parse_port (parser_t *parser, port_t *port)
+{
+  char *start = parser->cursor;
+
+  if (strncmp (parser->cursor, ANY, strlen (ANY)) == 0)
+  {
+    port->str = read_span (parser, WORD_CHARACTERS, NULL);
+  }
+  else
+  {
+    port->str = read_span (parser, PORT_CHARACTERS, "expected ports or 'any'");
+  }
 
-void set_ranges (rule_t *rule)
+  if (set_port_values (port, &(parser->storage->hot)) == false)
+  {
+    parser->cursor = start;
+    parse_error (parser, "invalid ports", port->str);
+  }
+}
+
+void free_rules (rule_t *rules)
 {
-  set_ip_range (&(rule->source_ip));
+  if (rules != NULL)
+  {
+    free_rules_storage (rules->storage);
+  }
+}
+
+/* Storages go once neither their own list nor a list reusing their rules
+   needs them. Only the thread that loads rules frees them. */
+void free_rules_storage (rule_storage_t *storage)
+{
+  if (--(storage->references) > 0)
+  {
+    return;
+  }
+
+  for (int i = 0; i < storage->number_borrowed; i++)
+  {
+    free_rules_storage (storage->borrowed[i]);
+  }
 
-  set_ip_range (&(rule->dest_ip));
+  if (storage->mapping != NULL)
+  {
+    munmap (storage->mapping, storage->mapping_length);
+  }
 
-  set_port_values (&(rule->source_port));
+  arena_free (&(storage->hot));
+  arena_free (&(storage->cold));
 
-  set_port_values (&(rule->dest_port));
+  free_native (storage->native);
+  free_prefilter (storage->prefilter);
+  free (storage->headers);
+  free (storage);
 }
 
 uint32_t zero_right_part (uint32_t, int);
 uint32_t one_right_part (uint32_t, int);
 
-void set_ip_range (ip_t *ip)
+bool set_ip_range (ip_t *ip)
 {
   if (strcmp (ip->str, ANY) == 0)
   {
     ip->start = 0;
     ip->finish = MAX_32;
-    return;
+    return true;
   }
 
   char *slash = strstr (ip->str, "/");
@@ -132,21 +980,27 @@ void set_ip_range (ip_t *ip)
 
   struct in_addr address;
   int rv = inet_pton (AF_INET, ip->str, (void *) &address);
+
+  if (slash_found == true)
+  {
+    *slash = '/';
+  }
+
   if (rv != 1)
   {
-    fprintf (stderr, "Could not convert IP address: %s\n", ip->str);
-    exit (EXIT_FAILURE);
+    return false;
   }
 
   uint32_t ip_number = ntohl ((uint32_t) address.s_addr);
 
   if (slash_found == true)
   {
-    int mask = (int) atol (slash + 1);
-    if (mask < 0 || mask > 32)
+    char *end;
+    long mask = strtol (slash + 1, &end, 10);
+
+    if (end == slash + 1 || *end != '\0' || mask < 0 || mask > 32)
     {
-      fprintf (stderr, "Subnet mask is invalid\n");
-      exit (EXIT_FAILURE);
+      return false;
     }
 
     if (mask == 0)
@@ -161,11 +1015,9 @@ void set_ip_range (ip_t *ip)
     }
     else
     {
-      ip->start = zero_right_part (ip_number, mask);
-      ip->finish = one_right_part (ip_number, mask);
+      ip->start = zero_right_part (ip_number, (int) mask);
+      ip->finish = one_right_part (ip_number, (int) mask);
     }
-
-    *slash = '/';
   }
 
   else
@@ -173,6 +1025,8 @@ void set_ip_range (ip_t *ip)
     ip->start = ip_number;
     ip->finish = ip_number;
   }
+
+  return true;
 }
 
 uint32_t zero_right_part (uint32_t ip, int mask)
@@ -197,79 +1051,100 @@ uint32_t one_right_part (uint32_t ip, int mask)
   return number;
 }
 
-void set_port_values (port_t *port)
+bool read_port (char *, char *, uint16_t *);
+
+/* A range "start:finish" where either end may be left out, or a comma
+   separated list */
+bool set_port_values (port_t *port, arena_t *arena)
 {
+  port->ports = NULL;
+
   if (strcmp (port->str, ANY) == 0)
   {
     port->colon_found = true;
     port->start = 0;
     port->finish = MAX_16;
-    return;
+    return true;
   }
 
-  char *colon = strstr (port->str, ":");
-  char *comma = strstr (port->str, ",");
-
-  if (colon != NULL && comma != NULL)
-  {
-    fprintf (stderr, "Invalid ports: colon and comma in %s\n", port->str);
-    exit (EXIT_FAILURE);
-  }
+  char *finish = port->str + strlen (port->str);
+  char *colon = strchr (port->str, ':');
+  char *comma = strchr (port->str, ',');
 
   port->colon_found = colon == NULL ? false : true;
 
   if (port->colon_found == true)
   {
-    if (port->str == colon)
-    {
-      port->start = 0;
-    }
-    else
+    if (comma != NULL || strchr (colon + 1, ':') != NULL)
     {
-      *colon = '\0';
-      port->start = (uint16_t) atol (port->str);
-      *colon = ':';
+      return false;
     }
 
-    if (port->str + strlen (port->str) - 1 == colon)
-    {
-      port->finish = MAX_16;
-    }
-    else
+    port->start = 0;
+    port->finish = MAX_16;
+
+    return (colon == port->str || read_port (port->str, colon, &(port->start)) == true) &&
+           (colon + 1 == finish || read_port (colon + 1, finish, &(port->finish)) == true);
+  }
+
+  port->number_of_ports = 1;
+
+  for (char *c = port->str; *c != '\0'; c++)
+  {
+    if (*c == ',')
     {
-      port->finish = (uint16_t) atol (colon + 1);
+      port->number_of_ports++;
     }
   }
 
-  else
-  {
-    char regex[LINE_LENGTH];
-    subreg_capture_t captures[MAX_NUM_CAPTURES];
+  port->ports = (uint16_t *) arena_alloc (arena, port->number_of_ports * sizeof (uint16_t), sizeof (uint16_t));
 
-    strcpy (regex, "(?((?\\d)+),?)+");
+  char *start = port->str;
 
-    int number_of_captures = subreg_match (regex, port->str, captures, MAX_NUM_CAPTURES, MAX_DEPTH);
-    if (number_of_captures < 2)
+  for (int i = 0; i < port->number_of_ports; i++)
+  {
+    comma = strchr (start, ',');
+    if (comma == NULL)
     {
-      fprintf (stderr, "Invalid ports: no matching\n");
-      exit (EXIT_FAILURE);
+      comma = finish;
     }
 
-    port->number_of_ports = number_of_captures - 1;
+    if (read_port (start, comma, &(port->ports[i])) == false)
+    {
+      return false;
+    }
 
-    port->ports = (uint16_t *) malloc (port->number_of_ports * sizeof (uint16_t));
+    start = comma + 1;
+  }
 
-    for (int i = 1; i < port->number_of_ports; i++)
-    {
-      comma = ((char *) (captures[i].start)) + captures[i].length;
+  return true;
+}
 
-      *comma = '\0';
+bool read_port (char *start, char *finish, uint16_t *port)
+{
+  long number = 0;
 
-      port->ports[i - 1] = (uint16_t) atol (captures[i].start);
+  if (start == finish || finish - start > 5)
+  {
+    return false;
+  }
 
-      *comma = ',';
+  for (char *c = start; c < finish; c++)
+  {
+    if (isdigit ((unsigned char) *c) == false)
+    {
+      return false;
     }
 
-    port->ports[port->number_of_ports - 1] = (uint16_t) atol (captures[port->number_of_ports].start);
+    number = 10 * number + (*c - '0');
+  }
+
+  if (number > MAX_16)
+  {
+    return false;
   }
+
+  *port = (uint16_t) number;
+
+  return true;
 }
@@ -4,5 +4,14 @@
 #include "structures.h"
 
 rule_t *get_rules (char *);
+bool read_rules (char *, rule_t *, rule_t **, rule_reuse_t *);
+void free_rules (rule_t *);
+rule_storage_t *new_rule_storage (void);
+void index_rules (rule_storage_t *, rule_t *, rule_t **, int);
+rule_headers_t *new_rule_headers (int);
+void set_row_header (rule_headers_t *, int, rule_t *);
+uint8_t protocol_number (rule_t *);
+void set_port_header (port_t *, uint16_t *, uint16_t *);
+void free_rules_storage (rule_storage_t *);
 
 #endif
@@ -0,0 +1,252 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "stats.h"
+#include "output.h"
+
+#include "scan.h"
+
+#define TCP_ACK (0x10)
+#define TCP_RST (0x04)
+#define WELL_KNOWN_PORTS (1024)
+
+/* Rules look at one packet at a time; this counts, per source address,
+   the distinct destination ports and hosts of the probes it sent. Each
+   count is a 512 bit bitmap read by linear counting, so a threshold is
+   turned into a number of set bits once instead of estimating on every
+   packet. A window is covered by two halves: the half that is filling
+   and the one before it, so what is counted spans between one half and
+   a whole window. */
+
+bool is_probe (packet_t *);
+uint32_t scatter (uint32_t);
+int expected_bits (int);
+scan_source_t *find_source (scan_detector_t *, uint32_t, uint32_t, int64_t, counters_t *);
+void advance_window (scan_source_t *, int64_t);
+bool add_bit (uint64_t [2][SCAN_BITMAP_BITS / 64], int, uint32_t, uint16_t *);
+
+scan_detector_t *scan_init (settings_t *settings)
+{
+  scan_detector_t *detector = (scan_detector_t *) calloc (1, sizeof (scan_detector_t));
+  if (detector == NULL)
+  {
+    fprintf (stderr, "Could not allocate the scan detector\n");
+    exit (EXIT_FAILURE);
+  }
+
+  detector->ways = (scan_way_t *) calloc (SCAN_SETS * SCAN_WAYS, sizeof (scan_way_t));
+  detector->sources = (scan_source_t *) calloc (SCAN_SETS * SCAN_WAYS, sizeof (scan_source_t));
+
+  if (detector->ways == NULL || detector->sources == NULL)
+  {
+    fprintf (stderr, "Could not allocate the scan table\n");
+    exit (EXIT_FAILURE);
+  }
+
+  detector->half_window = settings->scan_window / 2;
+  detector->port_bits = settings->scan_ports > 0 ? expected_bits (settings->scan_ports) : 0;
+  detector->host_bits = settings->scan_hosts > 0 ? expected_bits (settings->scan_hosts) : 0;
+
+  snprintf (detector->port_text, LINE_LENGTH, "port scan: %d destination ports from one source within %d s",
+            settings->scan_ports, settings->scan_window);
+  snprintf (detector->host_text, LINE_LENGTH, "host sweep: %d destination hosts from one source within %d s",
+            settings->scan_hosts, settings->scan_window);
+
+  init_alert_rule (&(detector->port_rule), &(detector->port_message), detector->port_text);
+  init_alert_rule (&(detector->host_rule), &(detector->host_message), detector->host_text);
+
+  return detector;
+}
+
+/* Counts a packet and fills alerts with the rules to alert with, when its
+   source just reached a threshold. A source that stays above it is not
+   reported again until its count dropped below. Returns the number of
+   alerts. */
+int scan_packet (scan_detector_t *detector, packet_t *packet, const struct pcap_pkthdr *pkthdr,
+                 counters_t *counters, rule_t *alerts[2])
+{
+  if (is_probe (packet) == false)
+  {
+    return 0;
+  }
+
+  int64_t half = (int64_t) pkthdr->ts.tv_sec / detector->half_window;
+
+  /* 0 marks a free way */
+  uint32_t now = (uint32_t) pkthdr->ts.tv_sec + 1;
+
+  scan_source_t *source = find_source (detector, packet->source_IP, now, half, counters);
+
+  if (half > source->half)
+  {
+    advance_window (source, half);
+  }
+
+  int current = (int) (source->half & 1);
+  int number_of_alerts = 0;
+
+  if (detector->port_bits > 0 &&
+      add_bit (source->ports, current, scatter (packet->dest_port), &(source->port_bits)) == true &&
+      source->port_bits == detector->port_bits)
+  {
+    alerts[number_of_alerts++] = &(detector->port_rule);
+  }
+
+  if (detector->host_bits > 0 &&
+      add_bit (source->hosts, current, scatter (packet->dest_IP), &(source->host_bits)) == true &&
+      source->host_bits == detector->host_bits)
+  {
+    alerts[number_of_alerts++] = &(detector->host_rule);
+  }
+
+  if (number_of_alerts > 0)
+  {
+    COUNT (counters->scan_alerts, number_of_alerts);
+  }
+
+  return number_of_alerts;
+}
+
+void scan_free (scan_detector_t *detector)
+{
+  free (detector->ways);
+  free (detector->sources);
+  free (detector);
+}
+
+/* Packets a scan is made of: TCP without ACK or RST (SYN, FIN, NULL and
+   Xmas probes), and UDP that does not come from a well-known port, which
+   leaves out the answers of servers */
+bool is_probe (packet_t *packet)
+{
+  if (packet->protocol == IPPROTO_TCP)
+  {
+    return (packet->flags & (TCP_ACK | TCP_RST)) == 0;
+  }
+
+  return packet->source_port >= WELL_KNOWN_PORTS;
+}
+
+/* Spreads neighbouring addresses and ports over the whole range */
+uint32_t scatter (uint32_t value)
+{
+  value ^= value >> 16;
+  value *= 0x85EBCA6BU;
+  value ^= value >> 13;
+  value *= 0xC2B2AE35U;
+  value ^= value >> 16;
+
+  return value;
+}
+
+/* Bits a bitmap is expected to have set after that many distinct values,
+   the inverse of the linear counting estimate */
+int expected_bits (int distinct)
+{
+  double empty = 1.0;
+
+  for (int i = 0; i < distinct; i++)
+  {
+    empty *= 1.0 - 1.0 / SCAN_BITMAP_BITS;
+  }
+
+  int bits = (int) (SCAN_BITMAP_BITS * (1.0 - empty) + 0.5);
+
+  return bits > 0 ? bits : 1;
+}
+
+/* The entry of address, taking the way seen least recently in its set
+   when the address is not in the table */
+scan_source_t *find_source (scan_detector_t *detector, uint32_t address, uint32_t now,
+                            int64_t half, counters_t *counters)
+{
+  size_t set = (size_t) (((uint64_t) scatter (address) * SCAN_SETS) >> 32) * SCAN_WAYS;
+  scan_way_t *ways = &(detector->ways[set]);
+
+  int victim = 0;
+
+  for (int i = 0; i < SCAN_WAYS; i++)
+  {
+    if (ways[i].address == address && ways[i].last_seen != 0)
+    {
+      ways[i].last_seen = now;
+      return &(detector->sources[set + i]);
+    }
+
+    if (ways[i].last_seen < ways[victim].last_seen)
+    {
+      victim = i;
+    }
+  }
+
+  if (ways[victim].last_seen != 0)
+  {
+    COUNT (counters->scan_evictions, 1);
+  }
+
+  ways[victim].address = address;
+  ways[victim].last_seen = now;
+
+  scan_source_t *source = &(detector->sources[set + victim]);
+
+  memset (source, 0, sizeof (scan_source_t));
+  source->half = half;
+
+  return source;
+}
+
+/* Moves the source on to half window half. The half that was filling is
+   kept as the previous one when it is just before half, everything older
+   is dropped. */
+void advance_window (scan_source_t *source, int64_t half)
+{
+  int current = (int) (half & 1);
+  int previous = 1 - current;
+
+  memset (source->ports[current], 0, sizeof (source->ports[current]));
+  memset (source->hosts[current], 0, sizeof (source->hosts[current]));
+
+  if (half - source->half > 1)
+  {
+    memset (source->ports[previous], 0, sizeof (source->ports[previous]));
+    memset (source->hosts[previous], 0, sizeof (source->hosts[previous]));
+  }
+
+  source->port_bits = 0;
+  source->host_bits = 0;
+
+  for (int i = 0; i < SCAN_BITMAP_BITS / 64; i++)
+  {
+    source->port_bits += __builtin_popcountll (source->ports[previous][i]);
+    source->host_bits += __builtin_popcountll (source->hosts[previous][i]);
+  }
+
+  source->half = half;
+}
+
+/* Sets the bit of hash in the current half. Returns true if the bit was
+   set in neither half, after counting it. */
+bool add_bit (uint64_t bitmaps[2][SCAN_BITMAP_BITS / 64], int current, uint32_t hash, uint16_t *count)
+{
+  uint32_t bit = (uint32_t) (((uint64_t) hash * SCAN_BITMAP_BITS) >> 32);
+  uint64_t mask = 1ULL << (bit % 64);
+
+  uint64_t *word = &(bitmaps[current][bit / 64]);
+
+  if ((*word & mask) != 0)
+  {
+    return false;
+  }
+
+  *word |= mask;
+
+  if ((bitmaps[1 - current][bit / 64] & mask) != 0)
+  {
+    return false;
+  }
+
+  (*count)++;
+
+  return true;
+}
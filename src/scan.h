@@ -0,0 +1,10 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "structures.h"
+
+scan_detector_t *scan_init (settings_t *);
+int scan_packet (scan_detector_t *, packet_t *, const struct pcap_pkthdr *, counters_t *, rule_t *[2]);
+void scan_free (scan_detector_t *);
+
+#endif
@@ -0,0 +1,283 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "output.h"
+#include "queue.h"
+#include "epoch.h"
+
+#include "segment.h"
+
+/* The statistics thread fills the segment once a second from counters
+   the capture thread keeps anyway, so publishing costs the packet path
+   nothing. Per second rates are taken between two publications. */
+
+void track_rules (segment_t *, rule_t *);
+
+segment_t *segment_init (char *name, context_t *context)
+{
+  segment_t *segment = (segment_t *) calloc (1, sizeof (segment_t));
+  if (segment == NULL)
+  {
+    fprintf (stderr, "Could not allocate the stats segment\n");
+    exit (EXIT_FAILURE);
+  }
+
+  int fd = shm_open (name, O_CREAT | O_RDWR, 0644);
+
+  if (fd < 0 || ftruncate (fd, sizeof (segment_data_t)) != 0)
+  {
+    fprintf (stderr, "Could not create shared memory %s\n", name);
+    exit (EXIT_FAILURE);
+  }
+
+  segment->data = (segment_data_t *) mmap (NULL, sizeof (segment_data_t), PROT_READ | PROT_WRITE,
+                                           MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (segment->data == MAP_FAILED)
+  {
+    fprintf (stderr, "Could not map shared memory %s\n", name);
+    exit (EXIT_FAILURE);
+  }
+
+  segment->name = name;
+  segment->context = context;
+
+  track_rules (segment, context->rules);
+
+  clock_gettime (CLOCK_MONOTONIC, &(segment->last));
+
+  segment_data_t *data = segment->data;
+
+  memset (data, 0, sizeof (segment_data_t));
+
+  data->pid = (int64_t) getpid ();
+  data->started = (int64_t) time (NULL);
+  data->number_of_rules = segment->number_of_rules;
+  data->version = SEGMENT_VERSION;
+
+  __atomic_store_n (&(data->magic), SEGMENT_MAGIC, __ATOMIC_RELEASE);
+
+  return segment;
+}
+
+/* Rates are taken against the hits of the same rule set. A reloaded set
+   starts from the hits it carried over, so its first rates are zero. */
+void track_rules (segment_t *segment, rule_t *rules)
+{
+  segment->rules = rules;
+  segment->number_of_rules = 0;
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    if (rule->id + 1 > segment->number_of_rules)
+    {
+      segment->number_of_rules = rule->id + 1;
+    }
+  }
+
+  free (segment->last_hits);
+  segment->last_hits = (uint64_t *) calloc (segment->number_of_rules + 1, sizeof (uint64_t));
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    segment->last_hits[rule->id] = __atomic_load_n (&(rule->hits), __ATOMIC_RELAXED);
+  }
+}
+
+int fill_top_rules (segment_t *, segment_rule_t *, double);
+void insert_top_rule (segment_rule_t *, int *, segment_rule_t *);
+
+void segment_publish (segment_t *segment, stats_t *stats)
+{
+  context_t *context = segment->context;
+  counters_t *counters = &(context->counters);
+  segment_data_t *data = segment->data;
+
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  double seconds = (double) (now.tv_sec - segment->last.tv_sec) +
+                   (double) (now.tv_nsec - segment->last.tv_nsec) / 1e9;
+
+  if (seconds <= 0)
+  {
+    seconds = 1;
+  }
+
+  uint64_t packets = __atomic_load_n (&(counters->packets), __ATOMIC_RELAXED);
+  uint64_t rejected = 0;
+
+  for (int i = 0; i < NUMBER_OF_REJECT_REASONS; i++)
+  {
+    rejected += __atomic_load_n (&(counters->rejected[i]), __ATOMIC_RELAXED);
+  }
+
+  capture_stats_t *capture = &(stats->capture);
+  uint64_t dropped = __atomic_load_n (&(capture->dropped), __ATOMIC_RELAXED);
+
+  /* Ranked before the sequence goes odd: readers only wait for the copy */
+  segment_rule_t top_rules[SEGMENT_TOP_RULES];
+  int number_of_top_rules = fill_top_rules (segment, top_rules, seconds);
+
+  uint64_t sequence = data->sequence;
+
+  __atomic_store_n (&(data->sequence), sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  data->updated = (int64_t) time (NULL);
+
+  data->capture_available = __atomic_load_n (&(capture->available), __ATOMIC_RELAXED);
+  data->capture_received = __atomic_load_n (&(capture->received), __ATOMIC_RELAXED);
+  data->capture_dropped = dropped;
+  data->capture_interface_dropped = __atomic_load_n (&(capture->interface_dropped), __ATOMIC_RELAXED);
+  data->drops_per_second = (double) (dropped - segment->last_dropped) / seconds;
+
+  data->packets = packets;
+  data->parsed = __atomic_load_n (&(counters->parsed), __ATOMIC_RELAXED);
+  data->rejected = rejected;
+  data->matched = __atomic_load_n (&(counters->matched), __ATOMIC_RELAXED);
+  data->alerts = __atomic_load_n (&(counters->alerts), __ATOMIC_RELAXED);
+  data->output_bytes = __atomic_load_n (&(counters->output_bytes), __ATOMIC_RELAXED);
+
+  /* Packets are handled by the single capture thread */
+  data->number_of_workers = 1;
+  data->workers[0].packets = packets;
+  data->workers[0].matched = data->matched;
+  data->workers[0].packets_per_second = (double) (packets - segment->last_packets) / seconds;
+
+  uint64_t recorder_size = context->recorder->mask + 1;
+  uint64_t recorded = __atomic_load_n (&(context->recorder->head), __ATOMIC_RELAXED);
+
+  data->recorder_size = recorder_size;
+  data->recorder_used = recorded < recorder_size ? recorded : recorder_size;
+
+  exporter_t *exporter = context->exporter;
+
+  data->exporting = exporter != NULL;
+
+  if (exporter != NULL)
+  {
+    data->export_queue_used = queue_used (exporter->queue);
+    data->export_queue_size = exporter->queue->size;
+    data->export_packets = __atomic_load_n (&(exporter->exported), __ATOMIC_RELAXED);
+    data->export_dropped = __atomic_load_n (&(exporter->dropped), __ATOMIC_RELAXED);
+  }
+
+  data->number_of_rules = segment->number_of_rules;
+  data->number_of_top_rules = number_of_top_rules;
+  memcpy (data->top_rules, top_rules, number_of_top_rules * sizeof (segment_rule_t));
+
+  __atomic_store_n (&(data->sequence), sequence + 2, __ATOMIC_RELEASE);
+
+  segment->last = now;
+  segment->last_packets = packets;
+  segment->last_dropped = dropped;
+}
+
+/* Fills top with the rules ranked by hits since the last publication,
+   then by total hits. Returns how many there are. */
+int fill_top_rules (segment_t *segment, segment_rule_t *top, double seconds)
+{
+  int number_of_top_rules = 0;
+
+  epoch_enter ();
+
+  rule_t *rules = __atomic_load_n (&(segment->context->rules), __ATOMIC_ACQUIRE);
+
+  if (rules != segment->rules)
+  {
+    track_rules (segment, rules);
+  }
+
+  for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+  {
+    uint64_t hits = __atomic_load_n (&(rule->hits), __ATOMIC_RELAXED);
+
+    if (hits == 0)
+    {
+      continue;
+    }
+
+    segment_rule_t entry;
+
+    entry.id = rule->id;
+    entry.hits = hits;
+    entry.hits_per_second = (double) (hits - segment->last_hits[rule->id]) / seconds;
+
+    segment->last_hits[rule->id] = hits;
+
+    insert_top_rule (top, &number_of_top_rules, &entry);
+  }
+
+  /* Messages are only copied for the rules that made it */
+  for (int i = 0; i < number_of_top_rules; i++)
+  {
+    segment_rule_t *entry = &(top[i]);
+
+    for (rule_t *rule = rules; rule != NULL; rule = rule->next)
+    {
+      if (rule->id == entry->id)
+      {
+        option_t *message = which_option (rule, STRING_MSG);
+
+        snprintf (entry->message, SEGMENT_MESSAGE_LENGTH, "%s", message != NULL ? message->value : "");
+        break;
+      }
+    }
+  }
+
+  epoch_exit ();
+
+  return number_of_top_rules;
+}
+
+bool ranks_before (segment_rule_t *, segment_rule_t *);
+
+void insert_top_rule (segment_rule_t *top, int *number, segment_rule_t *entry)
+{
+  int position = *number;
+
+  while (position > 0 && ranks_before (entry, &(top[position - 1])) == true)
+  {
+    position--;
+  }
+
+  if (position >= SEGMENT_TOP_RULES)
+  {
+    return;
+  }
+
+  int last = *number < SEGMENT_TOP_RULES ? *number : SEGMENT_TOP_RULES - 1;
+
+  memmove (&(top[position + 1]), &(top[position]), (last - position) * sizeof (segment_rule_t));
+
+  top[position] = *entry;
+
+  if (*number < SEGMENT_TOP_RULES)
+  {
+    (*number)++;
+  }
+}
+
+bool ranks_before (segment_rule_t *a, segment_rule_t *b)
+{
+  if (a->hits_per_second != b->hits_per_second)
+  {
+    return a->hits_per_second > b->hits_per_second;
+  }
+
+  return a->hits > b->hits;
+}
+
+/* Removes the name, readers that still have it mapped keep the last values */
+void segment_close (segment_t *segment)
+{
+  munmap (segment->data, sizeof (segment_data_t));
+  shm_unlink (segment->name);
+
+  free (segment->last_hits);
+  free (segment);
+}
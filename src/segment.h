@@ -0,0 +1,43 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include "structures.h"
+
+segment_t *segment_init (char *, context_t *);
+void segment_publish (segment_t *, stats_t *);
+void segment_close (segment_t *);
+
+/* Reader side of the seqlock, for tools attached to the segment. After a
+   few quick retries it sleeps between attempts, so a busy writer is not
+   spun against. Returns false if the writer kept it busy for every
+   attempt, about a second. */
+static inline bool segment_read (segment_data_t *shared, segment_data_t *copy)
+{
+  for (int attempt = 0; attempt < 1000; attempt++)
+  {
+    if (attempt >= 10)
+    {
+      usleep (1000);
+    }
+
+    uint64_t before = __atomic_load_n (&(shared->sequence), __ATOMIC_ACQUIRE);
+
+    if (before % 2 == 1)
+    {
+      continue;
+    }
+
+    memcpy (copy, shared, sizeof (segment_data_t));
+
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n (&(shared->sequence), __ATOMIC_RELAXED) == before)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+#endif
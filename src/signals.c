@@ -0,0 +1,61 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "signals.h"
+
+volatile sig_atomic_t dump_requested = 0;
+volatile sig_atomic_t profile_requested = 0;
+volatile sig_atomic_t reload_requested = 0;
+
+pcap_t *capture_handle = NULL;
+
+void handle_signal (int);
+
+/* Handlers only set flags, the capture loop acts on them between packets
+   and the reload thread polls for SIGHUP */
+void signals_init (pcap_t *handle)
+{
+  capture_handle = handle;
+
+  struct sigaction action;
+
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = handle_signal;
+  sigemptyset (&(action.sa_mask));
+
+  sigaction (SIGUSR1, &action, NULL);
+  sigaction (SIGUSR2, &action, NULL);
+  sigaction (SIGHUP, &action, NULL);
+  sigaction (SIGINT, &action, NULL);
+  sigaction (SIGTERM, &action, NULL);
+}
+
+void handle_signal (int signal_number)
+{
+  switch (signal_number)
+  {
+  case SIGUSR1:
+    profile_requested = 1;
+    break;
+
+  case SIGUSR2:
+    dump_requested = 1;
+    break;
+
+  case SIGHUP:
+    reload_requested = 1;
+    break;
+
+  case SIGINT:
+  case SIGTERM:
+    if (capture_handle != NULL)
+    {
+      pcap_breakloop (capture_handle);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
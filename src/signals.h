@@ -0,0 +1,12 @@
+#ifndef SIGNALS_H
+#define SIGNALS_H
+
+#include "libraries.h"
+
+extern volatile sig_atomic_t dump_requested;
+extern volatile sig_atomic_t profile_requested;
+extern volatile sig_atomic_t reload_requested;
+
+void signals_init (pcap_t *);
+
+#endif
@@ -0,0 +1,186 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "stages.h"
+
+/* Like the rule profile, every thread fills its own histograms. Reports
+   fold the interval histograms into the totals, so they must run on the
+   thread that owns them (or after it stopped). */
+
+__thread stages_t *thread_stages = NULL;
+
+stages_t *all_stages = NULL;
+pthread_mutex_t stages_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+double calibrated_cycles = 0;
+
+char *stage_names[NUMBER_OF_STAGES] = {
+  "capture wait", "parse", "classify", "match", "output", "latency"
+};
+
+stages_t *stages_init (void)
+{
+#ifdef STAGE_TIMING
+  stages_t *stages = (stages_t *) calloc (1, sizeof (stages_t));
+
+  cycles_per_nanosecond ();
+
+  stages->last_report = read_cycles ();
+
+  pthread_mutex_lock (&stages_mutex);
+  stages->next = all_stages;
+  all_stages = stages;
+  pthread_mutex_unlock (&stages_mutex);
+
+  thread_stages = stages;
+
+  return stages;
+#else
+  return NULL;
+#endif
+}
+
+/* Measures the cycle counter against the monotonic clock once */
+double cycles_per_nanosecond (void)
+{
+  if (calibrated_cycles > 0)
+  {
+    return calibrated_cycles;
+  }
+
+  struct timespec start, finish, pause = {0, 20000000};
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  uint64_t start_cycles = read_cycles ();
+
+  nanosleep (&pause, NULL);
+
+  clock_gettime (CLOCK_MONOTONIC, &finish);
+  uint64_t finish_cycles = read_cycles ();
+
+  double nanoseconds = (double) (finish.tv_sec - start.tv_sec) * 1e9 +
+                       (double) (finish.tv_nsec - start.tv_nsec);
+
+  calibrated_cycles = (double) (finish_cycles - start_cycles) / nanoseconds;
+
+  return calibrated_cycles;
+}
+
+/* Called by the capture thread for every packet: reports when the interval
+   has passed. A report that would wait for a scrape is put off to a later
+   packet, so capture never blocks on the mutex. */
+void stages_tick (int interval)
+{
+  stages_t *stages = thread_stages;
+
+  if (stages == NULL || interval <= 0)
+  {
+    return;
+  }
+
+  uint64_t now = read_cycles ();
+
+  if ((double) (now - stages->last_report) >= (double) interval * 1e9 * calibrated_cycles &&
+      stages_report (true, false) == true)
+  {
+    stages->last_report = now;
+  }
+}
+
+char *stage_name (int stage)
+{
+  return stage_names[stage];
+}
+
+/* Adds the totals of all threads to the NUMBER_OF_STAGES histograms given,
+   from any thread. The owners keep filling their histograms meanwhile;
+   the mutex only keeps reports from folding them while they are read. */
+void stages_load (histogram_t *merged)
+{
+#ifdef STAGE_TIMING
+  pthread_mutex_lock (&stages_mutex);
+
+  for (stages_t *stages = all_stages; stages != NULL; stages = stages->next)
+  {
+    for (int i = 0; i < NUMBER_OF_STAGES; i++)
+    {
+      histogram_load (&(merged[i]), &(stages->total[i]));
+      histogram_load (&(merged[i]), &(stages->interval[i]));
+    }
+  }
+
+  pthread_mutex_unlock (&stages_mutex);
+#endif
+}
+
+void print_stage (char *, histogram_t *, double);
+
+/* Prints the histograms of the last interval, or the totals since start.
+   Unless wait is true, returns false without printing anything when the
+   mutex is taken. */
+bool stages_report (bool interval, bool wait)
+{
+#ifdef STAGE_TIMING
+  if (wait == true)
+  {
+    pthread_mutex_lock (&stages_mutex);
+  }
+  else if (pthread_mutex_trylock (&stages_mutex) != 0)
+  {
+    return false;
+  }
+
+  histogram_t *merged = (histogram_t *) calloc (NUMBER_OF_STAGES, sizeof (histogram_t));
+
+  for (stages_t *stages = all_stages; stages != NULL; stages = stages->next)
+  {
+    for (int i = 0; i < NUMBER_OF_STAGES; i++)
+    {
+      if (interval == true)
+      {
+        histogram_merge (&(merged[i]), &(stages->interval[i]));
+      }
+
+      histogram_merge (&(stages->total[i]), &(stages->interval[i]));
+      memset (&(stages->interval[i]), 0, sizeof (histogram_t));
+
+      if (interval == false)
+      {
+        histogram_merge (&(merged[i]), &(stages->total[i]));
+      }
+    }
+  }
+
+  pthread_mutex_unlock (&stages_mutex);
+
+  printf ("Stage timing (%s, nanoseconds)\n", interval == true ? "last interval" : "total");
+  printf ("%-14s %12s %10s %10s %10s %10s %12s\n", "stage", "count", "mean", "p50", "p99", "p99.9", "max");
+
+  double scale = calibrated_cycles > 0 ? 1.0 / calibrated_cycles : 1.0;
+
+  for (int i = 0; i < NUMBER_OF_STAGES; i++)
+  {
+    print_stage (stage_names[i], &(merged[i]), i == STAGE_LATENCY ? 1.0 : scale);
+  }
+
+  printf ("\n");
+
+  free (merged);
+#endif
+
+  return true;
+}
+
+void print_stage (char *name, histogram_t *histogram, double scale)
+{
+  double mean = histogram->count > 0 ? (double) histogram->sum / (double) histogram->count : 0;
+
+  printf ("%-14s %12lu %10.0f %10.0f %10.0f %10.0f %12.0f\n",
+          name, (long unsigned) histogram->count,
+          mean * scale,
+          (double) histogram_percentile (histogram, 50) * scale,
+          (double) histogram_percentile (histogram, 99) * scale,
+          (double) histogram_percentile (histogram, 99.9) * scale,
+          (double) histogram->max * scale);
+}
@@ -0,0 +1,108 @@
+#ifndef STAGES_H
+#define STAGES_H
+
+#include "structures.h"
+#include "cycles.h"
+#include "histogram.h"
+
+enum {STAGE_WAIT = 0, STAGE_PARSE, STAGE_CLASSIFY, STAGE_MATCH, STAGE_OUTPUT, STAGE_LATENCY};
+
+extern __thread stages_t *thread_stages;
+
+stages_t *stages_init (void);
+bool stages_report (bool, bool);
+void stages_tick (int);
+double cycles_per_nanosecond (void);
+char *stage_name (int);
+void stages_load (histogram_t *);
+
+/* Probes used on the packet path. All of them compile to nothing
+   without STAGE_TIMING. */
+#ifdef STAGE_TIMING
+
+static inline uint64_t stage_begin (void)
+{
+  uint64_t now = read_cycles ();
+  stages_t *stages = thread_stages;
+
+  if (stages != NULL && stages->last_exit != 0)
+  {
+    histogram_add (&(stages->interval[STAGE_WAIT]), now - stages->last_exit);
+  }
+
+  return now;
+}
+
+static inline uint64_t stage_next (int stage, uint64_t start)
+{
+  uint64_t now = read_cycles ();
+
+  if (thread_stages != NULL)
+  {
+    histogram_add (&(thread_stages->interval[stage]), now - start);
+  }
+
+  return now;
+}
+
+/* Splits the time since start into header classification and option matching */
+static inline uint64_t stage_checked (uint64_t start)
+{
+  uint64_t now = read_cycles ();
+  stages_t *stages = thread_stages;
+
+  if (stages != NULL)
+  {
+    histogram_add (&(stages->interval[STAGE_CLASSIFY]), now - start - stages->match_cycles);
+    histogram_add (&(stages->interval[STAGE_MATCH]), stages->match_cycles);
+    stages->match_cycles = 0;
+  }
+
+  return now;
+}
+
+static inline void stage_latency (const struct pcap_pkthdr *pkthdr)
+{
+  if (thread_stages != NULL)
+  {
+    struct timespec now;
+    clock_gettime (CLOCK_REALTIME, &now);
+
+    int64_t latency = ((int64_t) now.tv_sec - (int64_t) pkthdr->ts.tv_sec) * 1000000000 +
+                      ((int64_t) now.tv_nsec - (int64_t) pkthdr->ts.tv_usec * 1000);
+
+    histogram_add (&(thread_stages->interval[STAGE_LATENCY]), latency > 0 ? (uint64_t) latency : 0);
+  }
+}
+
+static inline void stage_end (void)
+{
+  if (thread_stages != NULL)
+  {
+    thread_stages->last_exit = read_cycles ();
+  }
+}
+
+#define STAGE_BEGIN(start) uint64_t start = stage_begin ()
+#define STAGE_NEXT(stage, start) start = stage_next (stage, start)
+#define STAGE_CHECKED(start) start = stage_checked (start)
+#define STAGE_LATENCY(pkthdr) stage_latency (pkthdr)
+#define STAGE_END() stage_end ()
+
+#define MATCH_BEGIN(start) uint64_t start = read_cycles ()
+#define MATCH_END(start) do { if (thread_stages != NULL) thread_stages->match_cycles += read_cycles () - (start); } while (0)
+
+#else
+
+#define STAGE_BEGIN(start) do { } while (0)
+#define STAGE_NEXT(stage, start) do { } while (0)
+#define STAGE_CHECKED(start) do { } while (0)
+#define STAGE_LATENCY(pkthdr) do { } while (0)
+#define STAGE_END() do { } while (0)
+
+#define MATCH_BEGIN(start) do { } while (0)
+#define MATCH_END(start) do { } while (0)
+
+#endif
+
+#endif
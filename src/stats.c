@@ -0,0 +1,256 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "packet.h"
+#include "segment.h"
+#include "epoch.h"
+#include "talkers.h"
+
+#include "stats.h"
+
+#define STOP_POLL (100000) /* microseconds */
+
+void *stats_thread (void *);
+void write_stats_file (stats_t *);
+void write_talkers (FILE *, int);
+
+/* The thread is only started when the statistics go to a file, the
+   metrics server or the shared segment. Either way they are collected and
+   printed once more by stats_close. */
+stats_t *stats_init (settings_t *settings, counters_t *counters, exporter_t *exporter,
+                     segment_t *segment, pcap_t *handle)
+{
+  stats_t *stats = (stats_t *) calloc (1, sizeof (stats_t));
+  if (stats == NULL)
+  {
+    fprintf (stderr, "Could not allocate statistics\n");
+    exit (EXIT_FAILURE);
+  }
+
+  stats->handle = handle;
+  stats->counters = counters;
+  stats->exporter = exporter;
+  stats->segment = segment;
+  stats->filename = settings->stats_file;
+  stats->started = time (NULL);
+  stats->top_talkers = settings->top_talkers;
+
+  stats_collect (stats);
+
+  if (stats->filename != NULL || settings->metrics_address != NULL || segment != NULL)
+  {
+    int rv = pthread_create (&(stats->thread), NULL, stats_thread, stats);
+    if (rv != 0)
+    {
+      fprintf (stderr, "Could not start the statistics thread\n");
+      exit (EXIT_FAILURE);
+    }
+
+    stats->running = true;
+  }
+
+  return stats;
+}
+
+/* Called by the capture thread for every packet: reads the kernel
+   counters when the second of the packet changes. The handle is only used
+   by the capture thread, the statistics thread reads the copies. */
+void stats_tick (stats_t *stats, const struct pcap_pkthdr *pkthdr)
+{
+  if ((int64_t) pkthdr->ts.tv_sec != stats->collected_second)
+  {
+    stats->collected_second = (int64_t) pkthdr->ts.tv_sec;
+    stats_collect (stats);
+  }
+}
+
+/* Reads the kernel counters, on the capture thread or once it stopped */
+void stats_collect (stats_t *stats)
+{
+  struct pcap_stat now;
+  capture_stats_t *capture = &(stats->capture);
+
+  if (pcap_stats (stats->handle, &now) != 0)
+  {
+    __atomic_store_n (&(capture->available), false, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if (capture->available == false)
+  {
+    capture->last = now;
+  }
+
+  /* Unsigned differences stay right when the 32 bit counters wrap */
+  __atomic_store_n (&(capture->received),
+                    capture->received + (uint32_t) (now.ps_recv - capture->last.ps_recv), __ATOMIC_RELAXED);
+  __atomic_store_n (&(capture->dropped),
+                    capture->dropped + (uint32_t) (now.ps_drop - capture->last.ps_drop), __ATOMIC_RELAXED);
+  __atomic_store_n (&(capture->interface_dropped),
+                    capture->interface_dropped + (uint32_t) (now.ps_ifdrop - capture->last.ps_ifdrop),
+                    __ATOMIC_RELAXED);
+  __atomic_store_n (&(capture->available), true, __ATOMIC_RELAXED);
+
+  capture->last = now;
+}
+
+/* One "name value" pair per line */
+void stats_write (FILE *file, stats_t *stats)
+{
+  counters_t *counters = stats->counters;
+  capture_stats_t *capture = &(stats->capture);
+
+  fprintf (file, "uptime_seconds %ld\n", (long) (time (NULL) - stats->started));
+
+  if (__atomic_load_n (&(capture->available), __ATOMIC_RELAXED) == true)
+  {
+    fprintf (file, "capture_received %lu\n",
+             (long unsigned) __atomic_load_n (&(capture->received), __ATOMIC_RELAXED));
+    fprintf (file, "capture_dropped %lu\n",
+             (long unsigned) __atomic_load_n (&(capture->dropped), __ATOMIC_RELAXED));
+    fprintf (file, "capture_interface_dropped %lu\n",
+             (long unsigned) __atomic_load_n (&(capture->interface_dropped), __ATOMIC_RELAXED));
+  }
+
+  fprintf (file, "packets %lu\n", (long unsigned) __atomic_load_n (&(counters->packets), __ATOMIC_RELAXED));
+  fprintf (file, "parsed %lu\n", (long unsigned) __atomic_load_n (&(counters->parsed), __ATOMIC_RELAXED));
+
+  for (int i = REJECT_NONE + 1; i < NUMBER_OF_REJECT_REASONS; i++)
+  {
+    fprintf (file, "rejected_%s %lu\n", reject_reason_name (i),
+             (long unsigned) __atomic_load_n (&(counters->rejected[i]), __ATOMIC_RELAXED));
+  }
+
+  uint64_t prefiltered = __atomic_load_n (&(counters->prefiltered), __ATOMIC_RELAXED);
+  uint64_t skipped = __atomic_load_n (&(counters->prefilter_skipped), __ATOMIC_RELAXED);
+
+  fprintf (file, "prefilter_rows %lu\n", (long unsigned) prefiltered);
+  fprintf (file, "prefilter_skipped %lu\n", (long unsigned) skipped);
+  fprintf (file, "prefilter_skipped_percent %.1f\n", prefiltered > 0 ? 100.0 * skipped / prefiltered : 0.0);
+  fprintf (file, "matched %lu\n", (long unsigned) __atomic_load_n (&(counters->matched), __ATOMIC_RELAXED));
+  fprintf (file, "scan_alerts %lu\n", (long unsigned) __atomic_load_n (&(counters->scan_alerts), __ATOMIC_RELAXED));
+  fprintf (file, "scan_evictions %lu\n", (long unsigned) __atomic_load_n (&(counters->scan_evictions), __ATOMIC_RELAXED));
+  fprintf (file, "rate_alerts %lu\n", (long unsigned) __atomic_load_n (&(counters->rate_alerts), __ATOMIC_RELAXED));
+  fprintf (file, "alerts %lu\n", (long unsigned) __atomic_load_n (&(counters->alerts), __ATOMIC_RELAXED));
+  fprintf (file, "output_bytes %lu\n", (long unsigned) __atomic_load_n (&(counters->output_bytes), __ATOMIC_RELAXED));
+
+  if (stats->exporter != NULL)
+  {
+    fprintf (file, "export_packets %lu\n",
+             (long unsigned) __atomic_load_n (&(stats->exporter->exported), __ATOMIC_RELAXED));
+    fprintf (file, "export_dropped %lu\n",
+             (long unsigned) __atomic_load_n (&(stats->exporter->dropped), __ATOMIC_RELAXED));
+  }
+
+  if (stats->top_talkers > 0)
+  {
+    write_talkers (file, stats->top_talkers);
+  }
+}
+
+/* The heaviest talkers of each summary, one per line after the name: the
+   key, its count and how much the count may be above the true one */
+void write_talkers (FILE *file, int top)
+{
+  talker_summary_t *summaries = talkers_load ();
+  char key[LINE_LENGTH];
+
+  for (int i = 0; i < TALKER_SUMMARIES; i++)
+  {
+    for (int j = 0; j < top && j < summaries[i].number_of_talkers; j++)
+    {
+      talker_t *talker = &(summaries[i].talkers[j]);
+
+      format_talker (key, i, talker);
+      fprintf (file, "talker_%s %s %lu %lu\n", talker_name (i), key,
+               (long unsigned) talker->count, (long unsigned) talker->error);
+    }
+  }
+
+  free (summaries);
+}
+
+void *stats_thread (void *arg)
+{
+  stats_t *stats = (stats_t *) arg;
+
+  /* The segment lists rules */
+  epoch_register ();
+
+  while (true)
+  {
+    for (int i = 0; i < STATS_INTERVAL * 1000000 / STOP_POLL; i++)
+    {
+      if (__atomic_load_n (&(stats->stop), __ATOMIC_ACQUIRE) == true)
+      {
+        epoch_unregister ();
+        return NULL;
+      }
+
+      usleep (STOP_POLL);
+    }
+
+    if (stats->filename != NULL)
+    {
+      write_stats_file (stats);
+    }
+
+    if (stats->segment != NULL)
+    {
+      segment_publish (stats->segment, stats);
+    }
+  }
+
+  return NULL;
+}
+
+/* Readers never see a partly written file */
+void write_stats_file (stats_t *stats)
+{
+  char temporary[LINE_LENGTH];
+
+  snprintf (temporary, LINE_LENGTH, "%s.tmp", stats->filename);
+
+  FILE *file = fopen (temporary, "w");
+  if (file == NULL)
+  {
+    fprintf (stderr, "Could not open %s\n", temporary);
+    return;
+  }
+
+  stats_write (file, stats);
+
+  if (fclose (file) != 0 || rename (temporary, stats->filename) != 0)
+  {
+    fprintf (stderr, "Could not write %s\n", stats->filename);
+  }
+}
+
+/* Stops the thread, then collects, writes and prints the final values */
+void stats_close (stats_t *stats)
+{
+  if (stats->running == true)
+  {
+    __atomic_store_n (&(stats->stop), true, __ATOMIC_RELEASE);
+    pthread_join (stats->thread, NULL);
+  }
+
+  stats_collect (stats);
+
+  if (stats->filename != NULL)
+  {
+    write_stats_file (stats);
+  }
+
+  if (stats->segment != NULL)
+  {
+    segment_publish (stats->segment, stats);
+  }
+
+  printf ("Statistics\n");
+  stats_write (stdout, stats);
+  printf ("\n");
+
+  free (stats);
+}
@@ -0,0 +1,17 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "structures.h"
+
+/* Counters have a single writer, so a relaxed store of the incremented
+   value is enough for readers on other threads */
+#define COUNT(counter, amount) \
+  __atomic_store_n (&(counter), (counter) + (amount), __ATOMIC_RELAXED)
+
+stats_t *stats_init (settings_t *, counters_t *, exporter_t *, segment_t *, pcap_t *);
+void stats_tick (stats_t *, const struct pcap_pkthdr *);
+void stats_collect (stats_t *);
+void stats_write (FILE *, stats_t *);
+void stats_close (stats_t *);
+
+#endif
@@ -27,9 +27,180 @@ typedef struct port_tag
 port_t;
 
 struct option_tag;
+struct packet_tag;
+
+typedef struct arena_block_tag
+{
+  struct arena_block_tag *next;
+
+  size_t size;
+  size_t used;
+
+  uint8_t data[];
+}
+arena_block_t;
+
+typedef struct arena_tag
+{
+  arena_block_t *blocks;
+
+  size_t block_size;
+  size_t allocated;
+}
+arena_t;
+
+/* Flags of rule_headers_t port_lists */
+enum {SOURCE_PORT_LIST = 1, DEST_PORT_LIST = 2};
+
+/* Fields checked for every rule, one array per field, in the order the
+   rules are checked. Rules that pass them are looked up in rules[]. An
+   ordering is one allocation, never changed once published but for its
+   counters: the rule orderer replaces it as a whole. */
+typedef struct rule_headers_tag
+{
+  int number;
+
+  /* Written by the capture thread while rows are counted */
+  uint64_t packets;
+  uint64_t *passed; /* packets whose header matched the row */
+  uint64_t *matched;
+
+  struct rule_tag **rules;
+
+  uint8_t *protocols; /* IP protocol number, 6 for tcp and http rules */
+  uint8_t *port_lists; /* ports given as lists are checked on the rule */
+
+  uint32_t *source_ip_start;
+  uint32_t *source_ip_finish;
+  uint32_t *dest_ip_start;
+  uint32_t *dest_ip_finish;
+
+  uint16_t *source_port_start;
+  uint16_t *source_port_finish;
+  uint16_t *dest_port_start;
+  uint16_t *dest_port_finish;
+
+  int32_t *patterns; /* fast pattern of the row in the prefilter, or -1 */
+}
+rule_headers_t;
+
+/* What the load-time analysis took out of the rows checked per packet */
+typedef struct rule_analysis_tag
+{
+  int rules;
+  int rows; /* left to check */
+
+  int duplicates; /* same header, options and message as an earlier rule */
+  int shadowed; /* every packet they match is matched by an earlier rule */
+  int merged; /* folded into an earlier rule differing in one IP range or port set */
+  int groups; /* rows standing for merged rules */
+
+  int option_checks; /* options of all rules */
+  int option_checks_left; /* options of the rows */
+}
+rule_analysis_t;
+
+/* What the matcher generated by native.c calls back into, for content and
+   for the options it leaves to the interpreter */
+typedef struct native_calls_tag
+{
+  void *(*find_needle) (const void *, size_t, const void *, size_t);
+  void *(*find_needle_nocase) (const void *, size_t, const void *, size_t);
+  bool (*check_option) (struct option_tag *, struct packet_tag *);
+  struct option_tag **options;
+}
+native_calls_t;
+
+/* Returns the row that matched the packet, or -1 */
+typedef int (*native_match_t) (const uint8_t *, const native_calls_t *);
+
+/* Rule set compiled to a shared object, checked in place of the header
+   arrays when neither the profiler nor the rule orderer needs them */
+typedef struct native_tag
+{
+  void *library;
+  native_match_t match;
+  native_calls_t calls;
+
+  struct rule_tag **rows; /* in the order they were compiled */
+  int number;
+  int number_of_options; /* left to the interpreter */
+}
+native_t;
+
+/* Fast patterns of the rows, searched for all at once in a payload by an
+   Aho-Corasick automaton over case folded bytes. A row can only match a
+   packet whose payload holds its fast pattern, so the rest of the row is
+   only checked after a hit. The stamps are written by the capture thread
+   only. */
+typedef struct prefilter_tag
+{
+  int number_of_patterns;
+  int number_of_states;
+  int shift; /* log2 of the columns per state */
+
+  uint8_t classes[256]; /* column of each byte, 0 for bytes in no pattern */
+  int32_t *transitions; /* next state << shift, negative where a pattern ends */
+  int32_t *reports; /* longest pattern ending at each state, or -1 */
+  int32_t *suffixes; /* longest pattern ending inside each pattern's end, or -1 */
+
+  uint8_t *bytes; /* of each pattern, folded, at a fixed stride */
+  uint8_t *lengths; /* of each pattern */
+
+  uint32_t stamp; /* of the current payload */
+  uint32_t *seen; /* stamp of the last payload scanned each pattern was found in */
+  uint32_t *searched; /* stamp of the last payload each pattern was searched in */
+  uint32_t *found; /* stamp of the last payload a search found each pattern in */
+  int searches; /* in the current payload */
+  bool scanned; /* for all the patterns at once */
+
+  int rows; /* with a fast pattern */
+}
+prefilter_t;
+
+/* Memory behind a whole rule list, released at once by free_rules. The
+   hot arena holds the port lists, the cold arena the rules, options and
+   strings. */
+typedef struct rule_storage_tag
+{
+  arena_t hot;
+  arena_t cold;
+
+  rule_headers_t *headers; /* replaced by the rule orderer, read inside epoch sections */
+  rule_analysis_t analysis;
+
+  native_t *native; /* NULL unless the rules were compiled to native code */
+  prefilter_t *prefilter; /* NULL when no row has a content */
+
+  void *mapping; /* compiled rule cache the strings point into */
+  size_t mapping_length;
+
+  int next_option_id;
+
+  /* A reload shares the strings, options and ports of unchanged rules
+     with the storages they were parsed into */
+  int references; /* this list and the lists borrowing from it */
+  struct rule_storage_tag *borrowed[REUSE_GENERATIONS];
+  int number_borrowed;
+}
+rule_storage_t;
+
+/* What a reload could keep from the rules it replaced */
+typedef struct rule_reuse_tag
+{
+  int rules; /* in the new set */
+  int reused; /* copied from a rule with the same text */
+  int parsed;
+  int removed; /* rules of the old set that were not reused */
+
+  bool rebuilt; /* too much had changed to keep looking */
+}
+rule_reuse_t;
 
 typedef struct rule_tag
 {
+  int id; /* position in the rule file */
+
   char *str;
 
   char *protocol;
@@ -42,21 +213,162 @@ typedef struct rule_tag
 
   struct option_tag *options;
 
+  int fast_pattern; /* of a row, in the prefilter of its storage, or -1 */
+
+  /* Set on the rows the analysis merged, which are not in the list: the
+     rules they stand for, in list order */
+  struct rule_tag **members;
+  int number_of_members;
+
+  uint64_t hits; /* written by the capture thread only */
+  uint64_t hash; /* of the text without surrounding spaces, 0 if not known */
+
+  rule_storage_t *storage; /* shared by all rules of the list */
+  rule_storage_t *origin; /* holds the strings, options and ports */
+
   struct rule_tag *prev;
   struct rule_tag *next;
 }
 rule_t;
 
+/* Where a content option is searched for, set by the modifiers after it
+   in the rule. A relative content (distance or within) is searched for
+   after the match of the content before it, and is checked together with
+   that content. */
+typedef struct content_tag
+{
+  int start; /* offset, or distance from the end of the previous match */
+  int length; /* depth, or within; 0 searches to the end of the payload */
+  bool nocase;
+  bool relative;
+  struct option_tag *previous; /* the content a relative content follows */
+  struct option_tag *following; /* the relative content after this one */
+}
+content_t;
+
 typedef struct option_tag {
+  int id; /* unique among the options of a rule list */
+
   char *name;
-  char *value;
+  char *value; /* always terminated, but a content may hold NUL bytes */
+  int value_length;
   struct option_tag *next;
+
+  bool modifier; /* folded into the content before it */
+  content_t content;
 }
 option_t;
 
+/* Compiled rule cache file. Sections hold no pointers, only offsets from
+   the start of the file, so it can be mapped at any address. */
+typedef struct cache_header_tag
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+
+  uint64_t source_hash; /* FNV-1a of the rule file */
+  uint64_t source_size;
+  uint64_t file_size;
+
+  uint32_t number_of_rules;
+  uint32_t number_of_options;
+  uint32_t number_of_ports;
+  uint32_t strings_size;
+
+  uint64_t rules_offset;
+  uint64_t options_offset;
+  uint64_t ports_offset;
+  uint64_t strings_offset;
+
+  /* Result of the rule analysis, so loading the cache does not redo it */
+  uint32_t number_of_rows;
+  uint32_t number_of_members;
+  uint32_t duplicates;
+  uint32_t shadowed;
+
+  uint64_t rows_offset;
+  uint64_t members_offset;
+}
+cache_header_t;
+
+typedef struct cache_port_tag
+{
+  uint32_t str; /* offset in the strings section */
+
+  uint32_t colon_found;
+  uint32_t start;
+  uint32_t finish;
+
+  uint32_t number_of_ports;
+  uint32_t first_port; /* index in the ports section */
+}
+cache_port_t;
+
+/* Rules and their options are stored in list order */
+typedef struct cache_rule_tag
+{
+  int32_t id;
+
+  uint32_t str;
+  uint32_t protocol;
+
+  uint32_t source_ip_str;
+  uint32_t source_ip_start;
+  uint32_t source_ip_finish;
+
+  uint32_t dest_ip_str;
+  uint32_t dest_ip_start;
+  uint32_t dest_ip_finish;
+
+  cache_port_t source_port;
+  cache_port_t dest_port;
+
+  uint32_t number_of_options;
+  uint32_t first_option; /* index in the options section */
+}
+cache_rule_t;
+
+typedef struct cache_option_tag
+{
+  int32_t id;
+
+  uint32_t name;
+  uint32_t value;
+  uint32_t value_length;
+
+  int32_t start;
+  int32_t length;
+  uint8_t flags; /* CACHE_OPTION_ flags */
+  uint8_t padding[3];
+  int32_t previous; /* index among the options of the rule, or -1 */
+  int32_t following;
+}
+cache_option_t;
+
+/* Rows checked per packet, in order. A merged row is its first member
+   with the ranges and ports of the whole group. */
+typedef struct cache_row_tag
+{
+  uint32_t rule; /* id of the rule, or of the first member */
+
+  uint32_t number_of_members; /* 0 unless merged */
+  uint32_t first_member; /* index in the members section, of rule ids */
+
+  uint32_t source_ip_start;
+  uint32_t source_ip_finish;
+  uint32_t dest_ip_start;
+  uint32_t dest_ip_finish;
+
+  cache_port_t source_port;
+  cache_port_t dest_port;
+}
+cache_row_t;
+
 typedef struct packet_tag
 {
   bool valid;
+  int reject_reason; /* REJECT_NONE when valid */
 
   /* Network layer */
   uint8_t version; /* 4 bits */
@@ -66,6 +378,7 @@ typedef struct packet_tag
   uint16_t frag_offset; /* 13 bits */
 
   char transport_protocol[STRING_LENGTH];
+  uint8_t protocol; /* IP protocol number of transport_protocol */
 
   uint32_t source_IP;
   uint32_t dest_IP;
@@ -85,6 +398,540 @@ typedef struct packet_tag
 }
 packet_t;
 
+/* Command line settings */
+typedef struct settings_tag
+{
+  char *rules_filename;
+  char *rule_cache; /* compiled rule cache file, NULL to always parse */
+
+  int sample_rate; /* print one of every N benign packets, 0 disables */
+  int recorder_size; /* number of packets kept by the flight recorder */
+
+  char *export_prefix; /* pcap files of matched packets, NULL disables */
+  int export_context; /* packets of the same flow exported before a match */
+  long export_file_size; /* bytes per pcap file before rotating */
+  int export_file_time; /* seconds per pcap file before rotating */
+
+  char *alert_log; /* one line per alert, NULL disables */
+  bool compress; /* gzip the exported pcap files and the alert log */
+
+  int profile_top; /* rules shown by the rule profile, 0 disables profiling */
+
+  int stage_interval; /* seconds between stage timing reports, 0 only at exit */
+
+  char *stats_file; /* rewritten every STATS_INTERVAL seconds */
+  char *metrics_address; /* Unix socket path, or a loopback TCP port */
+  char *segment_name; /* POSIX shared memory name read by nids_top */
+
+  int order_interval; /* seconds between rule orderings, 0 keeps the file order */
+  bool native_rules; /* compile every rule set with the system compiler */
+
+  int scan_ports; /* distinct destination ports of one source, 0 disables */
+  int scan_hosts; /* distinct destination hosts of one source, 0 disables */
+  int scan_window; /* seconds the distinct ports and hosts are counted over */
+
+  int syn_rate; /* SYN packets per second to one destination, 0 disables */
+  int udp_rate; /* UDP packets per second from one source, 0 disables */
+
+  int top_talkers; /* heavy hitters reported per summary, 0 disables */
+}
+settings_t;
+
+/* One flight recorder slot */
+typedef struct record_tag
+{
+  struct pcap_pkthdr header;
+
+  bool valid;
+  bool tcp;
+  bool exported;
+  uint8_t flags;
+
+  uint32_t source_IP;
+  uint32_t dest_IP;
+
+  uint16_t source_port;
+  uint16_t dest_port;
+
+  uint32_t raw_length;
+  uint8_t raw[RECORD_LENGTH];
+}
+record_t;
+
+/* Fixed-size ring of recently captured packets */
+typedef struct recorder_tag
+{
+  record_t *records;
+
+  uint64_t mask; /* size - 1, size is a power of two */
+  uint64_t head; /* number of packets recorded so far */
+  uint64_t dumped; /* first record that has not been dumped yet */
+  int64_t next_alert_dump; /* packet time before which alerts do not dump */
+}
+recorder_t;
+
+/* Single producer, single consumer byte ring */
+typedef struct queue_tag
+{
+  uint8_t *buffer;
+  uint64_t size; /* power of two */
+
+  uint64_t head; /* written by the producer only */
+  uint64_t tail; /* written by the consumer only */
+
+  uint64_t reserved; /* length of the entry being written, with any padding before it */
+}
+queue_t;
+
+/* Totals of one compressed output stream, over all of its files */
+typedef struct compression_stats_tag
+{
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+
+  uint64_t blocks;
+  uint64_t stalls; /* blocks handed over while the previous one was still compressing */
+  uint64_t dropped; /* bytes refused for want of memory to queue a stalled block */
+
+  double seconds; /* spent in deflate */
+}
+compression_stats_t;
+
+/* Block that filled up while another was being compressed */
+typedef struct pending_block_tag
+{
+  uint8_t *data;
+  size_t length;
+
+  struct pending_block_tag *next;
+}
+pending_block_t;
+
+/* Stdio stream that gzips double-buffered blocks on its own thread */
+typedef struct compressor_tag
+{
+  FILE *output;
+  z_stream stream;
+  uint8_t *out_buffer;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  uint8_t *blocks[2];
+  size_t lengths[2];
+  int active; /* block being filled by the writer */
+  bool full; /* the other block is queued or being compressed */
+  bool finish;
+  bool never_wait; /* queue a block as pending rather than wait for the thread */
+
+  pending_block_t *pending; /* oldest first, written only with never_wait */
+  pending_block_t *pending_tail;
+
+  bool degraded; /* fell behind once, blocks are stored uncompressed */
+  bool level_lowered;
+
+  compression_stats_t stats;
+  compression_stats_t *totals;
+}
+compressor_t;
+
+/* Background writer of matched packets to rotating pcap files */
+typedef struct exporter_tag
+{
+  queue_t *queue;
+
+  pthread_t thread;
+  bool stop;
+
+  pcap_t *dead_handle;
+  pcap_dumper_t *dumper;
+  FILE *file;
+
+  char *prefix;
+  long file_size_limit;
+  int file_time_limit;
+
+  long file_size;
+  time_t file_opened;
+  int file_count;
+
+  bool compress;
+  compression_stats_t compression;
+
+  uint64_t exported; /* updated by the writer thread */
+  uint64_t dropped; /* updated by the capture thread */
+}
+exporter_t;
+
+/* Cost of evaluating one rule or option */
+typedef struct cost_tag
+{
+  uint64_t checks;
+  uint64_t matches;
+
+  uint64_t cycles;
+  uint64_t max_cycles;
+}
+cost_t;
+
+/* Rule profiling counters of one thread */
+typedef struct profile_tag
+{
+  int number_of_rules;
+  int number_of_options;
+
+  cost_t *rules; /* indexed by rule id */
+  cost_t *options; /* indexed by option id */
+
+  struct profile_tag *next; /* list of all threads' profiles */
+}
+profile_t;
+
+/* Log-bucket histogram with 1/16 relative precision */
+typedef struct histogram_tag
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+}
+histogram_t;
+
+/* One counter of a Space-Saving summary. The true count of the key is
+   between count - error and count. */
+typedef struct talker_tag
+{
+  uint64_t key[2]; /* addresses, then ports and protocol */
+  uint64_t count;
+  uint64_t error; /* counted for the keys it replaced */
+  uint32_t hash;
+  int16_t slot; /* in the index */
+  int16_t position; /* in the heap */
+}
+talker_t;
+
+/* Heap entry: a copy of the count of a talker, so sifting only moves
+   these */
+typedef struct talker_count_tag
+{
+  uint64_t count;
+  int32_t talker;
+}
+talker_count_t;
+
+/* Space-Saving summary over a fixed number of counters: a key that is
+   not counted takes the smallest counter over. Any key with more than
+   total / TALKER_COUNTERS is in it, and no count is over by more. */
+typedef struct talker_summary_tag
+{
+  talker_t talkers[TALKER_COUNTERS];
+  talker_count_t heap[TALKER_COUNTERS]; /* smallest count first */
+  int16_t index[TALKER_SLOTS]; /* talker of each slot by hash, linear probing, -1 for none */
+  int number_of_talkers;
+  uint64_t total;
+}
+talker_summary_t;
+
+/* Heavy hitters of one thread, by packets and bytes per source,
+   destination, destination port and flow. The owner publishes a copy
+   once a second for reports, which merge the copies of all threads. */
+typedef struct talkers_tag
+{
+  talker_summary_t live[TALKER_SUMMARIES];
+  talker_summary_t published[TALKER_SUMMARIES];
+  int64_t published_second;
+
+  struct talkers_tag *next;
+}
+talkers_t;
+
+/* Per-stage timing of one thread */
+typedef struct stages_tag
+{
+  histogram_t interval[NUMBER_OF_STAGES];
+  histogram_t total[NUMBER_OF_STAGES];
+
+  uint64_t last_exit; /* cycles when the previous packet was done */
+  uint64_t match_cycles; /* spent in options of the current packet */
+  uint64_t last_report;
+
+  struct stages_tag *next;
+}
+stages_t;
+
+/* Counters of the capture thread. Only that thread writes them, the
+   stats thread reads them with relaxed atomic loads. */
+typedef struct counters_tag
+{
+  uint64_t packets;
+  uint64_t parsed;
+  uint64_t rejected[NUMBER_OF_REJECT_REASONS];
+
+  uint64_t prefiltered; /* rows whose header matched that have a fast pattern */
+  uint64_t prefilter_skipped; /* of which the payload did not hold the pattern */
+
+  uint64_t matched; /* packets that matched a rule */
+  uint64_t scan_alerts; /* of the port scan detector */
+  uint64_t scan_evictions; /* sources forgotten to make room for others */
+  uint64_t rate_alerts; /* of the SYN and UDP rate detector */
+  uint64_t alerts;
+  uint64_t output_bytes; /* written to the alert log */
+}
+counters_t;
+
+/* Kernel capture counters, widened to 64 bits as pcap_stats wraps */
+typedef struct capture_stats_tag
+{
+  bool available;
+
+  uint64_t received;
+  uint64_t dropped;
+  uint64_t interface_dropped;
+
+  struct pcap_stat last;
+}
+capture_stats_t;
+
+/* Layout of the shared memory segment read by nids_top. Readers copy it
+   and retry while sequence is odd or changed during the copy. */
+typedef struct segment_worker_tag
+{
+  uint64_t packets;
+  uint64_t matched;
+  double packets_per_second;
+}
+segment_worker_t;
+
+typedef struct segment_rule_tag
+{
+  int id;
+  uint64_t hits;
+  double hits_per_second;
+  char message[SEGMENT_MESSAGE_LENGTH];
+}
+segment_rule_t;
+
+typedef struct segment_data_tag
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sequence;
+
+  int64_t pid;
+  int64_t started;
+  int64_t updated;
+
+  bool capture_available;
+  uint64_t capture_received;
+  uint64_t capture_dropped;
+  uint64_t capture_interface_dropped;
+  double drops_per_second;
+
+  uint64_t packets;
+  uint64_t parsed;
+  uint64_t rejected;
+  uint64_t matched;
+  uint64_t alerts;
+  uint64_t output_bytes;
+
+  int number_of_workers;
+  segment_worker_t workers[SEGMENT_WORKERS];
+
+  uint64_t recorder_used;
+  uint64_t recorder_size;
+
+  bool exporting;
+  uint64_t export_queue_used;
+  uint64_t export_queue_size;
+  uint64_t export_packets;
+  uint64_t export_dropped;
+
+  int number_of_rules;
+  int number_of_top_rules;
+  segment_rule_t top_rules[SEGMENT_TOP_RULES];
+}
+segment_data_t;
+
+/* Publisher side of the segment, owned by the statistics thread */
+typedef struct segment_tag
+{
+  char *name;
+  segment_data_t *data;
+
+  struct context_tag *context;
+
+  struct timespec last;
+  uint64_t last_packets;
+  uint64_t last_dropped;
+  rule_t *rules; /* the set last_hits belongs to, only compared */
+  uint64_t *last_hits; /* indexed by rule id */
+  int number_of_rules;
+}
+segment_t;
+
+/* Publishes the capture statistics, which the capture thread collects
+   once a second, together with its counters */
+typedef struct stats_tag
+{
+  pthread_t thread;
+  bool running;
+  bool stop;
+
+  pcap_t *handle;
+  counters_t *counters;
+  exporter_t *exporter;
+  segment_t *segment;
+
+  char *filename;
+  time_t started;
+
+  int top_talkers; /* heavy hitters written per summary */
+
+  capture_stats_t capture; /* written by the capture thread only */
+  int64_t collected_second;
+}
+stats_t;
+
+/* Serves Prometheus text to local scrapers from its own thread */
+typedef struct metrics_tag
+{
+  pthread_t thread;
+  bool stop;
+
+  int listen_fd;
+  char *socket_path; /* unlinked on close, NULL for TCP */
+
+  struct context_tag *context;
+}
+metrics_t;
+
+/* A thread that reads a published rule set. active holds the epoch the
+   thread entered its read section in, 0 outside of one. */
+typedef struct epoch_reader_tag
+{
+  uint64_t active;
+
+  struct epoch_reader_tag *next; /* list of all readers */
+}
+epoch_reader_t;
+
+/* Rebuilds the rule set in the background when a reload is requested */
+typedef struct reloader_tag
+{
+  pthread_t thread;
+  bool stop;
+
+  struct context_tag *context;
+
+  int reloads;
+  int failures;
+
+  time_t last_ordering;
+  int orderings;
+}
+reloader_t;
+
+/* Tag of one way of the scan table, kept apart from the bitmaps so a
+   whole set is compared in one cache line */
+typedef struct scan_way_tag
+{
+  uint32_t address;
+  uint32_t last_seen; /* seconds, 0 for a free way */
+}
+scan_way_t;
+
+/* Destination ports and hosts one source sent probes to, as bitmaps over
+   the current and the previous half window. Counts are of the bits set
+   in the union of both halves. */
+typedef struct scan_source_tag
+{
+  int64_t half; /* index of the current half window */
+
+  uint16_t port_bits;
+  uint16_t host_bits;
+
+  uint64_t ports[2][SCAN_BITMAP_BITS / 64];
+  uint64_t hosts[2][SCAN_BITMAP_BITS / 64];
+}
+scan_source_t;
+
+/* Fixed table of sources, set associative and evicting the source seen
+   least recently, so its memory does not grow with the traffic */
+typedef struct scan_detector_tag
+{
+  scan_way_t *ways; /* SCAN_SETS sets of SCAN_WAYS */
+  scan_source_t *sources; /* same index as the ways */
+
+  int half_window; /* seconds */
+  int port_bits; /* bits set when a source reached the port threshold, 0 disables */
+  int host_bits;
+
+  /* What the alerts are printed and logged as */
+  rule_t port_rule;
+  rule_t host_rule;
+  option_t port_message;
+  option_t host_message;
+  char port_text[LINE_LENGTH];
+  char host_text[LINE_LENGTH];
+}
+scan_detector_t;
+
+/* Count-min sketch of the packets per key in the current and the
+   previous second. The previous second is weighed by the part of it
+   still within one second of the packet, so the rate decays smoothly
+   instead of dropping to zero at each new second. */
+typedef struct rate_sketch_tag
+{
+  uint32_t counts[2][RATE_DEPTH * RATE_WIDTH]; /* by second & 1 */
+  uint64_t alerted[RATE_ALERTED_BITS / 64]; /* keys alerted for in the current second */
+
+  int64_t second; /* current second */
+  uint32_t threshold; /* packets per second */
+
+  rule_t rule; /* what the alerts are printed and logged as */
+  option_t message;
+  char text[LINE_LENGTH];
+}
+rate_sketch_t;
+
+/* SYN packets per destination and UDP packets per source */
+typedef struct rate_detector_tag
+{
+  rate_sketch_t syn;
+  rate_sketch_t udp;
+}
+rate_detector_t;
+
+/* State handed to the pcap callback */
+typedef struct context_tag
+{
+  rule_t *rules; /* replaced by the reloader, read inside epoch sections */
+  rule_t *active_rules; /* the set the capture thread last matched with */
+
+  int data_link_offset;
+
+  settings_t *settings;
+
+  recorder_t *recorder;
+  exporter_t *exporter;
+
+  FILE *alert_log;
+  compression_stats_t alert_log_compression;
+
+  uint64_t benign_packets;
+
+  counters_t counters;
+  stats_t *stats;
+  metrics_t *metrics;
+  segment_t *segment;
+  reloader_t *reloader;
+  scan_detector_t *scans; /* NULL when no scan threshold is set */
+  rate_detector_t *rates; /* NULL when no rate threshold is set */
+}
+context_t;
+
 /* IP header structure */
 typedef struct ip_header_tag
 {
@@ -245,7 +245,7 @@ static int parse_literal(state_t* state)
     if ( rc == '(' )
     {
         int capturing;
-        const char* input_start;
+        const char* input_start = state->input;
 
         state->depth++;
 
@@ -259,7 +259,6 @@ static int parse_literal(state_t* state)
         }
         else
         {
-            input_start = state->input;
             capturing = 1;
         }
 
@@ -0,0 +1,433 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "talkers.h"
+
+/* Like the stage timing, every thread counts in its own summaries. The
+   owner copies them for reports once a second, and only when no report
+   holds the lock, so it never waits for one. Summaries of several
+   threads merge by adding the counts of the keys they share; a key
+   missing from one of them may have had up to its smallest count there,
+   which is added to both its count and its error. */
+
+__thread talkers_t *thread_talkers = NULL;
+
+talkers_t *all_talkers = NULL;
+pthread_mutex_t talkers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+char *talker_names[TALKER_SUMMARIES] = {
+  "src_ip_packets", "src_ip_bytes", "dst_ip_packets", "dst_ip_bytes",
+  "dst_port_packets", "dst_port_bytes", "flow_packets", "flow_bytes"
+};
+
+void count_talker (talker_summary_t *, uint64_t [2], uint32_t, uint64_t);
+int find_slot (talker_summary_t *, uint64_t [2], uint32_t);
+void remove_slot (talker_summary_t *, int);
+void sift_up (talker_summary_t *, int);
+void sift_down (talker_summary_t *, int);
+void place_count (talker_summary_t *, int, talker_count_t);
+uint32_t hash_key (uint64_t [2]);
+uint64_t smallest_count (talker_summary_t *);
+talker_t *find_talker (talker_summary_t *, talker_t *);
+void merge_summary (talker_summary_t *, talker_summary_t *);
+int compare_talkers (const void *, const void *);
+void clear_summary (talker_summary_t *);
+
+talkers_t *talkers_init (void)
+{
+  talkers_t *talkers = (talkers_t *) calloc (1, sizeof (talkers_t));
+  if (talkers == NULL)
+  {
+    fprintf (stderr, "Could not allocate the heavy hitter summaries\n");
+    exit (EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < TALKER_SUMMARIES; i++)
+  {
+    clear_summary (&(talkers->live[i]));
+    clear_summary (&(talkers->published[i]));
+  }
+
+  pthread_mutex_lock (&talkers_mutex);
+  talkers->next = all_talkers;
+  all_talkers = talkers;
+  pthread_mutex_unlock (&talkers_mutex);
+
+  thread_talkers = talkers;
+
+  return talkers;
+}
+
+/* Called by the owner for every valid packet */
+void talkers_add (talkers_t *talkers, packet_t *packet, const struct pcap_pkthdr *pkthdr)
+{
+  uint64_t keys[TALKER_SUMMARIES / 2][2] = {
+    {packet->source_IP, 0},
+    {packet->dest_IP, 0},
+    {0, packet->dest_port},
+    {((uint64_t) packet->source_IP << 32) | packet->dest_IP,
+     ((uint64_t) packet->source_port << 24) | ((uint64_t) packet->dest_port << 8) | packet->protocol}
+  };
+
+  for (int i = 0; i < TALKER_SUMMARIES / 2; i++)
+  {
+    uint32_t hash = hash_key (keys[i]);
+
+    count_talker (&(talkers->live[2 * i]), keys[i], hash, 1);
+    count_talker (&(talkers->live[2 * i + 1]), keys[i], hash, pkthdr->len);
+  }
+
+  if ((int64_t) pkthdr->ts.tv_sec != talkers->published_second && talkers_publish (talkers) == true)
+  {
+    talkers->published_second = (int64_t) pkthdr->ts.tv_sec;
+  }
+}
+
+/* Copies the summaries for reports, unless one is being made. Returns
+   false if it did not. */
+bool talkers_publish (talkers_t *talkers)
+{
+  if (pthread_mutex_trylock (&talkers_mutex) != 0)
+  {
+    return false;
+  }
+
+  memcpy (talkers->published, talkers->live, sizeof (talkers->live));
+
+  pthread_mutex_unlock (&talkers_mutex);
+
+  return true;
+}
+
+/* Merges the published summaries of all threads, each sorted by count
+   from the largest. Returns TALKER_SUMMARIES summaries to free. */
+talker_summary_t *talkers_load (void)
+{
+  talker_summary_t *merged = (talker_summary_t *) calloc (TALKER_SUMMARIES, sizeof (talker_summary_t));
+
+  pthread_mutex_lock (&talkers_mutex);
+
+  for (talkers_t *talkers = all_talkers; talkers != NULL; talkers = talkers->next)
+  {
+    for (int i = 0; i < TALKER_SUMMARIES; i++)
+    {
+      merge_summary (&(merged[i]), &(talkers->published[i]));
+    }
+  }
+
+  pthread_mutex_unlock (&talkers_mutex);
+
+  for (int i = 0; i < TALKER_SUMMARIES; i++)
+  {
+    qsort (merged[i].talkers, merged[i].number_of_talkers, sizeof (talker_t), compare_talkers);
+  }
+
+  return merged;
+}
+
+char *talker_name (int summary)
+{
+  return talker_names[summary];
+}
+
+/* The key of a talker of the summary as text without spaces, in a
+   buffer of LINE_LENGTH */
+void format_talker (char *text, int summary, talker_t *talker)
+{
+  struct in_addr address;
+  char source[STRING_LENGTH];
+  char dest[STRING_LENGTH];
+
+  switch (summary / 2)
+  {
+  case 0:
+  case 1:
+    address.s_addr = htonl ((uint32_t) talker->key[0]);
+    inet_ntop (AF_INET, &address, text, STRING_LENGTH);
+    break;
+
+  case 2:
+    snprintf (text, STRING_LENGTH, "%d", (int) talker->key[1]);
+    break;
+
+  default:
+    address.s_addr = htonl ((uint32_t) (talker->key[0] >> 32));
+    inet_ntop (AF_INET, &address, source, STRING_LENGTH);
+    address.s_addr = htonl ((uint32_t) talker->key[0]);
+    inet_ntop (AF_INET, &address, dest, STRING_LENGTH);
+
+    snprintf (text, LINE_LENGTH, "%s:%s:%d->%s:%d",
+              (talker->key[1] & 0xFF) == IPPROTO_TCP ? "tcp" : "udp",
+              source, (int) (talker->key[1] >> 24), dest, (int) ((talker->key[1] >> 8) & 0xFFFF));
+  }
+}
+
+/* Space-Saving: adds weight to the counter of key, or gives key the
+   smallest counter when it has none and all are taken */
+void count_talker (talker_summary_t *summary, uint64_t key[2], uint32_t hash, uint64_t weight)
+{
+  summary->total += weight;
+
+  int slot = find_slot (summary, key, hash);
+  int number = summary->index[slot];
+  talker_t *talker;
+
+  if (number >= 0)
+  {
+    talker = &(summary->talkers[number]);
+    talker->count += weight;
+
+    summary->heap[talker->position].count = talker->count;
+    sift_down (summary, talker->position);
+
+    return;
+  }
+
+  int position;
+
+  if (summary->number_of_talkers < TALKER_COUNTERS)
+  {
+    number = summary->number_of_talkers++;
+    position = number;
+
+    talker = &(summary->talkers[number]);
+    talker->count = 0;
+    talker->error = 0;
+  }
+  else
+  {
+    number = summary->heap[0].talker;
+    position = 0;
+
+    talker = &(summary->talkers[number]);
+    talker->error = talker->count;
+
+    remove_slot (summary, talker->slot);
+    slot = find_slot (summary, key, hash);
+  }
+
+  talker->key[0] = key[0];
+  talker->key[1] = key[1];
+  talker->hash = hash;
+  talker->count += weight;
+  talker->slot = (int16_t) slot;
+
+  summary->index[slot] = (int16_t) number;
+
+  summary->heap[position].count = talker->count;
+  summary->heap[position].talker = number;
+
+  if (position > 0)
+  {
+    sift_up (summary, position);
+  }
+  else
+  {
+    sift_down (summary, position);
+  }
+}
+
+/* The slot of key in the index, or the free slot where it would go */
+int find_slot (talker_summary_t *summary, uint64_t key[2], uint32_t hash)
+{
+  int slot = (int) (hash & (TALKER_SLOTS - 1));
+
+  while (summary->index[slot] >= 0)
+  {
+    talker_t *talker = &(summary->talkers[summary->index[slot]]);
+
+    if (talker->hash == hash && talker->key[0] == key[0] && talker->key[1] == key[1])
+    {
+      break;
+    }
+
+    slot = (slot + 1) & (TALKER_SLOTS - 1);
+  }
+
+  return slot;
+}
+
+/* Frees slot and moves back the talkers after it that would not be found
+   across the hole any more */
+void remove_slot (talker_summary_t *summary, int slot)
+{
+  int hole = slot;
+
+  summary->index[hole] = -1;
+
+  for (int next = (hole + 1) & (TALKER_SLOTS - 1); summary->index[next] >= 0;
+       next = (next + 1) & (TALKER_SLOTS - 1))
+  {
+    talker_t *talker = &(summary->talkers[summary->index[next]]);
+    int home = (int) (talker->hash & (TALKER_SLOTS - 1));
+
+    if (((next - home) & (TALKER_SLOTS - 1)) >= ((next - hole) & (TALKER_SLOTS - 1)))
+    {
+      summary->index[hole] = summary->index[next];
+      summary->index[next] = -1;
+      talker->slot = (int16_t) hole;
+      hole = next;
+    }
+  }
+}
+
+/* The heap entry at position moves to where its count belongs; the
+   entries it passes are moved into the hole it leaves */
+void sift_up (talker_summary_t *summary, int position)
+{
+  talker_count_t moving = summary->heap[position];
+
+  while (position > 0)
+  {
+    int parent = (position - 1) / 2;
+
+    if (summary->heap[parent].count <= moving.count)
+    {
+      break;
+    }
+
+    place_count (summary, position, summary->heap[parent]);
+    position = parent;
+  }
+
+  place_count (summary, position, moving);
+}
+
+void sift_down (talker_summary_t *summary, int position)
+{
+  talker_count_t *heap = summary->heap;
+  talker_count_t moving = heap[position];
+
+  for (;;)
+  {
+    int child = 2 * position + 1;
+
+    if (child >= summary->number_of_talkers)
+    {
+      break;
+    }
+
+    if (child + 1 < summary->number_of_talkers && heap[child + 1].count < heap[child].count)
+    {
+      child++;
+    }
+
+    if (heap[child].count >= moving.count)
+    {
+      break;
+    }
+
+    place_count (summary, position, heap[child]);
+    position = child;
+  }
+
+  place_count (summary, position, moving);
+}
+
+void place_count (talker_summary_t *summary, int position, talker_count_t count)
+{
+  summary->heap[position] = count;
+  summary->talkers[count.talker].position = (int16_t) position;
+}
+
+uint32_t hash_key (uint64_t key[2])
+{
+  uint64_t hash = (key[0] ^ (key[1] * FNV_PRIME)) * 0x9E3779B97F4A7C15ULL;
+
+  return (uint32_t) (hash >> 32);
+}
+
+/* What a key the summary has no counter for may have been counted */
+uint64_t smallest_count (talker_summary_t *summary)
+{
+  if (summary->number_of_talkers < TALKER_COUNTERS)
+  {
+    return 0;
+  }
+
+  uint64_t smallest = UINT64_MAX;
+
+  for (int i = 0; i < summary->number_of_talkers; i++)
+  {
+    if (summary->talkers[i].count < smallest)
+    {
+      smallest = summary->talkers[i].count;
+    }
+  }
+
+  return smallest;
+}
+
+talker_t *find_talker (talker_summary_t *summary, talker_t *wanted)
+{
+  for (int i = 0; i < summary->number_of_talkers; i++)
+  {
+    talker_t *talker = &(summary->talkers[i]);
+
+    if (talker->key[0] == wanted->key[0] && talker->key[1] == wanted->key[1])
+    {
+      return talker;
+    }
+  }
+
+  return NULL;
+}
+
+/* Adds from to into and keeps the TALKER_COUNTERS largest counts. Only
+   the talkers of into are kept, not its heap or index: merged summaries
+   are only read. */
+void merge_summary (talker_summary_t *into, talker_summary_t *from)
+{
+  talker_t merged[2 * TALKER_COUNTERS];
+  int number = 0;
+
+  uint64_t into_smallest = smallest_count (into);
+  uint64_t from_smallest = smallest_count (from);
+
+  for (int i = 0; i < into->number_of_talkers; i++)
+  {
+    talker_t *talker = &(into->talkers[i]);
+    talker_t *other = find_talker (from, talker);
+
+    merged[number] = *talker;
+    merged[number].count += other != NULL ? other->count : from_smallest;
+    merged[number].error += other != NULL ? other->error : from_smallest;
+    number++;
+  }
+
+  for (int i = 0; i < from->number_of_talkers; i++)
+  {
+    talker_t *talker = &(from->talkers[i]);
+
+    if (find_talker (into, talker) == NULL)
+    {
+      merged[number] = *talker;
+      merged[number].count += into_smallest;
+      merged[number].error += into_smallest;
+      number++;
+    }
+  }
+
+  qsort (merged, number, sizeof (talker_t), compare_talkers);
+
+  into->number_of_talkers = number < TALKER_COUNTERS ? number : TALKER_COUNTERS;
+  into->total += from->total;
+
+  memcpy (into->talkers, merged, into->number_of_talkers * sizeof (talker_t));
+}
+
+/* Largest count first */
+int compare_talkers (const void *a, const void *b)
+{
+  uint64_t count_a = ((const talker_t *) a)->count;
+  uint64_t count_b = ((const talker_t *) b)->count;
+
+  return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+void clear_summary (talker_summary_t *summary)
+{
+  memset (summary, 0, sizeof (talker_summary_t));
+  memset (summary->index, 0xFF, sizeof (summary->index));
+}
@@ -0,0 +1,15 @@
+#ifndef TALKERS_H
+#define TALKERS_H
+
+#include "structures.h"
+
+extern __thread talkers_t *thread_talkers;
+
+talkers_t *talkers_init (void);
+void talkers_add (talkers_t *, packet_t *, const struct pcap_pkthdr *);
+bool talkers_publish (talkers_t *);
+talker_summary_t *talkers_load (void);
+char *talker_name (int);
+void format_talker (char *, int, talker_t *);
+
+#endif
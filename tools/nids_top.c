@@ -0,0 +1,173 @@
+#include "libraries.h"
+#include "definitions.h"
+#include "structures.h"
+
+#include "segment.h"
+
+/* Top-like view of the counters a running my_nids publishes with -T.
+   Attaches read-only, so it can neither slow down nor disturb capture. */
+
+#define CLEAR_SCREEN "\x1B[H\x1B[2J"
+
+segment_data_t *attach (char *);
+void show (segment_data_t *);
+double percent (uint64_t, uint64_t);
+void print_usage (char *);
+
+int main (int argc, char *argv[])
+{
+  int delay = 1;
+  int iterations = -1;
+
+  int c;
+
+  while ((c = getopt (argc, argv, "d:n:")) != -1)
+  {
+    switch (c)
+    {
+    case 'd':
+      delay = (int) atol (optarg);
+      break;
+
+    case 'n':
+      iterations = (int) atol (optarg);
+      break;
+
+    default:
+      print_usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  if (optind != argc - 1 || delay < 1)
+  {
+    print_usage (argv[0]);
+    exit (EXIT_FAILURE);
+  }
+
+  segment_data_t *shared = attach (argv[optind]);
+  segment_data_t copy;
+
+  for (int i = 0; iterations < 0 || i < iterations; i++)
+  {
+    if (i > 0)
+    {
+      sleep (delay);
+    }
+
+    /* A busy segment is retried, it does not use up an iteration */
+    while (segment_read (shared, &copy) == false)
+    {
+      fprintf (stderr, "Segment is busy, retrying\n");
+    }
+
+    show (&copy);
+  }
+
+  munmap (shared, sizeof (segment_data_t));
+
+  return 0;
+}
+
+void print_usage (char *program)
+{
+  fprintf (stderr, "Usage: %s [-d seconds] [-n iterations] segment_name\n", program);
+  fprintf (stderr, "  -d S   refresh every S seconds (default: 1)\n");
+  fprintf (stderr, "  -n N   exit after N screens (default: run until interrupted)\n");
+}
+
+segment_data_t *attach (char *name)
+{
+  int fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0)
+  {
+    fprintf (stderr, "Could not open shared memory %s, is my_nids running with -T?\n", name);
+    exit (EXIT_FAILURE);
+  }
+
+  segment_data_t *shared = (segment_data_t *) mmap (NULL, sizeof (segment_data_t), PROT_READ,
+                                                    MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (shared == MAP_FAILED)
+  {
+    fprintf (stderr, "Could not map shared memory %s\n", name);
+    exit (EXIT_FAILURE);
+  }
+
+  if (__atomic_load_n (&(shared->magic), __ATOMIC_ACQUIRE) != SEGMENT_MAGIC ||
+      shared->version != SEGMENT_VERSION)
+  {
+    fprintf (stderr, "%s is not a version %d stats segment\n", name, SEGMENT_VERSION);
+    exit (EXIT_FAILURE);
+  }
+
+  return shared;
+}
+
+double percent (uint64_t part, uint64_t whole)
+{
+  return whole > 0 ? 100.0 * (double) part / (double) whole : 0;
+}
+
+void show (segment_data_t *data)
+{
+  time_t now = time (NULL);
+
+  printf (CLEAR_SCREEN);
+  printf ("my_nids pid %ld, up %lds, updated %lds ago\n\n",
+          (long) data->pid, (long) (now - data->started), (long) (now - data->updated));
+
+  if (data->capture_available == true)
+  {
+    printf ("Capture    received %lu  dropped %lu (%.2f%%, %.0f/s)  interface dropped %lu\n",
+            (long unsigned) data->capture_received, (long unsigned) data->capture_dropped,
+            percent (data->capture_dropped, data->capture_received + data->capture_dropped),
+            data->drops_per_second, (long unsigned) data->capture_interface_dropped);
+  }
+  else
+  {
+    printf ("Capture    no kernel statistics\n");
+  }
+
+  printf ("Packets    %lu  parsed %lu  rejected %lu  matched %lu  alerts %lu  log bytes %lu\n",
+          (long unsigned) data->packets, (long unsigned) data->parsed,
+          (long unsigned) data->rejected, (long unsigned) data->matched,
+          (long unsigned) data->alerts, (long unsigned) data->output_bytes);
+
+  printf ("Recorder   %lu of %lu records (%.0f%%)\n",
+          (long unsigned) data->recorder_used, (long unsigned) data->recorder_size,
+          percent (data->recorder_used, data->recorder_size));
+
+  if (data->exporting == true)
+  {
+    printf ("Export     queue %lu of %lu bytes (%.1f%%)  written %lu  dropped %lu\n",
+            (long unsigned) data->export_queue_used, (long unsigned) data->export_queue_size,
+            percent (data->export_queue_used, data->export_queue_size),
+            (long unsigned) data->export_packets, (long unsigned) data->export_dropped);
+  }
+
+  printf ("\n%-8s %14s %14s %14s\n", "worker", "packets/s", "packets", "matched");
+
+  for (int i = 0; i < data->number_of_workers && i < SEGMENT_WORKERS; i++)
+  {
+    segment_worker_t *worker = &(data->workers[i]);
+
+    printf ("%-8d %14.0f %14lu %14lu\n", i, worker->packets_per_second,
+            (long unsigned) worker->packets, (long unsigned) worker->matched);
+  }
+
+  printf ("\n%-8s %12s %14s  %s (%d rules)\n", "rule", "hits/s", "hits", "message", data->number_of_rules);
+
+  for (int i = 0; i < data->number_of_top_rules && i < SEGMENT_TOP_RULES; i++)
+  {
+    segment_rule_t *rule = &(data->top_rules[i]);
+
+    rule->message[SEGMENT_MESSAGE_LENGTH - 1] = '\0';
+
+    printf ("%-8d %12.1f %14lu  %s\n", rule->id + 1, rule->hits_per_second,
+            (long unsigned) rule->hits, rule->message);
+  }
+
+  fflush (stdout);
+}